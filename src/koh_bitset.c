@@ -0,0 +1,287 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+
+#include "koh_bitset.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+struct koh_BitSet {
+    uint64_t    *words;
+    int64_t     words_num;
+    // base - lo, выровненный вниз на 64
+    uint32_t    lo, hi, base;
+    int         num;
+};
+
+koh_BitSet *bset_new(uint32_t lo, uint32_t hi) {
+    if (lo > hi)
+        return NULL;
+
+    koh_BitSet *bs = calloc(1, sizeof(*bs));
+    if (!bs)
+        return NULL;
+    bs->lo = lo;
+    bs->hi = hi;
+    bs->base = lo & ~63u;
+    bs->words_num = ((uint64_t)hi - bs->base) / 64 + 1;
+    // Запас до 4 слов для векторного цикла.
+    bs->words = calloc((bs->words_num + 3) & ~3, sizeof(*bs->words));
+    if (!bs->words) {
+        free(bs);
+        return NULL;
+    }
+    return bs;
+}
+
+void bset_free(koh_BitSet *bs) {
+    if (!bs)
+        return;
+    free(bs->words);
+    free(bs);
+}
+
+static inline bool bset_key(
+    const koh_BitSet *bs, const void *key, int key_len, uint32_t *bit
+) {
+    if (key_len != sizeof(uint32_t))
+        return false;
+    uint32_t value;
+    memcpy(&value, key, sizeof(value));
+    if (value < bs->lo || value > bs->hi)
+        return false;
+    *bit = value - bs->base;
+    return true;
+}
+
+bool bset_add(koh_BitSet *bs, const void *key, int key_len) {
+    assert(bs);
+
+    uint32_t bit;
+    if (!bset_key(bs, key, key_len, &bit))
+        return false;
+    uint64_t mask = 1ULL << (bit & 63);
+    uint64_t *w = &bs->words[bit >> 6];
+    if (*w & mask)
+        return false;
+    *w |= mask;
+    bs->num++;
+    return true;
+}
+
+bool bset_exist(koh_BitSet *bs, const void *key, int key_len) {
+    assert(bs);
+
+    uint32_t bit;
+    if (!bset_key(bs, key, key_len, &bit))
+        return false;
+    return bs->words[bit >> 6] & (1ULL << (bit & 63));
+}
+
+bool bset_remove(koh_BitSet *bs, const void *key, int key_len) {
+    assert(bs);
+
+    uint32_t bit;
+    if (!bset_key(bs, key, key_len, &bit))
+        return false;
+    uint64_t mask = 1ULL << (bit & 63);
+    uint64_t *w = &bs->words[bit >> 6];
+    if (!(*w & mask))
+        return false;
+    *w &= ~mask;
+    bs->num--;
+    return true;
+}
+
+koh_BitSet *bset_from_set(koh_Set *set, uint32_t lo, uint32_t hi) {
+    assert(set);
+
+    koh_BitSet *bs = bset_new(lo, hi);
+    if (!bs)
+        return NULL;
+    for (struct koh_SetView v = set_each_begin(set);
+            set_each_valid(&v); set_each_next(&v)) {
+        uint32_t bit;
+        if (!bset_key(bs, set_each_key(&v), set_each_key_len(&v), &bit)) {
+            bset_free(bs);
+            return NULL;
+        }
+        bs->words[bit >> 6] |= 1ULL << (bit & 63);
+    }
+    bs->num = set_size(set);
+    return bs;
+}
+
+void bset_to_set(koh_BitSet *bs, koh_Set *set) {
+    assert(bs);
+    assert(set);
+
+    for (struct koh_BitSetView v = bset_each_begin(bs);
+            bset_each_valid(&v); bset_each_next(&v))
+        set_add(set, &v.key, sizeof(v.key));
+}
+
+void bset_clear(koh_BitSet *bs) {
+    assert(bs);
+    memset(bs->words, 0, sizeof(*bs->words) * bs->words_num);
+    bs->num = 0;
+}
+
+int bset_size(koh_BitSet *bs) {
+    assert(bs);
+    return bs->num;
+}
+
+uint32_t bset_lo(koh_BitSet *bs) {
+    assert(bs);
+    return bs->lo;
+}
+
+uint32_t bset_hi(koh_BitSet *bs) {
+    assert(bs);
+    return bs->hi;
+}
+
+static int words_popcount(const uint64_t *words, int64_t num) {
+    int64_t count = 0;
+    for (int64_t i = 0; i < num; i++)
+        count += __builtin_popcountll(words[i]);
+    return count;
+}
+
+static bool bset_same_range(const koh_BitSet *a, const koh_BitSet *b) {
+    return a->lo == b->lo && a->hi == b->hi;
+}
+
+bool bset_union(koh_BitSet *dst, const koh_BitSet *src) {
+    assert(dst);
+    assert(src);
+
+    if (!bset_same_range(dst, src))
+        return false;
+
+    int64_t i = 0;
+#ifdef __AVX2__
+    // Хвост массива дополнен нулями до кратного 4.
+    for (; i < dst->words_num; i += 4) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)&dst->words[i]);
+        __m256i b = _mm256_loadu_si256((const __m256i*)&src->words[i]);
+        _mm256_storeu_si256((__m256i*)&dst->words[i], _mm256_or_si256(a, b));
+    }
+#endif
+    for (; i < dst->words_num; i++)
+        dst->words[i] |= src->words[i];
+    dst->num = words_popcount(dst->words, dst->words_num);
+    return true;
+}
+
+bool bset_intersect(koh_BitSet *dst, const koh_BitSet *src) {
+    assert(dst);
+    assert(src);
+
+    if (!bset_same_range(dst, src))
+        return false;
+
+    int64_t i = 0;
+#ifdef __AVX2__
+    for (; i < dst->words_num; i += 4) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)&dst->words[i]);
+        __m256i b = _mm256_loadu_si256((const __m256i*)&src->words[i]);
+        _mm256_storeu_si256((__m256i*)&dst->words[i], _mm256_and_si256(a, b));
+    }
+#endif
+    for (; i < dst->words_num; i++)
+        dst->words[i] &= src->words[i];
+    dst->num = words_popcount(dst->words, dst->words_num);
+    return true;
+}
+
+bool bset_compare(const koh_BitSet *bs1, const koh_BitSet *bs2) {
+    assert(bs1);
+    assert(bs2);
+
+    if (bs1->num != bs2->num)
+        return false;
+    if (bset_same_range(bs1, bs2))
+        return !memcmp(
+            bs1->words, bs2->words, sizeof(*bs1->words) * bs1->words_num
+        );
+
+    for (struct koh_BitSetView v = bset_each_begin((koh_BitSet*)bs1);
+            bset_each_valid(&v); bset_each_next(&v)) {
+        if (!bset_exist((koh_BitSet*)bs2, &v.key, sizeof(v.key)))
+            return false;
+    }
+    return true;
+}
+
+void bset_each(koh_BitSet *bs, koh_SetEachCb cb, void *udata) {
+    assert(bs);
+    assert(cb);
+
+    for (int64_t i = 0; i < bs->words_num; i++) {
+        uint64_t bits = bs->words[i];
+        while (bits) {
+            int bit = __builtin_ctzll(bits);
+            bits &= bits - 1;
+            uint32_t key = bs->base + i * 64 + bit;
+
+            koh_SetAction action = cb(&key, sizeof(key), udata);
+            if (action == koh_SA_remove_next ||
+                    action == koh_SA_remove_break) {
+                bs->words[i] &= ~(1ULL << bit);
+                bs->num--;
+            }
+            if (action == koh_SA_break || action == koh_SA_remove_break)
+                return;
+        }
+    }
+}
+
+// Перейти к следующему установленному биту начиная с v->bits.
+static void view_seek(struct koh_BitSetView *v) {
+    while (!v->bits) {
+        if (++v->word >= v->bs->words_num)
+            return;
+        v->bits = v->bs->words[v->word];
+    }
+    int bit = __builtin_ctzll(v->bits);
+    v->bits &= v->bits - 1;
+    v->key = v->bs->base + v->word * 64 + bit;
+}
+
+struct koh_BitSetView bset_each_begin(koh_BitSet *bs) {
+    assert(bs);
+
+    struct koh_BitSetView v = {
+        .bs = bs,
+        .word = 0,
+        .bits = bs->words[0],
+    };
+    view_seek(&v);
+    return v;
+}
+
+bool bset_each_valid(struct koh_BitSetView *v) {
+    assert(v);
+    return v->word < v->bs->words_num;
+}
+
+void bset_each_next(struct koh_BitSetView *v) {
+    assert(v);
+    view_seek(v);
+}
+
+const void *bset_each_key(struct koh_BitSetView *v) {
+    assert(v);
+    return &v->key;
+}
+
+int bset_each_key_len(struct koh_BitSetView *v) {
+    assert(v);
+    return sizeof(v->key);
+}
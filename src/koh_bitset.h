@@ -0,0 +1,60 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+#pragma once
+
+#include "koh_set.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+Множество 4-байтовых целых из известного диапазона [lo, hi] на битовом
+массиве. Ключи передаются как в koh_Set - указателем и длиной, длина
+должна быть sizeof(uint32_t). Память - бит на значение диапазона,
+add/exist/remove - одно слово, объединение и пересечение идут по словам
+(AVX2 при сборке с -mavx2), обход - поиском установленных битов.
+
+Для тегов и id, плотных в своем диапазоне, koh_Set переводится в битовое
+множество через bset_from_set().
+*/
+
+typedef struct koh_BitSet koh_BitSet;
+
+struct koh_BitSetView {
+    koh_BitSet  *bs;
+    int64_t     word;
+    // еще не пройденные биты текущего слова
+    uint64_t    bits;
+    uint32_t    key;
+};
+
+// NULL если lo > hi.
+koh_BitSet *bset_new(uint32_t lo, uint32_t hi);
+// NULL если есть ключ не из 4 байт или вне [lo, hi].
+koh_BitSet *bset_from_set(koh_Set *set, uint32_t lo, uint32_t hi);
+void bset_free(koh_BitSet *bs);
+// Добавляет ключи в set.
+void bset_to_set(koh_BitSet *bs, koh_Set *set);
+
+// false для ключа вне диапазона или другой длины.
+bool bset_add(koh_BitSet *bs, const void *key, int key_len);
+bool bset_exist(koh_BitSet *bs, const void *key, int key_len);
+bool bset_remove(koh_BitSet *bs, const void *key, int key_len);
+void bset_clear(koh_BitSet *bs);
+int bset_size(koh_BitSet *bs);
+uint32_t bset_lo(koh_BitSet *bs);
+uint32_t bset_hi(koh_BitSet *bs);
+
+// dst |= src и dst &= src, диапазоны должны совпадать.
+bool bset_union(koh_BitSet *dst, const koh_BitSet *src);
+bool bset_intersect(koh_BitSet *dst, const koh_BitSet *src);
+bool bset_compare(const koh_BitSet *bs1, const koh_BitSet *bs2);
+
+// Обход по возрастанию, поддерживает koh_SA_remove_next и
+// koh_SA_remove_break.
+void bset_each(koh_BitSet *bs, koh_SetEachCb cb, void *udata);
+
+struct koh_BitSetView bset_each_begin(koh_BitSet *bs);
+bool bset_each_valid(struct koh_BitSetView *v);
+void bset_each_next(struct koh_BitSetView *v);
+const void *bset_each_key(struct koh_BitSetView *v);
+int bset_each_key_len(struct koh_BitSetView *v);
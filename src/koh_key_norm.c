@@ -0,0 +1,212 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+
+#include "koh_key_norm.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Маски дополняются до кратного 16 байтам размера.
+#define LANE_BYTES  16
+
+#define F32_ABS     0x7fffffffU
+#define F32_INF     0x7f800000U
+#define F32_QNAN    0x7fc00000U
+#define F64_ABS     0x7fffffffffffffffULL
+#define F64_INF     0x7ff0000000000000ULL
+#define F64_QNAN    0x7ff8000000000000ULL
+
+struct koh_KeyNorm {
+    int         key_size, padded_size;
+    bool        has_f64;
+    // 0x00 для байтов выравнивания, иначе 0xff
+    uint8_t     *keep;
+    // 0xff во всех байтах поля float/double
+    uint8_t     *f32, *f64;
+};
+
+koh_KeyNorm *key_norm_new(int key_size) {
+    assert(key_size > 0);
+
+    koh_KeyNorm *norm = calloc(1, sizeof(*norm));
+    if (!norm)
+        return NULL;
+    norm->key_size = key_size;
+    norm->padded_size = (key_size + LANE_BYTES - 1) & ~(LANE_BYTES - 1);
+    norm->keep = aligned_alloc(LANE_BYTES, norm->padded_size * 3);
+    if (!norm->keep) {
+        free(norm);
+        return NULL;
+    }
+    norm->f32 = norm->keep + norm->padded_size;
+    norm->f64 = norm->f32 + norm->padded_size;
+    memset(norm->keep, 0xff, norm->key_size);
+    memset(norm->keep + key_size, 0, norm->padded_size - key_size);
+    memset(norm->f32, 0, norm->padded_size * 2);
+    return norm;
+}
+
+void key_norm_free(koh_KeyNorm *norm) {
+    if (!norm)
+        return;
+    free(norm->keep);
+    free(norm);
+}
+
+void key_norm_float(koh_KeyNorm *norm, int offset, int count) {
+    assert(norm);
+    assert(offset >= 0);
+    assert(offset + count * (int)sizeof(float) <= norm->key_size);
+    // SSE обрабатывает поля по 4 байта от начала ключа.
+    assert(offset % sizeof(float) == 0);
+    memset(norm->f32 + offset, 0xff, count * sizeof(float));
+}
+
+void key_norm_double(koh_KeyNorm *norm, int offset, int count) {
+    assert(norm);
+    assert(offset >= 0);
+    assert(offset + count * (int)sizeof(double) <= norm->key_size);
+    memset(norm->f64 + offset, 0xff, count * sizeof(double));
+    norm->has_f64 = true;
+}
+
+void key_norm_padding(koh_KeyNorm *norm, int offset, int len) {
+    assert(norm);
+    assert(offset >= 0);
+    assert(offset + len <= norm->key_size);
+    memset(norm->keep + offset, 0, len);
+}
+
+int key_norm_key_size(const koh_KeyNorm *norm) {
+    assert(norm);
+    return norm->key_size;
+}
+
+static inline uint32_t norm_f32(uint32_t x) {
+    uint32_t abs = x & F32_ABS;
+    // все единицы если условие истинно
+    uint32_t is_zero = -(uint32_t)(abs == 0);
+    uint32_t is_nan = -(uint32_t)(abs > F32_INF);
+    x &= ~is_zero;
+    return (x & ~is_nan) | (F32_QNAN & is_nan);
+}
+
+static inline uint64_t norm_f64(uint64_t x) {
+    uint64_t abs = x & F64_ABS;
+    uint64_t is_zero = -(uint64_t)(abs == 0);
+    uint64_t is_nan = -(uint64_t)(abs > F64_INF);
+    x &= ~is_zero;
+    return (x & ~is_nan) | (F64_QNAN & is_nan);
+}
+
+static void norm_lane(const koh_KeyNorm *norm, uint8_t *dst, int off) {
+#if defined(__SSE2__)
+    __m128i x = _mm_and_si128(
+        _mm_loadu_si128((const __m128i*)(dst + off)),
+        _mm_load_si128((const __m128i*)(norm->keep + off))
+    );
+    __m128i f32 = _mm_load_si128((const __m128i*)(norm->f32 + off));
+    __m128i abs = _mm_and_si128(x, _mm_set1_epi32(F32_ABS));
+    __m128i is_zero = _mm_cmpeq_epi32(abs, _mm_setzero_si128());
+    // abs не больше 0x7fffffff, знаковое сравнение подходит
+    __m128i is_nan = _mm_cmpgt_epi32(abs, _mm_set1_epi32(F32_INF));
+    __m128i y = _mm_andnot_si128(is_zero, x);
+    y = _mm_or_si128(
+        _mm_andnot_si128(is_nan, y),
+        _mm_and_si128(is_nan, _mm_set1_epi32(F32_QNAN))
+    );
+    // в полях float берется y, в остальных байтах x
+    x = _mm_or_si128(_mm_and_si128(f32, y), _mm_andnot_si128(f32, x));
+    _mm_storeu_si128((__m128i*)(dst + off), x);
+#else
+    for (int i = 0; i < LANE_BYTES; i += 4) {
+        uint32_t x, keep, f32;
+        memcpy(&x, dst + off + i, 4);
+        memcpy(&keep, norm->keep + off + i, 4);
+        memcpy(&f32, norm->f32 + off + i, 4);
+        x &= keep;
+        x = (norm_f32(x) & f32) | (x & ~f32);
+        memcpy(dst + off + i, &x, 4);
+    }
+#endif
+}
+
+void key_norm_apply(const koh_KeyNorm *norm, void *dst, const void *src) {
+    assert(norm);
+    assert(dst);
+    assert(src);
+
+    int full = norm->key_size & ~(LANE_BYTES - 1);
+    if (dst != src)
+        memmove(dst, src, norm->key_size);
+
+    for (int off = 0; off < full; off += LANE_BYTES)
+        norm_lane(norm, dst, off);
+
+    if (full < norm->key_size) {
+        _Alignas(LANE_BYTES) uint8_t tail[LANE_BYTES] = {};
+        int tail_len = norm->key_size - full;
+        memcpy(tail, (uint8_t*)dst + full, tail_len);
+        // маски смещены на full, поэтому хвост нормализуется отдельно
+        struct koh_KeyNorm shifted = *norm;
+        shifted.keep += full;
+        shifted.f32 += full;
+        norm_lane(&shifted, tail, 0);
+        memcpy((uint8_t*)dst + full, tail, tail_len);
+    }
+
+    if (!norm->has_f64)
+        return;
+
+    uint8_t *p = dst;
+    for (int off = 0; off + 8 <= norm->key_size; off++) {
+        if (!norm->f64[off])
+            continue;
+        uint64_t x;
+        memcpy(&x, p + off, 8);
+        x = norm_f64(x);
+        memcpy(p + off, &x, 8);
+        off += 7;
+    }
+}
+
+void key_norm_hook(void *dst, const void *src, int key_size, void *udata) {
+    assert(udata);
+    assert(key_size == ((koh_KeyNorm*)udata)->key_size);
+    key_norm_apply(udata, dst, src);
+}
+
+bool set_add_norm(
+    koh_Set *set, const koh_KeyNorm *norm, const void *key, int key_len
+) {
+    assert(key_len == norm->key_size);
+    uint8_t buf[norm->padded_size];
+    key_norm_apply(norm, buf, key);
+    int num = set_size(set);
+    set_add(set, buf, key_len);
+    return set_size(set) > num;
+}
+
+bool set_exist_norm(
+    koh_Set *set, const koh_KeyNorm *norm, const void *key, int key_len
+) {
+    assert(key_len == norm->key_size);
+    uint8_t buf[norm->padded_size];
+    key_norm_apply(norm, buf, key);
+    return set_exist(set, buf, key_len);
+}
+
+bool set_remove_norm(
+    koh_Set *set, const koh_KeyNorm *norm, const void *key, int key_len
+) {
+    assert(key_len == norm->key_size);
+    uint8_t buf[norm->padded_size];
+    key_norm_apply(norm, buf, key);
+    int num = set_size(set);
+    set_remove(set, buf, key_len);
+    return set_size(set) < num;
+}
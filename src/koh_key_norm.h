@@ -0,0 +1,49 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+#pragma once
+
+#include "koh_set.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+Приведение ключей к каноническому виду перед хешированием и сравнением:
+    - float/double: -0.0 становится 0.0, любой NAN - тихим NAN без полезной
+      нагрузки;
+    - байты выравнивания обнуляются.
+
+Описание строится один раз на тип ключа, key_norm_apply() работает без
+ветвлений по маскам, для float полей используется SSE2.
+
+    koh_KeyNorm *norm = key_norm_new(sizeof(Vector2));
+    key_norm_float(norm, 0, 2);
+*/
+
+typedef struct koh_KeyNorm koh_KeyNorm;
+
+koh_KeyNorm *key_norm_new(int key_size);
+void key_norm_free(koh_KeyNorm *norm);
+
+// count подряд идущих полей начиная со смещения offset
+void key_norm_float(koh_KeyNorm *norm, int offset, int count);
+void key_norm_double(koh_KeyNorm *norm, int offset, int count);
+// len байт начиная с offset всегда обнуляются
+void key_norm_padding(koh_KeyNorm *norm, int offset, int len);
+
+int key_norm_key_size(const koh_KeyNorm *norm);
+// dst и src размером key_size, могут совпадать.
+void key_norm_apply(const koh_KeyNorm *norm, void *dst, const void *src);
+
+// Для koh_MapSetup.normalize, udata - koh_KeyNorm.
+void key_norm_hook(void *dst, const void *src, int key_size, void *udata);
+
+// Обертки koh_Set, ключ нормализуется в буфер на стеке.
+bool set_add_norm(
+    koh_Set *set, const koh_KeyNorm *norm, const void *key, int key_len
+);
+bool set_exist_norm(
+    koh_Set *set, const koh_KeyNorm *norm, const void *key, int key_len
+);
+bool set_remove_norm(
+    koh_Set *set, const koh_KeyNorm *norm, const void *key, int key_len
+);
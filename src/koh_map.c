@@ -0,0 +1,479 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+
+#include "koh_map.h"
+#include "koh_set_hash.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum SlotState {
+    SLOT_EMPTY      = 0,
+    SLOT_TAKEN      = 1,
+    SLOT_DELETED    = 2,
+};
+
+/*
+В state младшие 2 бита - SlotState, старшие - эпоха записи. Запись чужой
+эпохи считается пустой, поэтому map_clear() только увеличивает эпоху, а
+таблица обнуляется раз в 2^30 очисток.
+*/
+struct SlotHeader {
+    uint32_t    hash, state;
+};
+
+#define EPOCH_SHIFT     2
+#define EPOCH_MAX       (UINT32_MAX >> EPOCH_SHIFT)
+
+struct koh_Map {
+    uint8_t     *slots;
+    int64_t     cap;            // степень двойки
+    int64_t     taken, deleted;
+    uint32_t    epoch;
+    int         key_size, value_size;
+    int         slot_size, key_offset, value_offset;
+
+    koh_MapNormalize    normalize;
+    void                *normalize_udata;
+    koh_MapExtract      extract;
+    void                *extract_udata;
+    // размер буфера для значимых байт ключа с длинами участков
+    int                 gather_size;
+};
+
+// Ключ запроса, подготовленный для поиска.
+struct Probe {
+    // ключ целиком, после приведения
+    const void      *key;
+    // значимые байты, при отсутствии extract - весь ключ
+    const uint8_t   *bytes;
+    int             len;
+    uint32_t        hash;
+};
+
+#define MAP_MIN_CAP     16
+
+static int align8(int n) {
+    return (n + 7) & ~7;
+}
+
+static inline struct SlotHeader *slot_at(const koh_Map *map, int64_t i) {
+    return (struct SlotHeader*)(map->slots + i * map->slot_size);
+}
+
+static inline void *slot_key(const koh_Map *map, struct SlotHeader *slot) {
+    return (uint8_t*)slot + map->key_offset;
+}
+
+static inline void *slot_value(const koh_Map *map, struct SlotHeader *slot) {
+    return (uint8_t*)slot + map->value_offset;
+}
+
+static inline enum SlotState state_of(uint32_t state, uint32_t epoch) {
+    if (state >> EPOCH_SHIFT != epoch)
+        return SLOT_EMPTY;
+    return state & ((1u << EPOCH_SHIFT) - 1);
+}
+
+static inline enum SlotState slot_state(
+    const koh_Map *map, const struct SlotHeader *slot
+) {
+    return state_of(slot->state, map->epoch);
+}
+
+static inline void slot_set_state(
+    const koh_Map *map, struct SlotHeader *slot, enum SlotState state
+) {
+    slot->state = map->epoch << EPOCH_SHIFT | state;
+}
+
+static bool map_alloc_slots(koh_Map *map, int64_t cap) {
+    uint8_t *slots = calloc(cap, map->slot_size);
+    if (!slots)
+        return false;
+    map->slots = slots;
+    map->cap = cap;
+    map->taken = map->deleted = 0;
+    map->epoch = 0;
+    return true;
+}
+
+koh_Map *map_new(const struct koh_MapSetup *setup) {
+    assert(setup);
+    assert(setup->key_size > 0);
+    assert(setup->value_size >= 0);
+
+    koh_Map *map = calloc(1, sizeof(*map));
+    if (!map)
+        return NULL;
+
+    map->key_size = setup->key_size;
+    map->value_size = setup->value_size;
+    map->key_offset = sizeof(struct SlotHeader);
+    map->value_offset = map->key_offset + align8(setup->key_size);
+    map->slot_size = map->value_offset + align8(setup->value_size);
+    map->normalize = setup->normalize;
+    map->normalize_udata = setup->normalize_udata;
+    map->extract = setup->extract;
+    map->extract_udata = setup->extract_udata;
+    map->gather_size = setup->key_size +
+        KOH_MAP_KEY_RANGES_MAX * sizeof(uint32_t);
+
+    int64_t cap = MAP_MIN_CAP;
+    while (cap < setup->capacity)
+        cap *= 2;
+
+    if (!map_alloc_slots(map, cap)) {
+        free(map);
+        return NULL;
+    }
+    return map;
+}
+
+void map_free(koh_Map *map) {
+    if (!map)
+        return;
+    free(map->slots);
+    free(map);
+}
+
+/*
+Собирает значимые участки ключа в buf: длина участка (uint32_t) и его
+байты. Длины нужны, чтобы "ab" + "c" и "a" + "bc" не совпадали.
+*/
+static int map_gather(const koh_Map *map, const void *key, uint8_t *buf) {
+    struct koh_KeyRange ranges[KOH_MAP_KEY_RANGES_MAX];
+    int ranges_num = map->extract(key, ranges, map->extract_udata);
+    assert(ranges_num >= 0 && ranges_num <= KOH_MAP_KEY_RANGES_MAX);
+
+    const uint8_t *key_begin = key, *key_end = key_begin + map->key_size;
+    int len = 0;
+    for (int i = 0; i < ranges_num; i++) {
+        const uint8_t *ptr = ranges[i].ptr;
+        uint32_t range_len = ranges[i].len;
+        assert(ptr >= key_begin && ptr + range_len <= key_end);
+        memcpy(buf + len, &range_len, sizeof(range_len));
+        len += sizeof(range_len);
+        memcpy(buf + len, ptr, range_len);
+        len += range_len;
+    }
+    return len;
+}
+
+/*
+norm_buf размером key_size нужен при normalize, gather_buf размером
+gather_size - при extract.
+*/
+static inline struct Probe map_probe(
+    const koh_Map *map, const void *key, uint8_t *norm_buf, uint8_t *gather_buf
+) {
+    struct Probe p = { .key = key, };
+    if (map->normalize) {
+        map->normalize(norm_buf, key, map->key_size, map->normalize_udata);
+        p.key = norm_buf;
+    }
+    if (map->extract) {
+        p.len = map_gather(map, p.key, gather_buf);
+        p.bytes = gather_buf;
+    } else {
+        p.len = map->key_size;
+        p.bytes = p.key;
+    }
+    p.hash = set_hash_bytes(p.bytes, p.len);
+    return p;
+}
+
+#define MAP_PROBE_BUFFERS(map) \
+    uint8_t norm_buf[(map)->normalize ? (map)->key_size : 1]; \
+    uint8_t gather_buf[(map)->extract ? (map)->gather_size : 1]
+
+static inline bool map_key_equal(
+    const koh_Map *map, struct SlotHeader *slot, const struct Probe *p
+) {
+    if (!map->extract)
+        return !memcmp(slot_key(map, slot), p->bytes, p->len);
+
+    // Участки записи сравниваются с собранным ключом запроса без копирования.
+    struct koh_KeyRange ranges[KOH_MAP_KEY_RANGES_MAX];
+    int ranges_num = map->extract(
+        slot_key(map, slot), ranges, map->extract_udata
+    );
+    int off = 0;
+    for (int i = 0; i < ranges_num; i++) {
+        uint32_t range_len = ranges[i].len;
+        if (off + sizeof(range_len) + range_len > (size_t)p->len)
+            return false;
+        if (memcmp(p->bytes + off, &range_len, sizeof(range_len)))
+            return false;
+        off += sizeof(range_len);
+        if (memcmp(p->bytes + off, ranges[i].ptr, range_len))
+            return false;
+        off += range_len;
+    }
+    return off == p->len;
+}
+
+/*
+Возвращает запись с ключом или, если ключа нет, запись куда его можно
+вставить (первую удаленную на пути пробирования либо пустую).
+*/
+static struct SlotHeader *map_find(
+    const koh_Map *map, const struct Probe *p, bool *found
+) {
+    int64_t mask = map->cap - 1;
+    struct SlotHeader *insert_slot = NULL;
+
+    for (int64_t i = p->hash & mask;; i = (i + 1) & mask) {
+        struct SlotHeader *slot = slot_at(map, i);
+        switch (slot_state(map, slot)) {
+            case SLOT_EMPTY:
+                *found = false;
+                return insert_slot ? insert_slot : slot;
+            case SLOT_DELETED:
+                if (!insert_slot)
+                    insert_slot = slot;
+                break;
+            default:
+                if (slot->hash == p->hash && map_key_equal(map, slot, p)) {
+                    *found = true;
+                    return slot;
+                }
+        }
+    }
+}
+
+static bool map_rehash(koh_Map *map, int64_t new_cap) {
+    uint8_t *old_slots = map->slots;
+    int64_t old_cap = map->cap;
+    uint32_t old_epoch = map->epoch;
+
+    if (!map_alloc_slots(map, new_cap))
+        return false;
+
+    for (int64_t i = 0; i < old_cap; i++) {
+        struct SlotHeader *old = (void*)(old_slots + i * map->slot_size);
+        if (state_of(old->state, old_epoch) != SLOT_TAKEN)
+            continue;
+        int64_t j = old->hash & (map->cap - 1);
+        while (slot_state(map, slot_at(map, j)) != SLOT_EMPTY)
+            j = (j + 1) & (map->cap - 1);
+        memcpy(slot_at(map, j), old, map->slot_size);
+        slot_set_state(map, slot_at(map, j), SLOT_TAKEN);
+        map->taken++;
+    }
+
+    free(old_slots);
+    return true;
+}
+
+void *map_upsert(koh_Map *map, const void *key, int key_len, bool *created) {
+    assert(map);
+    assert(key);
+
+    if (key_len != map->key_size) {
+        if (created)
+            *created = false;
+        return NULL;
+    }
+
+    // Занятые и удаленные вместе не больше 3/4 емкости.
+    if ((map->taken + map->deleted + 1) * 4 > map->cap * 3) {
+        int64_t cap = map->cap;
+        if ((map->taken + 1) * 2 > cap)
+            cap *= 2;
+        if (!map_rehash(map, cap)) {
+            fprintf(stderr, "map_upsert: allocation failed\n");
+            abort();
+        }
+    }
+
+    MAP_PROBE_BUFFERS(map);
+    struct Probe p = map_probe(map, key, norm_buf, gather_buf);
+    bool found;
+    struct SlotHeader *slot = map_find(map, &p, &found);
+
+    if (created)
+        *created = !found;
+    if (found)
+        return slot_value(map, slot);
+
+    if (slot_state(map, slot) == SLOT_DELETED)
+        map->deleted--;
+    slot->hash = p.hash;
+    slot_set_state(map, slot, SLOT_TAKEN);
+    memcpy(slot_key(map, slot), p.key, map->key_size);
+    memset(slot_value(map, slot), 0, map->value_size);
+    map->taken++;
+    return slot_value(map, slot);
+}
+
+void *map_add(koh_Map *map, const void *key, int key_len, const void *value) {
+    void *slot_value = map_upsert(map, key, key_len, NULL);
+    if (!slot_value)
+        return NULL;
+    if (value)
+        memcpy(slot_value, value, map->value_size);
+    else
+        memset(slot_value, 0, map->value_size);
+    return slot_value;
+}
+
+void *map_get(koh_Map *map, const void *key, int key_len) {
+    assert(map);
+    assert(key);
+
+    if (key_len != map->key_size)
+        return NULL;
+
+    MAP_PROBE_BUFFERS(map);
+    struct Probe p = map_probe(map, key, norm_buf, gather_buf);
+    bool found;
+    struct SlotHeader *slot = map_find(map, &p, &found);
+    return found ? slot_value(map, slot) : NULL;
+}
+
+bool map_exist(koh_Map *map, const void *key, int key_len) {
+    return map_get(map, key, key_len) != NULL;
+}
+
+static void map_remove_slot(koh_Map *map, struct SlotHeader *slot) {
+    slot_set_state(map, slot, SLOT_DELETED);
+    map->taken--;
+    map->deleted++;
+}
+
+bool map_remove(koh_Map *map, const void *key, int key_len) {
+    assert(map);
+    assert(key);
+
+    if (key_len != map->key_size)
+        return false;
+
+    MAP_PROBE_BUFFERS(map);
+    struct Probe p = map_probe(map, key, norm_buf, gather_buf);
+    bool found;
+    struct SlotHeader *slot = map_find(map, &p, &found);
+    if (found)
+        map_remove_slot(map, slot);
+    return found;
+}
+
+void map_clear(koh_Map *map) {
+    assert(map);
+    if (map->epoch == EPOCH_MAX) {
+        memset(map->slots, 0, map->cap * map->slot_size);
+        map->epoch = 0;
+    } else {
+        map->epoch++;
+    }
+    map->taken = map->deleted = 0;
+}
+
+int map_size(koh_Map *map) {
+    assert(map);
+    return map->taken;
+}
+
+int map_key_size(koh_Map *map) {
+    assert(map);
+    return map->key_size;
+}
+
+int map_value_size(koh_Map *map) {
+    assert(map);
+    return map->value_size;
+}
+
+bool map_compare(koh_Map *m1, koh_Map *m2) {
+    assert(m1);
+    assert(m2);
+
+    if (m1->taken != m2->taken || m1->key_size != m2->key_size ||
+            m1->value_size != m2->value_size)
+        return false;
+
+    for (int64_t i = 0; i < m1->cap; i++) {
+        struct SlotHeader *slot = slot_at(m1, i);
+        if (slot_state(m1, slot) != SLOT_TAKEN)
+            continue;
+        const void *value = map_get(m2, slot_key(m1, slot), m1->key_size);
+        if (!value || memcmp(value, slot_value(m1, slot), m1->value_size))
+            return false;
+    }
+    return true;
+}
+
+void map_each(koh_Map *map, koh_MapEachCb cb, void *udata) {
+    assert(map);
+    assert(cb);
+
+    // Удаление только помечает запись, поэтому обход не сбивается.
+    for (int64_t i = 0; i < map->cap; i++) {
+        struct SlotHeader *slot = slot_at(map, i);
+        if (slot_state(map, slot) != SLOT_TAKEN)
+            continue;
+
+        koh_SetAction action = cb(
+            slot_key(map, slot), map->key_size,
+            slot_value(map, slot), map->value_size, udata
+        );
+
+        switch (action) {
+            case koh_SA_remove_next:
+                map_remove_slot(map, slot);
+                break;
+            case koh_SA_remove_break:
+                map_remove_slot(map, slot);
+                return;
+            case koh_SA_break:
+                return;
+            default:
+                break;
+        }
+    }
+}
+
+static int64_t map_next_taken(const koh_Map *map, int64_t i) {
+    while (i < map->cap && slot_state(map, slot_at(map, i)) != SLOT_TAKEN)
+        i++;
+    return i;
+}
+
+struct koh_MapView map_each_begin(koh_Map *map) {
+    assert(map);
+    return (struct koh_MapView) {
+        .map = map,
+        .i = map_next_taken(map, 0),
+    };
+}
+
+bool map_each_valid(struct koh_MapView *v) {
+    assert(v);
+    return v->i < v->map->cap;
+}
+
+void map_each_next(struct koh_MapView *v) {
+    assert(v);
+    v->i = map_next_taken(v->map, v->i + 1);
+}
+
+const void *map_each_key(struct koh_MapView *v) {
+    assert(v);
+    return slot_key(v->map, slot_at(v->map, v->i));
+}
+
+int map_each_key_len(struct koh_MapView *v) {
+    assert(v);
+    return v->map->key_size;
+}
+
+void *map_each_value(struct koh_MapView *v) {
+    assert(v);
+    return slot_value(v->map, slot_at(v->map, v->i));
+}
+
+int map_each_value_len(struct koh_MapView *v) {
+    assert(v);
+    return v->map->value_size;
+}
@@ -0,0 +1,95 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+#pragma once
+
+#include "koh_set.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+Таблица ключ-значение с ключами фиксированного размера. Хеширование и
+обход устроены как в koh_Set, значение хранится в той же записи что и
+ключ, поэтому поиск с доступом к значению - одно обращение к таблице.
+
+Запись:   uint32_t hash | uint32_t state | key | value
+Ключ и значение выровнены на 8 байт. Указатель на значение действителен
+до следующей вставки, которая может перестроить таблицу.
+*/
+
+typedef struct koh_Map koh_Map;
+
+typedef void (*koh_MapNormalize)(
+    void *dst, const void *src, int key_size, void *udata
+);
+
+#define KOH_MAP_KEY_RANGES_MAX  8
+
+// Участок ключа, ptr указывает внутрь ключа.
+struct koh_KeyRange {
+    const void  *ptr;
+    int         len;
+};
+
+// Заполняет ranges значимыми участками ключа, возвращает их количество.
+typedef int (*koh_MapExtract)(
+    const void *key, struct koh_KeyRange ranges[KOH_MAP_KEY_RANGES_MAX],
+    void *udata
+);
+
+struct koh_MapSetup {
+    int                 key_size, value_size;
+    // начальная емкость в записях, 0 - по умолчанию
+    int                 capacity;
+    // Приведение ключа перед хешированием и сравнением, может быть NULL.
+    // В таблице хранится приведенный ключ. См. koh_key_norm.h
+    koh_MapNormalize    normalize;
+    void                *normalize_udata;
+    // Хешируются и сравниваются только участки ключа, которые вернул
+    // extract, например Rectangle и strlen(name) байт имени. В таблице
+    // ключ хранится целиком. Может быть NULL.
+    koh_MapExtract      extract;
+    void                *extract_udata;
+};
+
+struct koh_MapView {
+    koh_Map *map;
+    int64_t i;
+};
+
+typedef koh_SetAction (*koh_MapEachCb)(
+    const void *key, int key_len, void *value, int value_len, void *udata
+);
+
+koh_Map *map_new(const struct koh_MapSetup *setup);
+void map_free(koh_Map *map);
+
+// Вставка или перезапись. value == NULL - значение заполняется нулями.
+// Возвращает указатель на значение в таблице, NULL если длина ключа
+// не совпадает с key_size.
+void *map_add(koh_Map *map, const void *key, int key_len, const void *value);
+// Найти или вставить ключ с нулевым значением за один проход пробирования.
+// created, если не NULL, сообщает была ли вставка. NULL как у map_add.
+void *map_upsert(koh_Map *map, const void *key, int key_len, bool *created);
+// NULL если ключа нет.
+void *map_get(koh_Map *map, const void *key, int key_len);
+bool map_exist(koh_Map *map, const void *key, int key_len);
+bool map_remove(koh_Map *map, const void *key, int key_len);
+// O(1): записи помечаются устаревшими сменой эпохи, емкость сохраняется.
+void map_clear(koh_Map *map);
+int map_size(koh_Map *map);
+int map_key_size(koh_Map *map);
+int map_value_size(koh_Map *map);
+// Одинаковые ключи и побайтово равные значения. Ключи ищутся в m2 по
+// его правилам приведения и выделения участков.
+bool map_compare(koh_Map *m1, koh_Map *m2);
+
+// Поддерживает koh_SA_remove_next и koh_SA_remove_break.
+void map_each(koh_Map *map, koh_MapEachCb cb, void *udata);
+
+struct koh_MapView map_each_begin(koh_Map *map);
+bool map_each_valid(struct koh_MapView *v);
+void map_each_next(struct koh_MapView *v);
+const void *map_each_key(struct koh_MapView *v);
+int map_each_key_len(struct koh_MapView *v);
+void *map_each_value(struct koh_MapView *v);
+int map_each_value_len(struct koh_MapView *v);
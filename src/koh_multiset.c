@@ -0,0 +1,150 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+
+#include "koh_multiset.h"
+#include <assert.h>
+#include <stdlib.h>
+
+struct koh_MultiSet {
+    koh_Map     *map;
+    uint64_t    total;
+};
+
+koh_MultiSet *mset_new(int key_size) {
+    koh_MultiSet *mset = calloc(1, sizeof(*mset));
+    if (!mset)
+        return NULL;
+    mset->map = map_new(&(struct koh_MapSetup) {
+        .key_size = key_size,
+        .value_size = sizeof(uint32_t),
+    });
+    if (!mset->map) {
+        free(mset);
+        return NULL;
+    }
+    return mset;
+}
+
+void mset_free(koh_MultiSet *mset) {
+    if (!mset)
+        return;
+    map_free(mset->map);
+    free(mset);
+}
+
+uint32_t mset_add(koh_MultiSet *mset, const void *key, int key_len) {
+    assert(mset);
+
+    // Новая запись приходит с нулевым счетчиком.
+    uint32_t *count = map_upsert(mset->map, key, key_len, NULL);
+    if (!count)
+        return 0;
+    mset->total++;
+    return ++*count;
+}
+
+uint32_t mset_remove(koh_MultiSet *mset, const void *key, int key_len) {
+    assert(mset);
+
+    uint32_t *count = map_get(mset->map, key, key_len);
+    if (!count)
+        return 0;
+
+    mset->total--;
+    uint32_t left = --*count;
+    if (!left)
+        map_remove(mset->map, key, key_len);
+    return left;
+}
+
+bool mset_remove_all(koh_MultiSet *mset, const void *key, int key_len) {
+    assert(mset);
+
+    uint32_t *count = map_get(mset->map, key, key_len);
+    if (!count)
+        return false;
+    mset->total -= *count;
+    return map_remove(mset->map, key, key_len);
+}
+
+uint32_t mset_count(koh_MultiSet *mset, const void *key, int key_len) {
+    assert(mset);
+    uint32_t *count = map_get(mset->map, key, key_len);
+    return count ? *count : 0;
+}
+
+bool mset_exist(koh_MultiSet *mset, const void *key, int key_len) {
+    assert(mset);
+    return map_exist(mset->map, key, key_len);
+}
+
+void mset_clear(koh_MultiSet *mset) {
+    assert(mset);
+    map_clear(mset->map);
+    mset->total = 0;
+}
+
+int mset_size(koh_MultiSet *mset) {
+    assert(mset);
+    return map_size(mset->map);
+}
+
+uint64_t mset_total(koh_MultiSet *mset) {
+    assert(mset);
+    return mset->total;
+}
+
+struct EachCtx {
+    koh_MultiSet        *mset;
+    koh_MultiSetEachCb  cb;
+    void                *udata;
+};
+
+static koh_SetAction iter_each(
+    const void *key, int key_len, void *value, int value_len, void *udata
+) {
+    struct EachCtx *ctx = udata;
+    (void)value_len;
+    uint32_t count = *(uint32_t*)value;
+    koh_SetAction action = ctx->cb(key, key_len, count, ctx->udata);
+    if (action == koh_SA_remove_next || action == koh_SA_remove_break)
+        ctx->mset->total -= count;
+    return action;
+}
+
+void mset_each(koh_MultiSet *mset, koh_MultiSetEachCb cb, void *udata) {
+    assert(mset);
+    assert(cb);
+
+    struct EachCtx ctx = {
+        .mset = mset,
+        .cb = cb,
+        .udata = udata,
+    };
+    map_each(mset->map, iter_each, &ctx);
+}
+
+struct koh_MultiSetView mset_each_begin(koh_MultiSet *mset) {
+    assert(mset);
+    return (struct koh_MultiSetView) { .v = map_each_begin(mset->map), };
+}
+
+bool mset_each_valid(struct koh_MultiSetView *v) {
+    return map_each_valid(&v->v);
+}
+
+void mset_each_next(struct koh_MultiSetView *v) {
+    map_each_next(&v->v);
+}
+
+const void *mset_each_key(struct koh_MultiSetView *v) {
+    return map_each_key(&v->v);
+}
+
+int mset_each_key_len(struct koh_MultiSetView *v) {
+    return map_each_key_len(&v->v);
+}
+
+uint32_t mset_each_count(struct koh_MultiSetView *v) {
+    return *(uint32_t*)map_each_value(&v->v);
+}
@@ -0,0 +1,51 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+#pragma once
+
+#include "koh_map.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+Множество со счетчиком для ключей фиксированного размера. Счетчик лежит
+в записи koh_Map рядом с ключом: mset_add увеличивает его, mset_remove
+уменьшает и удаляет ключ на нуле. Подходит для учета ссылок на текстуры и
+звуки без отдельной таблицы.
+*/
+
+typedef struct koh_MultiSet koh_MultiSet;
+
+struct koh_MultiSetView {
+    struct koh_MapView  v;
+};
+
+typedef koh_SetAction (*koh_MultiSetEachCb)(
+    const void *key, int key_len, uint32_t count, void *udata
+);
+
+koh_MultiSet *mset_new(int key_size);
+void mset_free(koh_MultiSet *mset);
+
+// Возвращают значение счетчика после операции, mset_remove - 0 если
+// ключ удален или отсутствовал, mset_add - 0 при неверной длине ключа.
+uint32_t mset_add(koh_MultiSet *mset, const void *key, int key_len);
+uint32_t mset_remove(koh_MultiSet *mset, const void *key, int key_len);
+// Удаляет ключ целиком, независимо от счетчика.
+bool mset_remove_all(koh_MultiSet *mset, const void *key, int key_len);
+uint32_t mset_count(koh_MultiSet *mset, const void *key, int key_len);
+bool mset_exist(koh_MultiSet *mset, const void *key, int key_len);
+void mset_clear(koh_MultiSet *mset);
+// Количество различных ключей.
+int mset_size(koh_MultiSet *mset);
+// Сумма счетчиков.
+uint64_t mset_total(koh_MultiSet *mset);
+
+// koh_SA_remove_* удаляет ключ целиком.
+void mset_each(koh_MultiSet *mset, koh_MultiSetEachCb cb, void *udata);
+
+struct koh_MultiSetView mset_each_begin(koh_MultiSet *mset);
+bool mset_each_valid(struct koh_MultiSetView *v);
+void mset_each_next(struct koh_MultiSetView *v);
+const void *mset_each_key(struct koh_MultiSetView *v);
+int mset_each_key_len(struct koh_MultiSetView *v);
+uint32_t mset_each_count(struct koh_MultiSetView *v);
@@ -0,0 +1,371 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+
+#include "koh_ordered_set.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Размер блока подбирается так, чтобы ключи занимали около 4 КиБ.
+#define BLOCK_BYTES     4096
+#define BLOCK_MIN_KEYS  8
+
+struct Block {
+    int     num;
+    uint8_t keys[];
+};
+
+struct koh_OrderedSet {
+    struct Block        **blocks;
+    int                 blocks_num, blocks_cap;
+    int                 key_size, block_cap, num;
+    koh_OrderedSetCmp   cmp;
+};
+
+int oset_cmp_int(const void *a, const void *b, int key_size) {
+    (void)key_size;
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+int oset_cmp_uint32(const void *a, const void *b, int key_size) {
+    (void)key_size;
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+int oset_cmp_bytes(const void *a, const void *b, int key_size) {
+    return memcmp(a, b, key_size);
+}
+
+static inline void *block_key(
+    const koh_OrderedSet *oset, struct Block *block, int i
+) {
+    return block->keys + (size_t)i * oset->key_size;
+}
+
+static void oom(const char *where) {
+    fprintf(stderr, "%s: allocation failed\n", where);
+    abort();
+}
+
+koh_OrderedSet *oset_new(int key_size, koh_OrderedSetCmp cmp) {
+    assert(key_size > 0);
+
+    koh_OrderedSet *oset = calloc(1, sizeof(*oset));
+    if (!oset)
+        return NULL;
+    oset->key_size = key_size;
+    oset->cmp = cmp ? cmp : oset_cmp_bytes;
+    oset->block_cap = BLOCK_BYTES / key_size;
+    if (oset->block_cap < BLOCK_MIN_KEYS)
+        oset->block_cap = BLOCK_MIN_KEYS;
+    return oset;
+}
+
+void oset_clear(koh_OrderedSet *oset) {
+    assert(oset);
+    for (int i = 0; i < oset->blocks_num; i++)
+        free(oset->blocks[i]);
+    oset->blocks_num = 0;
+    oset->num = 0;
+}
+
+void oset_free(koh_OrderedSet *oset) {
+    if (!oset)
+        return;
+    oset_clear(oset);
+    free(oset->blocks);
+    free(oset);
+}
+
+int oset_size(koh_OrderedSet *oset) {
+    assert(oset);
+    return oset->num;
+}
+
+static struct Block *block_new(koh_OrderedSet *oset) {
+    struct Block *block = malloc(
+        sizeof(*block) + (size_t)oset->block_cap * oset->key_size
+    );
+    if (!block)
+        oom("oset block_new");
+    block->num = 0;
+    return block;
+}
+
+static void blocks_insert(koh_OrderedSet *oset, int at, struct Block *block) {
+    if (oset->blocks_num == oset->blocks_cap) {
+        int cap = oset->blocks_cap ? oset->blocks_cap * 2 : 8;
+        struct Block **blocks = realloc(oset->blocks, sizeof(*blocks) * cap);
+        if (!blocks)
+            oom("oset blocks_insert");
+        oset->blocks = blocks;
+        oset->blocks_cap = cap;
+    }
+    memmove(
+        &oset->blocks[at + 1], &oset->blocks[at],
+        sizeof(*oset->blocks) * (oset->blocks_num - at)
+    );
+    oset->blocks[at] = block;
+    oset->blocks_num++;
+}
+
+static void blocks_erase(koh_OrderedSet *oset, int at) {
+    free(oset->blocks[at]);
+    memmove(
+        &oset->blocks[at], &oset->blocks[at + 1],
+        sizeof(*oset->blocks) * (oset->blocks_num - at - 1)
+    );
+    oset->blocks_num--;
+}
+
+// Первый блок, последний ключ которого >= key (или > key при strict).
+static int find_block(koh_OrderedSet *oset, const void *key, bool strict) {
+    int lo = 0, hi = oset->blocks_num;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        struct Block *block = oset->blocks[mid];
+        int c = oset->cmp(
+            block_key(oset, block, block->num - 1), key, oset->key_size
+        );
+        if (c < 0 || (strict && c == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Первый индекс в блоке с ключом >= key (или > key при strict).
+static int find_in_block(
+    koh_OrderedSet *oset, struct Block *block, const void *key, bool strict
+) {
+    int lo = 0, hi = block->num;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int c = oset->cmp(block_key(oset, block, mid), key, oset->key_size);
+        if (c < 0 || (strict && c == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+bool oset_exist(koh_OrderedSet *oset, const void *key, int key_len) {
+    assert(oset);
+    assert(key);
+
+    if (key_len != oset->key_size)
+        return false;
+
+    int b = find_block(oset, key, false);
+    if (b == oset->blocks_num)
+        return false;
+    struct Block *block = oset->blocks[b];
+    int i = find_in_block(oset, block, key, false);
+    return i < block->num &&
+        !oset->cmp(block_key(oset, block, i), key, oset->key_size);
+}
+
+bool oset_add(koh_OrderedSet *oset, const void *key, int key_len) {
+    assert(oset);
+    assert(key);
+    assert(key_len == oset->key_size);
+
+    if (!oset->blocks_num)
+        blocks_insert(oset, 0, block_new(oset));
+
+    int b = find_block(oset, key, false);
+    // Больше всех ключей - в конец последнего блока.
+    if (b == oset->blocks_num)
+        b--;
+
+    struct Block *block = oset->blocks[b];
+    int i = find_in_block(oset, block, key, false);
+    if (i < block->num &&
+            !oset->cmp(block_key(oset, block, i), key, oset->key_size))
+        return false;
+
+    if (block->num == oset->block_cap) {
+        // Деление пополам, правая половина в новый блок.
+        struct Block *right = block_new(oset);
+        int half = block->num / 2;
+        right->num = block->num - half;
+        memcpy(
+            right->keys, block_key(oset, block, half),
+            (size_t)right->num * oset->key_size
+        );
+        block->num = half;
+        blocks_insert(oset, b + 1, right);
+        if (i > half) {
+            block = right;
+            i -= half;
+        }
+    }
+
+    memmove(
+        block_key(oset, block, i + 1), block_key(oset, block, i),
+        (size_t)(block->num - i) * oset->key_size
+    );
+    memcpy(block_key(oset, block, i), key, oset->key_size);
+    block->num++;
+    oset->num++;
+    return true;
+}
+
+bool oset_remove(koh_OrderedSet *oset, const void *key, int key_len) {
+    assert(oset);
+    assert(key);
+
+    if (key_len != oset->key_size)
+        return false;
+
+    int b = find_block(oset, key, false);
+    if (b == oset->blocks_num)
+        return false;
+    struct Block *block = oset->blocks[b];
+    int i = find_in_block(oset, block, key, false);
+    if (i == block->num ||
+            oset->cmp(block_key(oset, block, i), key, oset->key_size))
+        return false;
+
+    memmove(
+        block_key(oset, block, i), block_key(oset, block, i + 1),
+        (size_t)(block->num - i - 1) * oset->key_size
+    );
+    block->num--;
+    oset->num--;
+
+    if (!block->num) {
+        blocks_erase(oset, b);
+    } else if (b + 1 < oset->blocks_num) {
+        // Слияние с правым соседом, если вместе занимают не больше половины.
+        struct Block *right = oset->blocks[b + 1];
+        if (block->num + right->num <= oset->block_cap / 2) {
+            memcpy(
+                block_key(oset, block, block->num), right->keys,
+                (size_t)right->num * oset->key_size
+            );
+            block->num += right->num;
+            blocks_erase(oset, b + 1);
+        }
+    }
+    return true;
+}
+
+const void *oset_min(koh_OrderedSet *oset) {
+    assert(oset);
+    if (!oset->blocks_num)
+        return NULL;
+    return block_key(oset, oset->blocks[0], 0);
+}
+
+const void *oset_max(koh_OrderedSet *oset) {
+    assert(oset);
+    if (!oset->blocks_num)
+        return NULL;
+    struct Block *last = oset->blocks[oset->blocks_num - 1];
+    return block_key(oset, last, last->num - 1);
+}
+
+// Позиция первого ключа >= key (> key при strict), конец - (blocks_num, 0).
+static void position(
+    koh_OrderedSet *oset, const void *key, bool strict, int *block, int *i
+) {
+    *block = find_block(oset, key, strict);
+    *i = *block < oset->blocks_num ?
+        find_in_block(oset, oset->blocks[*block], key, strict) : 0;
+}
+
+static struct koh_OrderedSetView view_to_end(
+    koh_OrderedSet *oset, int block, int i
+) {
+    return (struct koh_OrderedSetView) {
+        .oset = oset,
+        .block = block,
+        .i = i,
+        .end_block = oset->blocks_num,
+        .end_i = 0,
+    };
+}
+
+struct koh_OrderedSetView oset_each_begin(koh_OrderedSet *oset) {
+    assert(oset);
+    return view_to_end(oset, 0, 0);
+}
+
+struct koh_OrderedSetView oset_lower_bound(koh_OrderedSet *oset, const void *key) {
+    assert(oset);
+    assert(key);
+    int block, i;
+    position(oset, key, false, &block, &i);
+    return view_to_end(oset, block, i);
+}
+
+struct koh_OrderedSetView oset_upper_bound(koh_OrderedSet *oset, const void *key) {
+    assert(oset);
+    assert(key);
+    int block, i;
+    position(oset, key, true, &block, &i);
+    return view_to_end(oset, block, i);
+}
+
+struct koh_OrderedSetView oset_range(
+    koh_OrderedSet *oset, const void *lo, const void *hi
+) {
+    assert(oset);
+    assert(lo);
+    assert(hi);
+
+    struct koh_OrderedSetView v = oset_lower_bound(oset, lo);
+    if (oset->cmp(lo, hi, oset->key_size) >= 0) {
+        v.end_block = v.block;
+        v.end_i = v.i;
+    } else {
+        position(oset, hi, false, &v.end_block, &v.end_i);
+    }
+    return v;
+}
+
+bool oset_each_valid(struct koh_OrderedSetView *v) {
+    assert(v);
+    if (v->block < v->end_block)
+        return true;
+    return v->block == v->end_block && v->i < v->end_i;
+}
+
+void oset_each_next(struct koh_OrderedSetView *v) {
+    assert(v);
+    if (++v->i >= v->oset->blocks[v->block]->num) {
+        v->block++;
+        v->i = 0;
+    }
+}
+
+const void *oset_each_key(struct koh_OrderedSetView *v) {
+    assert(v);
+    return block_key(v->oset, v->oset->blocks[v->block], v->i);
+}
+
+int oset_each_key_len(struct koh_OrderedSetView *v) {
+    assert(v);
+    return v->oset->key_size;
+}
+
+void oset_each(
+    koh_OrderedSet *oset,
+    koh_SetAction (*cb)(const void *key, int key_len, void *udata),
+    void *udata
+) {
+    assert(oset);
+    assert(cb);
+
+    for (struct koh_OrderedSetView v = oset_each_begin(oset);
+            oset_each_valid(&v); oset_each_next(&v)) {
+        if (cb(oset_each_key(&v), oset->key_size, udata) == koh_SA_break)
+            break;
+    }
+}
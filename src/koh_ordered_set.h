@@ -0,0 +1,70 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+#pragma once
+
+#include "koh_set.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+Упорядоченное множество ключей фиксированного размера: отсортированный
+массив блоков. Поиск - двоичный поиск по последним ключам блоков, затем
+внутри блока. Обход идет по возрастанию, выборка диапазона [a, b) стоит
+O(log n + k).
+
+Позиция в представлении становится недействительной после изменения
+множества.
+*/
+
+typedef int (*koh_OrderedSetCmp)(const void *a, const void *b, int key_size);
+
+int oset_cmp_int(const void *a, const void *b, int key_size);
+int oset_cmp_uint32(const void *a, const void *b, int key_size);
+// Побайтовое сравнение, порядок memcmp.
+int oset_cmp_bytes(const void *a, const void *b, int key_size);
+
+typedef struct koh_OrderedSet koh_OrderedSet;
+
+struct koh_OrderedSetView {
+    koh_OrderedSet  *oset;
+    int             block, i;
+    // граница диапазона, не включается
+    int             end_block, end_i;
+};
+
+// cmp == NULL - oset_cmp_bytes
+koh_OrderedSet *oset_new(int key_size, koh_OrderedSetCmp cmp);
+void oset_free(koh_OrderedSet *oset);
+
+bool oset_add(koh_OrderedSet *oset, const void *key, int key_len);
+bool oset_remove(koh_OrderedSet *oset, const void *key, int key_len);
+bool oset_exist(koh_OrderedSet *oset, const void *key, int key_len);
+void oset_clear(koh_OrderedSet *oset);
+int oset_size(koh_OrderedSet *oset);
+
+// Наименьший и наибольший ключи, NULL для пустого множества.
+const void *oset_min(koh_OrderedSet *oset);
+const void *oset_max(koh_OrderedSet *oset);
+
+// Обход по возрастанию, поддерживает только koh_SA_next и koh_SA_break.
+void oset_each(
+    koh_OrderedSet *oset,
+    koh_SetAction (*cb)(const void *key, int key_len, void *udata),
+    void *udata
+);
+
+// Все ключи по возрастанию.
+struct koh_OrderedSetView oset_each_begin(koh_OrderedSet *oset);
+// От первого ключа >= key до конца.
+struct koh_OrderedSetView oset_lower_bound(koh_OrderedSet *oset, const void *key);
+// От первого ключа > key до конца.
+struct koh_OrderedSetView oset_upper_bound(koh_OrderedSet *oset, const void *key);
+// Ключи из [lo, hi).
+struct koh_OrderedSetView oset_range(
+    koh_OrderedSet *oset, const void *lo, const void *hi
+);
+
+bool oset_each_valid(struct koh_OrderedSetView *v);
+void oset_each_next(struct koh_OrderedSetView *v);
+const void *oset_each_key(struct koh_OrderedSetView *v);
+int oset_each_key_len(struct koh_OrderedSetView *v);
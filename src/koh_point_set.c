@@ -0,0 +1,278 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+
+#include "koh_point_set.h"
+#include "koh_map.h"
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct Cell {
+    int32_t x, y;
+};
+
+struct Point {
+    Vector2 p;
+    // следующая точка ячейки или свободная запись, -1 - конец списка
+    int32_t next;
+};
+
+struct koh_PointSet {
+    float           eps, eps2, inv_cell;
+    // ячейка -> индекс первой точки
+    koh_Map         *cells;
+    struct Point    *points;
+    int32_t         points_num, points_cap, free_head, num;
+};
+
+koh_PointSet *pset_new(float eps) {
+    assert(eps > 0.f);
+
+    koh_PointSet *pset = calloc(1, sizeof(*pset));
+    if (!pset)
+        return NULL;
+    pset->eps = eps;
+    pset->eps2 = eps * eps;
+    pset->inv_cell = 1.f / eps;
+    pset->free_head = -1;
+    pset->cells = map_new(&(struct koh_MapSetup) {
+        .key_size = sizeof(struct Cell),
+        .value_size = sizeof(int32_t),
+    });
+    if (!pset->cells) {
+        free(pset);
+        return NULL;
+    }
+    return pset;
+}
+
+void pset_free(koh_PointSet *pset) {
+    if (!pset)
+        return;
+    map_free(pset->cells);
+    free(pset->points);
+    free(pset);
+}
+
+static int32_t cell_coord(float v, float inv_cell) {
+    double c = floor((double)v * inv_cell);
+    if (c < INT32_MIN)
+        return INT32_MIN;
+    if (c > INT32_MAX)
+        return INT32_MAX;
+    return c;
+}
+
+static struct Cell cell_of(const koh_PointSet *pset, Vector2 p) {
+    return (struct Cell) {
+        .x = cell_coord(p.x, pset->inv_cell),
+        .y = cell_coord(p.y, pset->inv_cell),
+    };
+}
+
+static float dist2(Vector2 a, Vector2 b) {
+    float dx = a.x - b.x, dy = a.y - b.y;
+    return dx * dx + dy * dy;
+}
+
+/*
+Ищет ближайшую к p точку не дальше eps в соседних ячейках.
+Возвращает индекс точки или -1, prev - предыдущая точка в списке ячейки.
+*/
+static int32_t nearest(
+    koh_PointSet *pset, Vector2 p, struct Cell *cell_out, int32_t *prev_out
+) {
+    struct Cell c = cell_of(pset, p);
+    int32_t best = -1;
+    float best_d2 = pset->eps2;
+
+    for (int64_t y = (int64_t)c.y - 1; y <= (int64_t)c.y + 1; y++) {
+        for (int64_t x = (int64_t)c.x - 1; x <= (int64_t)c.x + 1; x++) {
+            if (x < INT32_MIN || x > INT32_MAX || y < INT32_MIN || y > INT32_MAX)
+                continue;
+            struct Cell nc = { x, y };
+            int32_t *head = map_get(pset->cells, &nc, sizeof(nc));
+            int32_t prev = -1;
+            for (int32_t i = head ? *head : -1; i != -1;
+                    prev = i, i = pset->points[i].next) {
+                float d2 = dist2(pset->points[i].p, p);
+                if (d2 <= best_d2) {
+                    best_d2 = d2;
+                    best = i;
+                    if (cell_out)
+                        *cell_out = nc;
+                    if (prev_out)
+                        *prev_out = prev;
+                }
+            }
+        }
+    }
+
+    return best;
+}
+
+static bool finite2(Vector2 p) {
+    return isfinite(p.x) && isfinite(p.y);
+}
+
+bool pset_add(koh_PointSet *pset, Vector2 p) {
+    assert(pset);
+
+    if (!finite2(p) || nearest(pset, p, NULL, NULL) != -1)
+        return false;
+
+    int32_t i;
+    if (pset->free_head != -1) {
+        i = pset->free_head;
+        pset->free_head = pset->points[i].next;
+    } else {
+        if (pset->points_num == pset->points_cap) {
+            int32_t cap = pset->points_cap ? pset->points_cap * 2 : 64;
+            struct Point *points = realloc(pset->points, sizeof(*points) * cap);
+            if (!points) {
+                fprintf(stderr, "pset_add: allocation failed\n");
+                abort();
+            }
+            pset->points = points;
+            pset->points_cap = cap;
+        }
+        i = pset->points_num++;
+    }
+
+    struct Cell c = cell_of(pset, p);
+    bool created;
+    int32_t *head = map_upsert(pset->cells, &c, sizeof(c), &created);
+    pset->points[i].p = p;
+    pset->points[i].next = created ? -1 : *head;
+    *head = i;
+    pset->num++;
+    return true;
+}
+
+bool pset_find(koh_PointSet *pset, Vector2 p, Vector2 *found) {
+    assert(pset);
+
+    if (!finite2(p))
+        return false;
+    int32_t i = nearest(pset, p, NULL, NULL);
+    if (i == -1)
+        return false;
+    if (found)
+        *found = pset->points[i].p;
+    return true;
+}
+
+bool pset_exist(koh_PointSet *pset, Vector2 p) {
+    return pset_find(pset, p, NULL);
+}
+
+bool pset_remove(koh_PointSet *pset, Vector2 p) {
+    assert(pset);
+
+    if (!finite2(p))
+        return false;
+
+    struct Cell c;
+    int32_t prev;
+    int32_t i = nearest(pset, p, &c, &prev);
+    if (i == -1)
+        return false;
+
+    int32_t next = pset->points[i].next;
+    if (prev != -1) {
+        pset->points[prev].next = next;
+    } else if (next != -1) {
+        *(int32_t*)map_get(pset->cells, &c, sizeof(c)) = next;
+    } else {
+        map_remove(pset->cells, &c, sizeof(c));
+    }
+
+    pset->points[i].next = pset->free_head;
+    pset->free_head = i;
+    pset->num--;
+    return true;
+}
+
+void pset_clear(koh_PointSet *pset) {
+    assert(pset);
+    map_clear(pset->cells);
+    pset->points_num = 0;
+    pset->free_head = -1;
+    pset->num = 0;
+}
+
+int pset_size(koh_PointSet *pset) {
+    assert(pset);
+    return pset->num;
+}
+
+float pset_eps(koh_PointSet *pset) {
+    assert(pset);
+    return pset->eps;
+}
+
+void pset_each(koh_PointSet *pset, koh_PointSetEachCb cb, void *udata) {
+    assert(pset);
+    assert(cb);
+
+    for (struct koh_MapView v = map_each_begin(pset->cells);
+            map_each_valid(&v); map_each_next(&v)) {
+        int32_t *head = map_each_value(&v);
+        for (int32_t i = *head; i != -1; i = pset->points[i].next) {
+            if (cb(pset->points[i].p, udata) == koh_SA_break)
+                return;
+        }
+    }
+}
+
+void pset_query_radius(
+    koh_PointSet *pset, Vector2 center, float radius,
+    koh_PointSetEachCb cb, void *udata
+) {
+    assert(pset);
+    assert(cb);
+
+    if (!finite2(center) || !(radius >= 0.f))
+        return;
+
+    float r2 = radius * radius;
+    struct Cell lo = cell_of(pset, (Vector2) {
+        center.x - radius, center.y - radius
+    });
+    struct Cell hi = cell_of(pset, (Vector2) {
+        center.x + radius, center.y + radius
+    });
+    double cells_num = ((double)hi.x - lo.x + 1.) * ((double)hi.y - lo.y + 1.);
+
+    // Если ячеек в окне больше чем занятых, дешевле обойти занятые.
+    if (cells_num > map_size(pset->cells)) {
+        for (struct koh_MapView v = map_each_begin(pset->cells);
+                map_each_valid(&v); map_each_next(&v)) {
+            const struct Cell *c = map_each_key(&v);
+            if (c->x < lo.x || c->x > hi.x || c->y < lo.y || c->y > hi.y)
+                continue;
+            int32_t *head = map_each_value(&v);
+            for (int32_t i = *head; i != -1; i = pset->points[i].next) {
+                if (dist2(pset->points[i].p, center) <= r2 &&
+                        cb(pset->points[i].p, udata) == koh_SA_break)
+                    return;
+            }
+        }
+        return;
+    }
+
+    for (int64_t y = lo.y; y <= hi.y; y++) {
+        for (int64_t x = lo.x; x <= hi.x; x++) {
+            struct Cell c = { x, y };
+            int32_t *head = map_get(pset->cells, &c, sizeof(c));
+            for (int32_t i = head ? *head : -1; i != -1;
+                    i = pset->points[i].next) {
+                if (dist2(pset->points[i].p, center) <= r2 &&
+                        cb(pset->points[i].p, udata) == koh_SA_break)
+                    return;
+            }
+        }
+    }
+}
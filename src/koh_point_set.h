@@ -0,0 +1,41 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+#pragma once
+
+#include "koh_set.h"
+#include "raylib.h"
+#include <stdbool.h>
+
+/*
+Множество точек Vector2 с допуском eps. Точки раскладываются по ячейкам
+равномерной сетки со стороной eps, поэтому проверка "есть ли точка ближе
+eps" смотрит только 3x3 соседние ячейки. Точки с NAN или бесконечностью
+не принимаются.
+*/
+
+typedef struct koh_PointSet koh_PointSet;
+
+typedef koh_SetAction (*koh_PointSetEachCb)(Vector2 p, void *udata);
+
+// eps > 0
+koh_PointSet *pset_new(float eps);
+void pset_free(koh_PointSet *pset);
+
+// false - если уже есть точка не дальше eps или координаты не конечны.
+bool pset_add(koh_PointSet *pset, Vector2 p);
+bool pset_exist(koh_PointSet *pset, Vector2 p);
+// Ближайшая точка не дальше eps, found может быть NULL.
+bool pset_find(koh_PointSet *pset, Vector2 p, Vector2 *found);
+// Удаляет ближайшую точку не дальше eps.
+bool pset_remove(koh_PointSet *pset, Vector2 p);
+void pset_clear(koh_PointSet *pset);
+int pset_size(koh_PointSet *pset);
+float pset_eps(koh_PointSet *pset);
+
+// Точки не дальше radius от center, порядок не определен.
+// Поддерживает koh_SA_next и koh_SA_break.
+void pset_query_radius(
+    koh_PointSet *pset, Vector2 center, float radius,
+    koh_PointSetEachCb cb, void *udata
+);
+void pset_each(koh_PointSet *pset, koh_PointSetEachCb cb, void *udata);
@@ -0,0 +1,388 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+
+#include "koh_rect_index.h"
+#include "koh_map.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Cell {
+    int32_t x, y;
+};
+
+// Диапазон ячеек, включительно.
+struct CellRange {
+    int32_t x0, y0, x1, y1;
+};
+
+struct Entry {
+    Rectangle   rect;
+    uint32_t    id;
+    // номер последнего запроса, видевшего объект
+    uint32_t    stamp;
+    // индекс в big или -1
+    int32_t     big;
+};
+
+// Звено списка объектов ячейки.
+struct Node {
+    int32_t entry, next;
+};
+
+struct koh_RectIndex {
+    float           cell_size, inv_cell;
+    struct Entry    *entries;
+    int32_t         entries_num, entries_cap;
+    // id -> индекс в entries
+    koh_Map         *ids;
+    // ячейка -> первое звено
+    koh_Map         *cells;
+    struct Node     *nodes;
+    int32_t         nodes_num, nodes_cap, nodes_free;
+    int32_t         *big;
+    int32_t         big_num, big_cap;
+    uint32_t        stamp;
+};
+
+static void oom(const char *where) {
+    fprintf(stderr, "%s: allocation failed\n", where);
+    abort();
+}
+
+static void *grow(void *ptr, int32_t *cap, size_t item_size, const char *where) {
+    int32_t new_cap = *cap ? *cap * 2 : 64;
+    void *new_ptr = realloc(ptr, item_size * new_cap);
+    if (!new_ptr)
+        oom(where);
+    *cap = new_cap;
+    return new_ptr;
+}
+
+koh_RectIndex *rindex_new(float cell_size) {
+    assert(cell_size > 0.f);
+
+    koh_RectIndex *ri = calloc(1, sizeof(*ri));
+    if (!ri)
+        return NULL;
+    ri->cell_size = cell_size;
+    ri->inv_cell = 1.f / cell_size;
+    ri->nodes_free = -1;
+    ri->ids = map_new(&(struct koh_MapSetup) {
+        .key_size = sizeof(uint32_t),
+        .value_size = sizeof(int32_t),
+    });
+    ri->cells = map_new(&(struct koh_MapSetup) {
+        .key_size = sizeof(struct Cell),
+        .value_size = sizeof(int32_t),
+    });
+    if (!ri->ids || !ri->cells) {
+        rindex_free(ri);
+        return NULL;
+    }
+    return ri;
+}
+
+koh_RectIndex *rindex_new_meta(
+    const struct MetaLoaderObjects *objs, koh_StrIntern *names
+) {
+    assert(objs);
+    assert(names);
+
+    double sum = 0.;
+    int num = 0;
+    for (int i = 0; i < objs->num; i++) {
+        Rectangle r = objs->rects[i];
+        if (isfinite(r.width) && isfinite(r.height)) {
+            sum += fmax(r.width, r.height);
+            num++;
+        }
+    }
+    float cell_size = num ? 2. * sum / num : 1.;
+    if (!(cell_size >= 1.f))
+        cell_size = 1.f;
+
+    koh_RectIndex *ri = rindex_new(cell_size);
+    if (!ri)
+        return NULL;
+    for (int i = 0; i < objs->num; i++) {
+        uint32_t id = strint_intern(names, objs->names[i], -1);
+        rindex_add(ri, id, objs->rects[i]);
+    }
+    return ri;
+}
+
+void rindex_free(koh_RectIndex *ri) {
+    if (!ri)
+        return;
+    map_free(ri->ids);
+    map_free(ri->cells);
+    free(ri->entries);
+    free(ri->nodes);
+    free(ri->big);
+    free(ri);
+}
+
+static int32_t cell_coord(double v, float inv_cell) {
+    double c = floor(v * inv_cell);
+    if (c < INT32_MIN)
+        return INT32_MIN;
+    if (c > INT32_MAX)
+        return INT32_MAX;
+    return c;
+}
+
+static struct CellRange cell_range(const koh_RectIndex *ri, Rectangle r) {
+    return (struct CellRange) {
+        .x0 = cell_coord(r.x, ri->inv_cell),
+        .y0 = cell_coord(r.y, ri->inv_cell),
+        .x1 = cell_coord((double)r.x + r.width, ri->inv_cell),
+        .y1 = cell_coord((double)r.y + r.height, ri->inv_cell),
+    };
+}
+
+static double range_cells(struct CellRange cr) {
+    return ((double)cr.x1 - cr.x0 + 1.) * ((double)cr.y1 - cr.y0 + 1.);
+}
+
+static bool rect_valid(Rectangle r) {
+    return isfinite(r.x) && isfinite(r.y) &&
+        isfinite(r.width) && isfinite(r.height) &&
+        r.width >= 0.f && r.height >= 0.f;
+}
+
+// Как CheckCollisionRecs() из raylib.
+static bool rects_overlap(Rectangle a, Rectangle b) {
+    return a.x < b.x + b.width && a.x + a.width > b.x &&
+           a.y < b.y + b.height && a.y + a.height > b.y;
+}
+
+static void cell_link(koh_RectIndex *ri, struct Cell c, int32_t entry) {
+    int32_t n;
+    if (ri->nodes_free != -1) {
+        n = ri->nodes_free;
+        ri->nodes_free = ri->nodes[n].next;
+    } else {
+        if (ri->nodes_num == ri->nodes_cap)
+            ri->nodes = grow(
+                ri->nodes, &ri->nodes_cap, sizeof(*ri->nodes), "rindex"
+            );
+        n = ri->nodes_num++;
+    }
+
+    bool created;
+    int32_t *head = map_upsert(ri->cells, &c, sizeof(c), &created);
+    ri->nodes[n].entry = entry;
+    ri->nodes[n].next = created ? -1 : *head;
+    *head = n;
+}
+
+static void cell_unlink(koh_RectIndex *ri, struct Cell c, int32_t entry) {
+    int32_t *head = map_get(ri->cells, &c, sizeof(c));
+    assert(head);
+    for (int32_t *link = head; *link != -1; link = &ri->nodes[*link].next) {
+        int32_t n = *link;
+        if (ri->nodes[n].entry != entry)
+            continue;
+        *link = ri->nodes[n].next;
+        ri->nodes[n].next = ri->nodes_free;
+        ri->nodes_free = n;
+        break;
+    }
+    if (*head == -1)
+        map_remove(ri->cells, &c, sizeof(c));
+}
+
+// Переписывает ссылки звеньев с from на to.
+static void cell_relink(
+    koh_RectIndex *ri, struct Cell c, int32_t from, int32_t to
+) {
+    int32_t *head = map_get(ri->cells, &c, sizeof(c));
+    assert(head);
+    for (int32_t n = *head; n != -1; n = ri->nodes[n].next) {
+        if (ri->nodes[n].entry == from) {
+            ri->nodes[n].entry = to;
+            break;
+        }
+    }
+}
+
+bool rindex_add(koh_RectIndex *ri, uint32_t id, Rectangle rect) {
+    assert(ri);
+
+    if (!rect_valid(rect))
+        return false;
+
+    bool created;
+    int32_t *index = map_upsert(ri->ids, &id, sizeof(id), &created);
+    if (!created)
+        return false;
+
+    if (ri->entries_num == ri->entries_cap)
+        ri->entries = grow(
+            ri->entries, &ri->entries_cap, sizeof(*ri->entries), "rindex"
+        );
+    int32_t e = ri->entries_num++;
+    *index = e;
+    ri->entries[e] = (struct Entry) {
+        .rect = rect,
+        .id = id,
+        .stamp = ri->stamp,
+        .big = -1,
+    };
+
+    struct CellRange cr = cell_range(ri, rect);
+    if (range_cells(cr) > KOH_RECT_INDEX_BIG_CELLS) {
+        if (ri->big_num == ri->big_cap)
+            ri->big = grow(ri->big, &ri->big_cap, sizeof(*ri->big), "rindex");
+        ri->entries[e].big = ri->big_num;
+        ri->big[ri->big_num++] = e;
+        return true;
+    }
+
+    for (int64_t y = cr.y0; y <= cr.y1; y++)
+        for (int64_t x = cr.x0; x <= cr.x1; x++)
+            cell_link(ri, (struct Cell) { x, y }, e);
+    return true;
+}
+
+bool rindex_remove(koh_RectIndex *ri, uint32_t id) {
+    assert(ri);
+
+    int32_t *index = map_get(ri->ids, &id, sizeof(id));
+    if (!index)
+        return false;
+    int32_t e = *index;
+    map_remove(ri->ids, &id, sizeof(id));
+
+    struct Entry *entry = &ri->entries[e];
+    if (entry->big != -1) {
+        int32_t last_big = ri->big[--ri->big_num];
+        ri->big[entry->big] = last_big;
+        ri->entries[last_big].big = entry->big;
+    } else {
+        struct CellRange cr = cell_range(ri, entry->rect);
+        for (int64_t y = cr.y0; y <= cr.y1; y++)
+            for (int64_t x = cr.x0; x <= cr.x1; x++)
+                cell_unlink(ri, (struct Cell) { x, y }, e);
+    }
+
+    // Последний объект переезжает на место удаленного.
+    int32_t last = --ri->entries_num;
+    if (last == e)
+        return true;
+
+    struct Entry *moved = &ri->entries[last];
+    *(int32_t*)map_get(ri->ids, &moved->id, sizeof(moved->id)) = e;
+    if (moved->big != -1) {
+        ri->big[moved->big] = e;
+    } else {
+        struct CellRange cr = cell_range(ri, moved->rect);
+        for (int64_t y = cr.y0; y <= cr.y1; y++)
+            for (int64_t x = cr.x0; x <= cr.x1; x++)
+                cell_relink(ri, (struct Cell) { x, y }, last, e);
+    }
+    ri->entries[e] = *moved;
+    return true;
+}
+
+bool rindex_update(koh_RectIndex *ri, uint32_t id, Rectangle rect) {
+    assert(ri);
+
+    if (!rect_valid(rect) || !rindex_remove(ri, id))
+        return false;
+    return rindex_add(ri, id, rect);
+}
+
+bool rindex_get(koh_RectIndex *ri, uint32_t id, Rectangle *rect) {
+    assert(ri);
+
+    int32_t *index = map_get(ri->ids, &id, sizeof(id));
+    if (!index)
+        return false;
+    if (rect)
+        *rect = ri->entries[*index].rect;
+    return true;
+}
+
+void rindex_clear(koh_RectIndex *ri) {
+    assert(ri);
+    map_clear(ri->ids);
+    map_clear(ri->cells);
+    ri->entries_num = 0;
+    ri->nodes_num = 0;
+    ri->nodes_free = -1;
+    ri->big_num = 0;
+}
+
+int rindex_size(koh_RectIndex *ri) {
+    assert(ri);
+    return ri->entries_num;
+}
+
+// false - обход прерван
+static bool visit_cell(
+    koh_RectIndex *ri, int32_t head, Rectangle view,
+    koh_RectIndexEachCb cb, void *udata
+) {
+    for (int32_t n = head; n != -1; n = ri->nodes[n].next) {
+        struct Entry *entry = &ri->entries[ri->nodes[n].entry];
+        if (entry->stamp == ri->stamp)
+            continue;
+        entry->stamp = ri->stamp;
+        if (rects_overlap(entry->rect, view) &&
+                cb(entry->id, entry->rect, udata) == koh_SA_break)
+            return false;
+    }
+    return true;
+}
+
+void rindex_query(
+    koh_RectIndex *ri, Rectangle view, koh_RectIndexEachCb cb, void *udata
+) {
+    assert(ri);
+    assert(cb);
+
+    if (!rect_valid(view))
+        return;
+
+    if (++ri->stamp == 0) {
+        // переполнение счетчика, старые отметки сбрасываются
+        for (int32_t i = 0; i < ri->entries_num; i++)
+            ri->entries[i].stamp = 0;
+        ri->stamp = 1;
+    }
+
+    for (int32_t i = 0; i < ri->big_num; i++) {
+        struct Entry *entry = &ri->entries[ri->big[i]];
+        if (rects_overlap(entry->rect, view) &&
+                cb(entry->id, entry->rect, udata) == koh_SA_break)
+            return;
+    }
+
+    struct CellRange cr = cell_range(ri, view);
+
+    // Окно больше занятой части сетки - обход занятых ячеек.
+    if (range_cells(cr) > map_size(ri->cells)) {
+        for (struct koh_MapView v = map_each_begin(ri->cells);
+                map_each_valid(&v); map_each_next(&v)) {
+            const struct Cell *c = map_each_key(&v);
+            if (c->x < cr.x0 || c->x > cr.x1 || c->y < cr.y0 || c->y > cr.y1)
+                continue;
+            if (!visit_cell(ri, *(int32_t*)map_each_value(&v), view, cb, udata))
+                return;
+        }
+        return;
+    }
+
+    for (int64_t y = cr.y0; y <= cr.y1; y++) {
+        for (int64_t x = cr.x0; x <= cr.x1; x++) {
+            struct Cell c = { x, y };
+            int32_t *head = map_get(ri->cells, &c, sizeof(c));
+            if (head && !visit_cell(ri, *head, view, cb, udata))
+                return;
+        }
+    }
+}
@@ -0,0 +1,53 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+#pragma once
+
+#include "koh_metaloader.h"
+#include "koh_set.h"
+#include "koh_strintern.h"
+#include "raylib.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+Пространственный индекс прямоугольников на равномерной сетке. Объект
+записывается во все ячейки, которые перекрывает, запрос обходит только
+ячейки под окном и проверяет пересечение как CheckCollisionRecs().
+Объекты крупнее KOH_RECT_INDEX_BIG_CELLS ячеек хранятся отдельным
+списком и проверяются в каждом запросе.
+
+Объект задается постоянным id. Для объектов MetaLoader это id имени из
+koh_StrIntern, тогда индекс синхронизируется с множеством объектов
+вызовами rindex_add/rindex_remove рядом с set_add/set_remove.
+*/
+
+#define KOH_RECT_INDEX_BIG_CELLS    64
+
+typedef struct koh_RectIndex koh_RectIndex;
+
+typedef koh_SetAction (*koh_RectIndexEachCb)(
+    uint32_t id, Rectangle rect, void *udata
+);
+
+// cell_size > 0, примерно удвоенный типичный размер объекта.
+koh_RectIndex *rindex_new(float cell_size);
+// Пакетная сборка, id объекта - strint_intern(names, objs->names[i]).
+// Размер ячейки подбирается по среднему размеру прямоугольников.
+koh_RectIndex *rindex_new_meta(
+    const struct MetaLoaderObjects *objs, koh_StrIntern *names
+);
+void rindex_free(koh_RectIndex *ri);
+
+// false если id уже есть или координаты не конечны.
+bool rindex_add(koh_RectIndex *ri, uint32_t id, Rectangle rect);
+bool rindex_remove(koh_RectIndex *ri, uint32_t id);
+bool rindex_update(koh_RectIndex *ri, uint32_t id, Rectangle rect);
+bool rindex_get(koh_RectIndex *ri, uint32_t id, Rectangle *rect);
+void rindex_clear(koh_RectIndex *ri);
+int rindex_size(koh_RectIndex *ri);
+
+// Объекты, пересекающие view, каждый не больше одного раза.
+// Поддерживает koh_SA_next и koh_SA_break.
+void rindex_query(
+    koh_RectIndex *ri, Rectangle view, koh_RectIndexEachCb cb, void *udata
+);
@@ -0,0 +1,1227 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+
+#include "koh_roaring.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#define ARRAY_MAX       KOH_ROAR_ARRAY_MAX
+#define BITMAP_WORDS    1024
+#define BITMAP_BYTES    (BITMAP_WORDS * sizeof(uint64_t))
+
+// Длина серии хранится как len - 1, чтобы серия 0..65535 влезала в uint16.
+struct Run {
+    uint16_t    start, len;
+};
+
+struct Container {
+    uint16_t    high;
+    uint8_t     type;
+    // значений в контейнере, 1..65536
+    int32_t     card;
+    // элементов массива или серий и емкость data в элементах
+    int32_t     n, cap;
+    void        *data;
+};
+
+struct koh_Roaring {
+    struct Container    *cs;
+    int                 num, cap;
+    int64_t             card;
+};
+
+struct StreamHeader {
+    char        magic[4];
+    uint8_t     version, reserved[3];
+    uint32_t    containers_num, reserved2;
+    uint64_t    card;
+};
+
+struct StreamContainer {
+    uint16_t    high;
+    uint8_t     type, reserved;
+    uint32_t    n;
+};
+
+// {{{ containers
+
+static int array_lower_bound(const uint16_t *arr, int n, uint16_t low) {
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (arr[mid] < low)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Последняя серия с началом <= low или -1.
+static int run_find(const struct Run *runs, int n, uint16_t low) {
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (runs[mid].start <= low)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
+}
+
+static bool c_reserve(struct Container *c, int32_t n, size_t elem) {
+    if (n <= c->cap)
+        return true;
+    int32_t cap = c->cap ? c->cap : 4;
+    while (cap < n)
+        cap *= 2;
+    void *data = realloc(c->data, cap * elem);
+    if (!data)
+        return false;
+    c->data = data;
+    c->cap = cap;
+    return true;
+}
+
+static bool c_contains(const struct Container *c, uint16_t low) {
+    switch (c->type) {
+        case koh_ROAR_array: {
+            const uint16_t *arr = c->data;
+            int pos = array_lower_bound(arr, c->n, low);
+            return pos < c->n && arr[pos] == low;
+        }
+        case koh_ROAR_bitmap: {
+            const uint64_t *words = c->data;
+            return words[low >> 6] & (1ULL << (low & 63));
+        }
+        default: {
+            const struct Run *runs = c->data;
+            int i = run_find(runs, c->n, low);
+            return i >= 0 && low - runs[i].start <= runs[i].len;
+        }
+    }
+}
+
+static void c_to_words(const struct Container *c, uint64_t *words) {
+    if (c->type == koh_ROAR_bitmap) {
+        memcpy(words, c->data, BITMAP_BYTES);
+        return;
+    }
+
+    memset(words, 0, BITMAP_BYTES);
+    if (c->type == koh_ROAR_array) {
+        const uint16_t *arr = c->data;
+        for (int i = 0; i < c->n; i++)
+            words[arr[i] >> 6] |= 1ULL << (arr[i] & 63);
+        return;
+    }
+
+    const struct Run *runs = c->data;
+    for (int i = 0; i < c->n; i++) {
+        uint32_t lo = runs[i].start, hi = lo + runs[i].len;
+        for (uint32_t w = lo >> 6; w <= hi >> 6; w++) {
+            uint64_t mask = ~0ULL;
+            if (w == lo >> 6)
+                mask &= ~0ULL << (lo & 63);
+            if (w == hi >> 6 && (hi & 63) != 63)
+                mask &= (1ULL << ((hi & 63) + 1)) - 1;
+            words[w] |= mask;
+        }
+    }
+}
+
+// Массив из битов, arr вмещает card значений.
+static void words_to_array(const uint64_t *words, uint16_t *arr) {
+    int n = 0;
+    for (int w = 0; w < BITMAP_WORDS; w++) {
+        uint64_t bits = words[w];
+        while (bits) {
+            arr[n++] = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+        }
+    }
+}
+
+static int words_runs(const uint64_t *words) {
+    int runs = 0;
+    uint64_t carry = 0;
+    for (int w = 0; w < BITMAP_WORDS; w++) {
+        uint64_t bits = words[w];
+        // начала серий: бит установлен, предыдущий нет
+        runs += __builtin_popcountll(bits & ~((bits << 1) | carry));
+        carry = bits >> 63;
+    }
+    return runs;
+}
+
+static void words_to_runs(const uint64_t *words, struct Run *runs) {
+    int n = 0;
+    int32_t start = -1;
+    for (int32_t v = 0; v <= 65536; v++) {
+        bool set = v < 65536 && (words[v >> 6] & (1ULL << (v & 63)));
+        if (set && start < 0) {
+            start = v;
+        } else if (!set && start >= 0) {
+            runs[n++] = (struct Run) { start, v - 1 - start };
+            start = -1;
+        }
+        // пропуск пустых слов целиком
+        if (start < 0 && v < 65536 && !(v & 63) && !words[v >> 6])
+            v += 63;
+    }
+}
+
+// Заменяет содержимое контейнера битами words с card значениями.
+static bool c_from_words(
+    struct Container *c, const uint64_t *words, int32_t card
+) {
+    void *data;
+    int32_t n, cap;
+    uint8_t type;
+    if (card <= ARRAY_MAX) {
+        data = malloc(sizeof(uint16_t) * card);
+        if (!data)
+            return false;
+        words_to_array(words, data);
+        type = koh_ROAR_array;
+        n = cap = card;
+    } else {
+        data = malloc(BITMAP_BYTES);
+        if (!data)
+            return false;
+        memcpy(data, words, BITMAP_BYTES);
+        type = koh_ROAR_bitmap;
+        n = cap = 0;
+    }
+    free(c->data);
+    c->data = data;
+    c->type = type;
+    c->card = card;
+    c->n = n;
+    c->cap = cap;
+    return true;
+}
+
+static bool c_to_bitmap(struct Container *c) {
+    uint64_t words[BITMAP_WORDS];
+    c_to_words(c, words);
+    void *data = malloc(BITMAP_BYTES);
+    if (!data)
+        return false;
+    memcpy(data, words, BITMAP_BYTES);
+    free(c->data);
+    c->data = data;
+    c->type = koh_ROAR_bitmap;
+    c->n = c->cap = 0;
+    return true;
+}
+
+static bool array_add(struct Container *c, uint16_t low) {
+    uint16_t *arr = c->data;
+    int pos = array_lower_bound(arr, c->n, low);
+    if (pos < c->n && arr[pos] == low)
+        return false;
+
+    if (c->n == ARRAY_MAX) {
+        if (!c_to_bitmap(c))
+            return false;
+        ((uint64_t*)c->data)[low >> 6] |= 1ULL << (low & 63);
+        c->card++;
+        return true;
+    }
+
+    if (!c_reserve(c, c->n + 1, sizeof(uint16_t)))
+        return false;
+    arr = c->data;
+    memmove(&arr[pos + 1], &arr[pos], sizeof(*arr) * (c->n - pos));
+    arr[pos] = low;
+    c->n++;
+    c->card++;
+    return true;
+}
+
+static bool run_add(struct Container *c, uint16_t low) {
+    struct Run *runs = c->data;
+    int i = run_find(runs, c->n, low);
+    if (i >= 0 && low - runs[i].start <= runs[i].len)
+        return false;
+
+    bool ext_prev = i >= 0 && runs[i].start + runs[i].len + 1 == low;
+    bool ext_next = i + 1 < c->n && runs[i + 1].start == low + 1;
+    if (ext_prev && ext_next) {
+        runs[i].len += runs[i + 1].len + 2;
+        memmove(
+            &runs[i + 1], &runs[i + 2], sizeof(*runs) * (c->n - i - 2)
+        );
+        c->n--;
+    } else if (ext_prev) {
+        runs[i].len++;
+    } else if (ext_next) {
+        runs[i + 1].start--;
+        runs[i + 1].len++;
+    } else {
+        if (!c_reserve(c, c->n + 1, sizeof(struct Run)))
+            return false;
+        runs = c->data;
+        memmove(
+            &runs[i + 2], &runs[i + 1], sizeof(*runs) * (c->n - i - 1)
+        );
+        runs[i + 1] = (struct Run) { low, 0 };
+        c->n++;
+    }
+    c->card++;
+    return true;
+}
+
+static bool c_add(struct Container *c, uint16_t low) {
+    switch (c->type) {
+        case koh_ROAR_array:
+            return array_add(c, low);
+        case koh_ROAR_bitmap: {
+            uint64_t *w = &((uint64_t*)c->data)[low >> 6];
+            uint64_t mask = 1ULL << (low & 63);
+            if (*w & mask)
+                return false;
+            *w |= mask;
+            c->card++;
+            return true;
+        }
+        default:
+            return run_add(c, low);
+    }
+}
+
+static bool run_remove(struct Container *c, uint16_t low) {
+    struct Run *runs = c->data;
+    int i = run_find(runs, c->n, low);
+    if (i < 0 || low - runs[i].start > runs[i].len)
+        return false;
+
+    uint16_t start = runs[i].start, end = start + runs[i].len;
+    if (start == end) {
+        memmove(
+            &runs[i], &runs[i + 1], sizeof(*runs) * (c->n - i - 1)
+        );
+        c->n--;
+    } else if (low == start) {
+        runs[i].start++;
+        runs[i].len--;
+    } else if (low == end) {
+        runs[i].len--;
+    } else {
+        if (!c_reserve(c, c->n + 1, sizeof(struct Run)))
+            return false;
+        runs = c->data;
+        memmove(
+            &runs[i + 2], &runs[i + 1], sizeof(*runs) * (c->n - i - 1)
+        );
+        runs[i].len = low - start - 1;
+        runs[i + 1] = (struct Run) { low + 1, end - low - 1 };
+        c->n++;
+    }
+    c->card--;
+    return true;
+}
+
+static bool c_remove(struct Container *c, uint16_t low) {
+    switch (c->type) {
+        case koh_ROAR_array: {
+            uint16_t *arr = c->data;
+            int pos = array_lower_bound(arr, c->n, low);
+            if (pos == c->n || arr[pos] != low)
+                return false;
+            memmove(&arr[pos], &arr[pos + 1], sizeof(*arr) * (c->n - pos - 1));
+            c->n--;
+            c->card--;
+            return true;
+        }
+        case koh_ROAR_bitmap: {
+            uint64_t *words = c->data;
+            uint64_t mask = 1ULL << (low & 63);
+            if (!(words[low >> 6] & mask))
+                return false;
+            words[low >> 6] &= ~mask;
+            c->card--;
+            // Обратно в массив с запасом, чтобы не переключаться на границе.
+            if (c->card <= ARRAY_MAX / 2)
+                c_from_words(c, words, c->card);
+            return true;
+        }
+        default:
+            return run_remove(c, low);
+    }
+}
+
+static bool c_clone(struct Container *dst, const struct Container *src) {
+    size_t bytes;
+    switch (src->type) {
+        case koh_ROAR_array:
+            bytes = sizeof(uint16_t) * src->n;
+            break;
+        case koh_ROAR_bitmap:
+            bytes = BITMAP_BYTES;
+            break;
+        default:
+            bytes = sizeof(struct Run) * src->n;
+            break;
+    }
+    *dst = *src;
+    dst->cap = src->n;
+    dst->data = malloc(bytes ? bytes : 1);
+    if (!dst->data)
+        return false;
+    memcpy(dst->data, src->data, bytes);
+    return true;
+}
+
+static int64_t c_bytes(const struct Container *c) {
+    switch (c->type) {
+        case koh_ROAR_array:
+            return sizeof(uint16_t) * c->cap;
+        case koh_ROAR_bitmap:
+            return BITMAP_BYTES;
+        default:
+            return sizeof(struct Run) * c->cap;
+    }
+}
+
+// }}}
+
+// {{{ top level
+
+// Индекс контейнера или -(позиция вставки + 1).
+static int roar_find(const koh_Roaring *r, uint16_t high) {
+    int lo = 0, hi = r->num;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (r->cs[mid].high < high)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < r->num && r->cs[lo].high == high)
+        return lo;
+    return -(lo + 1);
+}
+
+static struct Container *roar_insert(koh_Roaring *r, int pos, uint16_t high) {
+    if (r->num == r->cap) {
+        int cap = r->cap ? r->cap * 2 : 8;
+        struct Container *cs = realloc(r->cs, sizeof(*cs) * cap);
+        if (!cs)
+            return NULL;
+        r->cs = cs;
+        r->cap = cap;
+    }
+    memmove(&r->cs[pos + 1], &r->cs[pos], sizeof(*r->cs) * (r->num - pos));
+    r->num++;
+    r->cs[pos] = (struct Container) {
+        .high = high,
+        .type = koh_ROAR_array,
+    };
+    return &r->cs[pos];
+}
+
+static void roar_erase(koh_Roaring *r, int pos) {
+    free(r->cs[pos].data);
+    memmove(
+        &r->cs[pos], &r->cs[pos + 1], sizeof(*r->cs) * (r->num - pos - 1)
+    );
+    r->num--;
+}
+
+// Забирает контейнер, r->cs имеет достаточную емкость.
+static void roar_push(koh_Roaring *r, struct Container *c) {
+    r->cs[r->num++] = *c;
+    r->card += c->card;
+}
+
+static bool roar_key(const void *key, int key_len, uint32_t *value) {
+    if (key_len != sizeof(uint32_t))
+        return false;
+    memcpy(value, key, sizeof(*value));
+    return true;
+}
+
+koh_Roaring *roar_new(void) {
+    return calloc(1, sizeof(koh_Roaring));
+}
+
+void roar_free(koh_Roaring *r) {
+    if (!r)
+        return;
+    for (int i = 0; i < r->num; i++)
+        free(r->cs[i].data);
+    free(r->cs);
+    free(r);
+}
+
+static koh_Roaring *roar_new_cap(int cap) {
+    koh_Roaring *r = roar_new();
+    if (!r)
+        return NULL;
+    r->cs = malloc(sizeof(*r->cs) * (cap ? cap : 1));
+    if (!r->cs) {
+        free(r);
+        return NULL;
+    }
+    r->cap = cap ? cap : 1;
+    return r;
+}
+
+koh_Roaring *roar_clone(const koh_Roaring *r) {
+    assert(r);
+
+    koh_Roaring *dst = roar_new_cap(r->num);
+    if (!dst)
+        return NULL;
+    for (int i = 0; i < r->num; i++) {
+        struct Container c;
+        if (!c_clone(&c, &r->cs[i])) {
+            roar_free(dst);
+            return NULL;
+        }
+        roar_push(dst, &c);
+    }
+    return dst;
+}
+
+bool roar_add(koh_Roaring *r, const void *key, int key_len) {
+    assert(r);
+
+    uint32_t value;
+    if (!roar_key(key, key_len, &value))
+        return false;
+
+    int i = roar_find(r, value >> 16);
+    struct Container *c = i >= 0 ?
+        &r->cs[i] : roar_insert(r, -i - 1, value >> 16);
+    if (!c)
+        return false;
+    if (!c_add(c, value & 0xFFFF)) {
+        if (!c->card)
+            roar_erase(r, c - r->cs);
+        return false;
+    }
+    r->card++;
+    return true;
+}
+
+bool roar_exist(const koh_Roaring *r, const void *key, int key_len) {
+    assert(r);
+
+    uint32_t value;
+    if (!roar_key(key, key_len, &value))
+        return false;
+    int i = roar_find(r, value >> 16);
+    return i >= 0 && c_contains(&r->cs[i], value & 0xFFFF);
+}
+
+bool roar_remove(koh_Roaring *r, const void *key, int key_len) {
+    assert(r);
+
+    uint32_t value;
+    if (!roar_key(key, key_len, &value))
+        return false;
+    int i = roar_find(r, value >> 16);
+    if (i < 0 || !c_remove(&r->cs[i], value & 0xFFFF))
+        return false;
+    if (!r->cs[i].card)
+        roar_erase(r, i);
+    r->card--;
+    return true;
+}
+
+void roar_clear(koh_Roaring *r) {
+    assert(r);
+    for (int i = 0; i < r->num; i++)
+        free(r->cs[i].data);
+    r->num = 0;
+    r->card = 0;
+}
+
+int64_t roar_size(const koh_Roaring *r) {
+    assert(r);
+    return r->card;
+}
+
+bool roar_compare(const koh_Roaring *r1, const koh_Roaring *r2) {
+    assert(r1);
+    assert(r2);
+
+    if (r1->num != r2->num || r1->card != r2->card)
+        return false;
+
+    uint64_t w1[BITMAP_WORDS], w2[BITMAP_WORDS];
+    for (int i = 0; i < r1->num; i++) {
+        const struct Container *c1 = &r1->cs[i], *c2 = &r2->cs[i];
+        if (c1->high != c2->high || c1->card != c2->card)
+            return false;
+        c_to_words(c1, w1);
+        c_to_words(c2, w2);
+        if (memcmp(w1, w2, BITMAP_BYTES))
+            return false;
+    }
+    return true;
+}
+
+void roar_optimize(koh_Roaring *r) {
+    assert(r);
+
+    uint64_t words[BITMAP_WORDS];
+    for (int i = 0; i < r->num; i++) {
+        struct Container *c = &r->cs[i];
+        c_to_words(c, words);
+        int64_t runs = words_runs(words);
+        int64_t run_bytes = sizeof(struct Run) * runs;
+        int64_t plain_bytes = c->card <= ARRAY_MAX ?
+            (int64_t)sizeof(uint16_t) * c->card : (int64_t)BITMAP_BYTES;
+
+        if (run_bytes < plain_bytes) {
+            if (c->type == koh_ROAR_run && c->cap == c->n)
+                continue;
+            struct Run *data = malloc(run_bytes);
+            if (!data)
+                continue;
+            words_to_runs(words, data);
+            free(c->data);
+            c->data = data;
+            c->type = koh_ROAR_run;
+            c->n = c->cap = runs;
+        } else if (c->type == koh_ROAR_run ||
+                (c->type == koh_ROAR_array && c->cap > c->n) ||
+                (c->type == koh_ROAR_bitmap && c->card <= ARRAY_MAX)) {
+            c_from_words(c, words, c->card);
+        }
+    }
+}
+
+struct koh_RoaringStats roar_stats(const koh_Roaring *r) {
+    assert(r);
+
+    struct koh_RoaringStats stats = {
+        .bytes = sizeof(*r) + sizeof(*r->cs) * r->cap,
+    };
+    for (int i = 0; i < r->num; i++) {
+        const struct Container *c = &r->cs[i];
+        stats.arrays += c->type == koh_ROAR_array;
+        stats.bitmaps += c->type == koh_ROAR_bitmap;
+        stats.runs += c->type == koh_ROAR_run;
+        stats.bytes += c_bytes(c);
+    }
+    return stats;
+}
+
+// }}}
+
+// {{{ algebra
+
+// Пересечение отсортированных массивов, out вмещает min(na, nb).
+static int array_and(
+    const uint16_t *a, int na, const uint16_t *b, int nb, uint16_t *out
+) {
+    // Сильно разные размеры - двоичный поиск меньшего в большем.
+    if (na * 32 < nb || nb * 32 < na) {
+        if (na > nb) {
+            const uint16_t *t = a; a = b; b = t;
+            int tn = na; na = nb; nb = tn;
+        }
+        int n = 0, from = 0;
+        for (int i = 0; i < na; i++) {
+            from += array_lower_bound(b + from, nb - from, a[i]);
+            if (from == nb)
+                break;
+            if (b[from] == a[i])
+                out[n++] = a[i];
+        }
+        return n;
+    }
+
+    int i = 0, j = 0, n = 0;
+#ifdef __SSE2__
+    // Блоки по 8: блок a сравнивается со всеми сдвигами блока b, затем
+    // сдвигается блок с меньшим максимумом.
+    while (i + 8 <= na && j + 8 <= nb) {
+        __m128i va = _mm_loadu_si128((const __m128i*)&a[i]);
+        __m128i vb = _mm_loadu_si128((const __m128i*)&b[j]);
+#define ROT(s) _mm_or_si128(_mm_srli_si128(vb, s), _mm_slli_si128(vb, 16 - s))
+        __m128i eq = _mm_cmpeq_epi16(va, vb);
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi16(va, ROT(2)));
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi16(va, ROT(4)));
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi16(va, ROT(6)));
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi16(va, ROT(8)));
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi16(va, ROT(10)));
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi16(va, ROT(12)));
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi16(va, ROT(14)));
+#undef ROT
+        // по 2 бита маски на элемент
+        uint32_t mask = _mm_movemask_epi8(eq) & 0x5555;
+        while (mask) {
+            out[n++] = a[i + __builtin_ctz(mask) / 2];
+            mask &= mask - 1;
+        }
+        uint16_t amax = a[i + 7], bmax = b[j + 7];
+        if (amax <= bmax)
+            i += 8;
+        if (bmax <= amax)
+            j += 8;
+    }
+#endif
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            i++;
+        } else if (a[i] > b[j]) {
+            j++;
+        } else {
+            out[n++] = a[i];
+            i++;
+            j++;
+        }
+    }
+    return n;
+}
+
+static int32_t words_and(uint64_t *dst, const uint64_t *src) {
+    int i = 0;
+#ifdef __AVX2__
+    for (; i < BITMAP_WORDS; i += 4) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)&dst[i]);
+        __m256i b = _mm256_loadu_si256((const __m256i*)&src[i]);
+        _mm256_storeu_si256((__m256i*)&dst[i], _mm256_and_si256(a, b));
+    }
+#endif
+    for (; i < BITMAP_WORDS; i++)
+        dst[i] &= src[i];
+
+    int32_t card = 0;
+    for (i = 0; i < BITMAP_WORDS; i++)
+        card += __builtin_popcountll(dst[i]);
+    return card;
+}
+
+static int32_t words_or(uint64_t *dst, const uint64_t *src) {
+    int i = 0;
+#ifdef __AVX2__
+    for (; i < BITMAP_WORDS; i += 4) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)&dst[i]);
+        __m256i b = _mm256_loadu_si256((const __m256i*)&src[i]);
+        _mm256_storeu_si256((__m256i*)&dst[i], _mm256_or_si256(a, b));
+    }
+#endif
+    for (; i < BITMAP_WORDS; i++)
+        dst[i] |= src[i];
+
+    int32_t card = 0;
+    for (i = 0; i < BITMAP_WORDS; i++)
+        card += __builtin_popcountll(dst[i]);
+    return card;
+}
+
+// Пересечение в out, out->card == 0 если пусто. false при нехватке памяти.
+static bool c_and(
+    const struct Container *a, const struct Container *b,
+    struct Container *out
+) {
+    *out = (struct Container) { .high = a->high, .type = koh_ROAR_array, };
+
+    if (a->type == koh_ROAR_array && b->type == koh_ROAR_array) {
+        int32_t n = a->n < b->n ? a->n : b->n;
+        out->data = malloc(sizeof(uint16_t) * n);
+        if (!out->data)
+            return false;
+        out->n = out->cap = out->card = array_and(
+            a->data, a->n, b->data, b->n, out->data
+        );
+        return true;
+    }
+
+    if (a->type == koh_ROAR_array || b->type == koh_ROAR_array) {
+        if (b->type == koh_ROAR_array) {
+            const struct Container *t = a; a = b; b = t;
+        }
+        const uint16_t *arr = a->data;
+        uint16_t *data = malloc(sizeof(uint16_t) * a->n);
+        if (!data)
+            return false;
+        int32_t n = 0;
+        for (int i = 0; i < a->n; i++) {
+            if (c_contains(b, arr[i]))
+                data[n++] = arr[i];
+        }
+        out->data = data;
+        out->n = out->cap = out->card = n;
+        return true;
+    }
+
+    uint64_t wa[BITMAP_WORDS], wb[BITMAP_WORDS];
+    c_to_words(a, wa);
+    c_to_words(b, wb);
+    int32_t card = words_and(wa, wb);
+    return !card || c_from_words(out, wa, card);
+}
+
+static bool c_or(
+    const struct Container *a, const struct Container *b,
+    struct Container *out
+) {
+    *out = (struct Container) { .high = a->high, .type = koh_ROAR_array, };
+
+    if (a->type == koh_ROAR_array && b->type == koh_ROAR_array &&
+            a->n + b->n <= ARRAY_MAX) {
+        const uint16_t *x = a->data, *y = b->data;
+        uint16_t *data = malloc(sizeof(uint16_t) * (a->n + b->n));
+        if (!data)
+            return false;
+        int i = 0, j = 0, n = 0;
+        while (i < a->n && j < b->n) {
+            if (x[i] < y[j])
+                data[n++] = x[i++];
+            else if (x[i] > y[j])
+                data[n++] = y[j++];
+            else {
+                data[n++] = x[i++];
+                j++;
+            }
+        }
+        while (i < a->n)
+            data[n++] = x[i++];
+        while (j < b->n)
+            data[n++] = y[j++];
+        out->data = data;
+        out->n = out->card = n;
+        out->cap = a->n + b->n;
+        return true;
+    }
+
+    uint64_t wa[BITMAP_WORDS], wb[BITMAP_WORDS];
+    c_to_words(a, wa);
+    c_to_words(b, wb);
+    return c_from_words(out, wa, words_or(wa, wb));
+}
+
+koh_Roaring *roar_and(const koh_Roaring *a, const koh_Roaring *b) {
+    assert(a);
+    assert(b);
+
+    koh_Roaring *r = roar_new_cap(a->num < b->num ? a->num : b->num);
+    if (!r)
+        return NULL;
+
+    int i = 0, j = 0;
+    while (i < a->num && j < b->num) {
+        if (a->cs[i].high < b->cs[j].high) {
+            i++;
+        } else if (a->cs[i].high > b->cs[j].high) {
+            j++;
+        } else {
+            struct Container c;
+            if (!c_and(&a->cs[i++], &b->cs[j++], &c)) {
+                roar_free(r);
+                return NULL;
+            }
+            if (c.card)
+                roar_push(r, &c);
+            else
+                free(c.data);
+        }
+    }
+    return r;
+}
+
+int64_t roar_and_size(const koh_Roaring *a, const koh_Roaring *b) {
+    assert(a);
+    assert(b);
+
+    int64_t card = 0;
+    uint16_t out[ARRAY_MAX];
+    uint64_t wa[BITMAP_WORDS], wb[BITMAP_WORDS];
+    int i = 0, j = 0;
+    while (i < a->num && j < b->num) {
+        const struct Container *ca = &a->cs[i], *cb = &b->cs[j];
+        if (ca->high < cb->high) {
+            i++;
+            continue;
+        }
+        if (ca->high > cb->high) {
+            j++;
+            continue;
+        }
+        i++;
+        j++;
+
+        if (ca->type == koh_ROAR_array && cb->type == koh_ROAR_array) {
+            card += array_and(ca->data, ca->n, cb->data, cb->n, out);
+        } else if (ca->type == koh_ROAR_array || cb->type == koh_ROAR_array) {
+            if (cb->type == koh_ROAR_array) {
+                const struct Container *t = ca; ca = cb; cb = t;
+            }
+            const uint16_t *arr = ca->data;
+            for (int k = 0; k < ca->n; k++)
+                card += c_contains(cb, arr[k]);
+        } else {
+            c_to_words(ca, wa);
+            c_to_words(cb, wb);
+            card += words_and(wa, wb);
+        }
+    }
+    return card;
+}
+
+koh_Roaring *roar_or(const koh_Roaring *a, const koh_Roaring *b) {
+    assert(a);
+    assert(b);
+
+    koh_Roaring *r = roar_new_cap(a->num + b->num);
+    if (!r)
+        return NULL;
+
+    int i = 0, j = 0;
+    while (i < a->num || j < b->num) {
+        struct Container c;
+        bool ok;
+        if (j == b->num || (i < a->num && a->cs[i].high < b->cs[j].high))
+            ok = c_clone(&c, &a->cs[i++]);
+        else if (i == a->num || a->cs[i].high > b->cs[j].high)
+            ok = c_clone(&c, &b->cs[j++]);
+        else
+            ok = c_or(&a->cs[i++], &b->cs[j++], &c);
+        if (!ok) {
+            roar_free(r);
+            return NULL;
+        }
+        roar_push(r, &c);
+    }
+    return r;
+}
+
+// }}}
+
+// {{{ stream
+
+bool roar_write_stream(
+    const koh_Roaring *r, koh_SetStreamWrite write, void *udata
+) {
+    assert(r);
+    assert(write);
+
+    struct StreamHeader hdr = {
+        .magic = { 'K', 'R', 'O', 'A', },
+        .version = KOH_ROAR_VERSION,
+        .containers_num = r->num,
+        .card = r->card,
+    };
+    if (!write(&hdr, sizeof(hdr), udata))
+        return false;
+
+    for (int i = 0; i < r->num; i++) {
+        const struct Container *c = &r->cs[i];
+        struct StreamContainer sc = {
+            .high = c->high,
+            .type = c->type,
+            .n = c->type == koh_ROAR_bitmap ? c->card : c->n,
+        };
+        if (!write(&sc, sizeof(sc), udata))
+            return false;
+        int64_t bytes = c->type == koh_ROAR_bitmap ? BITMAP_BYTES :
+            c->type == koh_ROAR_array ? sizeof(uint16_t) * c->n :
+            sizeof(struct Run) * c->n;
+        if (!write(c->data, bytes, udata))
+            return false;
+    }
+    return true;
+}
+
+static bool read_full(
+    koh_SetStreamRead read, void *udata, void *data, size_t len
+) {
+    size_t have = 0;
+    while (have < len) {
+        size_t got = read((uint8_t*)data + have, len - have, udata);
+        if (!got)
+            return false;
+        have += got;
+    }
+    return true;
+}
+
+// Проверка инвариантов прочитанного контейнера.
+static bool c_valid(struct Container *c) {
+    switch (c->type) {
+        case koh_ROAR_array: {
+            const uint16_t *arr = c->data;
+            if (c->n < 1 || c->n > ARRAY_MAX)
+                return false;
+            for (int i = 1; i < c->n; i++) {
+                if (arr[i - 1] >= arr[i])
+                    return false;
+            }
+            c->card = c->n;
+            return true;
+        }
+        case koh_ROAR_bitmap: {
+            int32_t card = 0;
+            const uint64_t *words = c->data;
+            for (int i = 0; i < BITMAP_WORDS; i++)
+                card += __builtin_popcountll(words[i]);
+            return card > 0 && card == c->card;
+        }
+        default: {
+            const struct Run *runs = c->data;
+            if (c->n < 1 || c->n > 32768)
+                return false;
+            int32_t card = 0, next = 0;
+            for (int i = 0; i < c->n; i++) {
+                int32_t end = runs[i].start + runs[i].len;
+                if (runs[i].start < next || end > 0xFFFF)
+                    return false;
+                card += runs[i].len + 1;
+                next = end + 2;
+            }
+            c->card = card;
+            return true;
+        }
+    }
+}
+
+koh_Roaring *roar_read_stream(koh_SetStreamRead read, void *udata) {
+    assert(read);
+
+    struct StreamHeader hdr;
+    if (!read_full(read, udata, &hdr, sizeof(hdr)) ||
+            memcmp(hdr.magic, KOH_ROAR_MAGIC, sizeof(hdr.magic)) ||
+            hdr.version != KOH_ROAR_VERSION ||
+            hdr.containers_num > 65536)
+        return NULL;
+
+    koh_Roaring *r = roar_new_cap(hdr.containers_num);
+    if (!r)
+        return NULL;
+
+    for (uint32_t i = 0; i < hdr.containers_num; i++) {
+        struct StreamContainer sc;
+        if (!read_full(read, udata, &sc, sizeof(sc)) ||
+                sc.type > koh_ROAR_run || sc.n > 65536 ||
+                (r->num && r->cs[r->num - 1].high >= sc.high))
+            goto fail;
+
+        struct Container c = { .high = sc.high, .type = sc.type, };
+        size_t bytes;
+        if (sc.type == koh_ROAR_bitmap) {
+            c.card = sc.n;
+            bytes = BITMAP_BYTES;
+        } else {
+            c.n = c.cap = sc.n;
+            bytes = sc.n * (sc.type == koh_ROAR_array ?
+                sizeof(uint16_t) : sizeof(struct Run));
+        }
+        c.data = malloc(bytes ? bytes : 1);
+        if (!c.data)
+            goto fail;
+        if (!read_full(read, udata, c.data, bytes) || !c_valid(&c)) {
+            free(c.data);
+            goto fail;
+        }
+        roar_push(r, &c);
+    }
+
+    if (r->card != (int64_t)hdr.card)
+        goto fail;
+    return r;
+
+fail:
+    roar_free(r);
+    return NULL;
+}
+
+// }}}
+
+// {{{ each
+
+static void view_container_begin(struct koh_RoaringView *v) {
+    if (v->ci >= v->r->num)
+        return;
+
+    const struct Container *c = &v->r->cs[v->ci];
+    uint32_t base = (uint32_t)c->high << 16;
+    switch (c->type) {
+        case koh_ROAR_array:
+            v->pos = 0;
+            v->key = base | ((const uint16_t*)c->data)[0];
+            break;
+        case koh_ROAR_bitmap: {
+            const uint64_t *words = c->data;
+            int w = 0;
+            while (!words[w])
+                w++;
+            v->pos = w * 64 + __builtin_ctzll(words[w]);
+            v->key = base | v->pos;
+            break;
+        }
+        default:
+            v->pos = 0;
+            v->key = base | ((const struct Run*)c->data)[0].start;
+            break;
+    }
+}
+
+struct koh_RoaringView roar_each_begin(koh_Roaring *r) {
+    assert(r);
+    struct koh_RoaringView v = { .r = r, .ci = 0, };
+    view_container_begin(&v);
+    return v;
+}
+
+bool roar_each_valid(struct koh_RoaringView *v) {
+    assert(v);
+    return v->ci < v->r->num;
+}
+
+void roar_each_next(struct koh_RoaringView *v) {
+    assert(v);
+
+    const struct Container *c = &v->r->cs[v->ci];
+    uint32_t base = (uint32_t)c->high << 16;
+    switch (c->type) {
+        case koh_ROAR_array:
+            if (++v->pos < c->n) {
+                v->key = base | ((const uint16_t*)c->data)[v->pos];
+                return;
+            }
+            break;
+        case koh_ROAR_bitmap: {
+            const uint64_t *words = c->data;
+            int bit = v->pos + 1;
+            if (bit < 65536) {
+                int w = bit >> 6;
+                uint64_t bits = words[w] & (~0ULL << (bit & 63));
+                while (!bits && ++w < BITMAP_WORDS)
+                    bits = words[w];
+                if (bits) {
+                    v->pos = w * 64 + __builtin_ctzll(bits);
+                    v->key = base | v->pos;
+                    return;
+                }
+            }
+            break;
+        }
+        default: {
+            const struct Run *runs = c->data;
+            uint16_t low = v->key & 0xFFFF;
+            if (low < runs[v->pos].start + runs[v->pos].len) {
+                v->key++;
+                return;
+            }
+            if (++v->pos < c->n) {
+                v->key = base | runs[v->pos].start;
+                return;
+            }
+            break;
+        }
+    }
+
+    v->ci++;
+    view_container_begin(v);
+}
+
+const void *roar_each_key(struct koh_RoaringView *v) {
+    assert(v);
+    return &v->key;
+}
+
+int roar_each_key_len(struct koh_RoaringView *v) {
+    assert(v);
+    return sizeof(v->key);
+}
+
+// Первое значение >= value.
+static void view_seek(struct koh_RoaringView *v, uint64_t value) {
+    if (value > UINT32_MAX) {
+        v->ci = v->r->num;
+        return;
+    }
+
+    int i = roar_find(v->r, value >> 16);
+    v->ci = i >= 0 ? i : -i - 1;
+    if (i < 0) {
+        view_container_begin(v);
+        return;
+    }
+
+    const struct Container *c = &v->r->cs[i];
+    uint32_t base = (uint32_t)c->high << 16;
+    uint16_t low = value & 0xFFFF;
+    switch (c->type) {
+        case koh_ROAR_array: {
+            const uint16_t *arr = c->data;
+            v->pos = array_lower_bound(arr, c->n, low);
+            if (v->pos < c->n) {
+                v->key = base | arr[v->pos];
+                return;
+            }
+            break;
+        }
+        case koh_ROAR_bitmap: {
+            const uint64_t *words = c->data;
+            int w = low >> 6;
+            uint64_t bits = words[w] & (~0ULL << (low & 63));
+            while (!bits && ++w < BITMAP_WORDS)
+                bits = words[w];
+            if (bits) {
+                v->pos = w * 64 + __builtin_ctzll(bits);
+                v->key = base | v->pos;
+                return;
+            }
+            break;
+        }
+        default: {
+            const struct Run *runs = c->data;
+            int k = run_find(runs, c->n, low);
+            if (k >= 0 && low - runs[k].start <= runs[k].len) {
+                v->pos = k;
+                v->key = base | low;
+                return;
+            }
+            if (k + 1 < c->n) {
+                v->pos = k + 1;
+                v->key = base | runs[k + 1].start;
+                return;
+            }
+            break;
+        }
+    }
+    v->ci++;
+    view_container_begin(v);
+}
+
+void roar_each(koh_Roaring *r, koh_SetEachCb cb, void *udata) {
+    assert(r);
+    assert(cb);
+
+    struct koh_RoaringView v = roar_each_begin(r);
+    while (roar_each_valid(&v)) {
+        uint32_t key = v.key;
+        koh_SetAction action = cb(&key, sizeof(key), udata);
+        if (action == koh_SA_remove_next || action == koh_SA_remove_break) {
+            roar_remove(r, &key, sizeof(key));
+            if (action == koh_SA_remove_break)
+                return;
+            // Контейнер мог сменить представление или исчезнуть.
+            view_seek(&v, (uint64_t)key + 1);
+            continue;
+        }
+        if (action == koh_SA_break)
+            return;
+        roar_each_next(&v);
+    }
+}
+
+// }}}
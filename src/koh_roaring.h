@@ -0,0 +1,99 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+#pragma once
+
+#include "koh_set.h"
+#include "koh_set_stream.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+Сжатое множество uint32 (Roaring bitmap). Старшие 16 бит значения выбирают
+контейнер, младшие хранятся в нем одним из способов:
+
+    массив      отсортированные uint16, до KOH_ROAR_ARRAY_MAX значений
+    битовый     8 КиБ, 65536 бит
+    серии       пары (начало, длина - 1), для идущих подряд id
+
+Ключи передаются как в koh_Set - указателем и длиной sizeof(uint32_t),
+поэтому обход совместим с koh_SetEachCb. Серии появляются только после
+roar_optimize(), вставка и удаление в серии их сохраняют.
+
+Поток сериализации:
+
+    char        magic[4]        "KROA"
+    uint8_t     version
+    uint8_t     reserved[3]
+    uint32_t    containers_num
+    uint32_t    reserved
+    uint64_t    card
+    containers_num раз:
+        uint16_t    high
+        uint8_t     type        koh_ROAR_array/bitmap/run
+        uint8_t     reserved
+        uint32_t    n           значений в массиве, бит или серий
+        данные                  n * 2, 8192 или n * 4 байт
+*/
+
+#define KOH_ROAR_MAGIC      "KROA"
+#define KOH_ROAR_VERSION    1
+#define KOH_ROAR_ARRAY_MAX  4096
+
+enum koh_RoarType {
+    koh_ROAR_array  = 0,
+    koh_ROAR_bitmap = 1,
+    koh_ROAR_run    = 2,
+};
+
+typedef struct koh_Roaring koh_Roaring;
+
+struct koh_RoaringView {
+    koh_Roaring *r;
+    int         ci;
+    // индекс в массиве, номер бита или номер серии
+    int32_t     pos;
+    uint32_t    key;
+};
+
+struct koh_RoaringStats {
+    int     arrays, bitmaps, runs;
+    int64_t bytes;
+};
+
+koh_Roaring *roar_new(void);
+void roar_free(koh_Roaring *r);
+koh_Roaring *roar_clone(const koh_Roaring *r);
+
+// false для ключа другой длины, уже добавленного или отсутствующего.
+bool roar_add(koh_Roaring *r, const void *key, int key_len);
+bool roar_exist(const koh_Roaring *r, const void *key, int key_len);
+bool roar_remove(koh_Roaring *r, const void *key, int key_len);
+void roar_clear(koh_Roaring *r);
+int64_t roar_size(const koh_Roaring *r);
+bool roar_compare(const koh_Roaring *r1, const koh_Roaring *r2);
+
+// Переводит контейнеры в самое компактное представление.
+void roar_optimize(koh_Roaring *r);
+struct koh_RoaringStats roar_stats(const koh_Roaring *r);
+
+// Новые множества a & b и a | b, NULL при нехватке памяти.
+koh_Roaring *roar_and(const koh_Roaring *a, const koh_Roaring *b);
+koh_Roaring *roar_or(const koh_Roaring *a, const koh_Roaring *b);
+// Мощность пересечения без построения результата.
+int64_t roar_and_size(const koh_Roaring *a, const koh_Roaring *b);
+
+bool roar_write_stream(
+    const koh_Roaring *r, koh_SetStreamWrite write, void *udata
+);
+// NULL если поток поврежден или оборван.
+koh_Roaring *roar_read_stream(koh_SetStreamRead read, void *udata);
+
+// Обход по возрастанию, поддерживает koh_SA_remove_next и
+// koh_SA_remove_break.
+void roar_each(koh_Roaring *r, koh_SetEachCb cb, void *udata);
+
+struct koh_RoaringView roar_each_begin(koh_Roaring *r);
+bool roar_each_valid(struct koh_RoaringView *v);
+void roar_each_next(struct koh_RoaringView *v);
+const void *roar_each_key(struct koh_RoaringView *v);
+int roar_each_key_len(struct koh_RoaringView *v);
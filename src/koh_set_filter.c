@@ -0,0 +1,175 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+
+#include "koh_set_filter.h"
+#include "koh_set_hash.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINE_WORDS      8
+#define LINE_BITS       (LINE_WORDS * 64)
+#define FILTER_HASHES   6
+#define MIN_LINES       4
+
+struct FilterLine {
+    _Alignas(64) uint64_t w[LINE_WORDS];
+};
+
+struct koh_SetFilter {
+    koh_Set                     *set;
+    struct FilterLine           *lines;
+    uint64_t                    lines_num;      // степень двойки
+    int                         bits_per_key;
+    // ключей, на которое рассчитан массив, и удалений с момента сборки
+    int                         keys_cap, removed;
+    struct koh_SetFilterStats   stats;
+};
+
+static uint64_t lines_for(int keys, int bits_per_key) {
+    uint64_t need = ((uint64_t)keys * bits_per_key + LINE_BITS - 1) / LINE_BITS;
+    uint64_t n = MIN_LINES;
+    while (n < need)
+        n *= 2;
+    return n;
+}
+
+static void filter_put(koh_SetFilter *f, uint64_t h) {
+    struct FilterLine *line = &f->lines[h & (f->lines_num - 1)];
+    // 6 позиций по 9 бит из нижних 54 бит второго хеша
+    h = set_hash_mix(h);
+    for (int i = 0; i < FILTER_HASHES; i++) {
+        uint32_t bit = (h >> (i * 9)) & (LINE_BITS - 1);
+        line->w[bit >> 6] |= 1ULL << (bit & 63);
+    }
+}
+
+static bool filter_test(const koh_SetFilter *f, uint64_t h) {
+    const struct FilterLine *line = &f->lines[h & (f->lines_num - 1)];
+    h = set_hash_mix(h);
+    uint64_t miss = 0;
+    for (int i = 0; i < FILTER_HASHES; i++) {
+        uint32_t bit = (h >> (i * 9)) & (LINE_BITS - 1);
+        miss |= ~line->w[bit >> 6] & (1ULL << (bit & 63));
+    }
+    return !miss;
+}
+
+static bool filter_alloc(koh_SetFilter *f, int keys) {
+    uint64_t lines_num = lines_for(keys, f->bits_per_key);
+    struct FilterLine *lines = aligned_alloc(
+        _Alignof(struct FilterLine), sizeof(*lines) * lines_num
+    );
+    if (!lines)
+        return false;
+    free(f->lines);
+    f->lines = lines;
+    f->lines_num = lines_num;
+    f->keys_cap = lines_num * LINE_BITS / f->bits_per_key;
+    return true;
+}
+
+void set_filter_rebuild(koh_SetFilter *f) {
+    assert(f);
+
+    int num = set_size(f->set);
+    if (num > f->keys_cap || (num < f->keys_cap / 4 && f->lines_num > MIN_LINES)) {
+        // Без памяти остаются старые строки: ложных срабатываний больше, а
+        // следующая попытка только после удвоения числа ключей.
+        if (!filter_alloc(f, num) && num > f->keys_cap)
+            f->keys_cap = num > INT_MAX / 2 ? INT_MAX : num * 2;
+    }
+
+    memset(f->lines, 0, sizeof(*f->lines) * f->lines_num);
+    for (struct koh_SetView v = set_each_begin(f->set);
+            set_each_valid(&v); set_each_next(&v)) {
+        filter_put(f, set_hash_bytes(set_each_key(&v), set_each_key_len(&v)));
+    }
+    f->removed = 0;
+    f->stats.rebuilds++;
+}
+
+koh_SetFilter *set_filter_new(koh_Set *set, int bits_per_key) {
+    assert(set);
+
+    koh_SetFilter *f = calloc(1, sizeof(*f));
+    if (!f)
+        return NULL;
+    f->set = set;
+    f->bits_per_key = bits_per_key > 0 ? bits_per_key : 10;
+    if (!filter_alloc(f, set_size(set))) {
+        free(f);
+        return NULL;
+    }
+    set_filter_rebuild(f);
+    f->stats.rebuilds = 0;
+    return f;
+}
+
+void set_filter_free(koh_SetFilter *f) {
+    if (!f)
+        return;
+    free(f->lines);
+    free(f);
+}
+
+bool set_filter_add(koh_SetFilter *f, const void *key, int key_len) {
+    assert(f);
+
+    int num = set_size(f->set);
+    set_add(f->set, key, key_len);
+    bool added = set_size(f->set) > num;
+    if (set_size(f->set) > f->keys_cap)
+        set_filter_rebuild(f);
+    else
+        filter_put(f, set_hash_bytes(key, key_len));
+    return added;
+}
+
+bool set_filter_exist(koh_SetFilter *f, const void *key, int key_len) {
+    assert(f);
+
+    if (f->removed > f->keys_cap / 4 || f->removed > set_size(f->set))
+        set_filter_rebuild(f);
+
+    f->stats.queries++;
+    if (!filter_test(f, set_hash_bytes(key, key_len))) {
+        f->stats.filtered++;
+        return false;
+    }
+
+    bool exist = set_exist(f->set, key, key_len);
+    if (!exist)
+        f->stats.false_positives++;
+    return exist;
+}
+
+bool set_filter_remove(koh_SetFilter *f, const void *key, int key_len) {
+    assert(f);
+
+    int num = set_size(f->set);
+    set_remove(f->set, key, key_len);
+    bool removed = set_size(f->set) < num;
+    if (removed)
+        f->removed++;
+    return removed;
+}
+
+void set_filter_clear(koh_SetFilter *f) {
+    assert(f);
+
+    set_clear(f->set);
+    memset(f->lines, 0, sizeof(*f->lines) * f->lines_num);
+    f->removed = 0;
+}
+
+koh_Set *set_filter_set(koh_SetFilter *f) {
+    assert(f);
+    return f->set;
+}
+
+struct koh_SetFilterStats set_filter_stats(const koh_SetFilter *f) {
+    assert(f);
+    return f->stats;
+}
@@ -0,0 +1,43 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+#pragma once
+
+#include "koh_set.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+Фильтр Блума перед koh_Set для запросов, которые в основном промахиваются.
+Биты ключа лежат в одной кеш-линии (512 бит), поэтому отрицательный ответ
+стоит одного обращения к памяти и не трогает таблицу множества.
+
+Удаление не снимает биты - лишние биты дают только ложные срабатывания,
+которые отсекает set_exist(). Фильтр перестраивается лениво, когда
+удаленных ключей накопилось больше четверти.
+*/
+
+struct koh_SetFilterStats {
+    uint64_t    queries,
+                // отвечено фильтром без обращения к множеству
+                filtered,
+                // фильтр пропустил, но ключа в множестве нет
+                false_positives,
+                rebuilds;
+};
+
+typedef struct koh_SetFilter koh_SetFilter;
+
+// Множество не копируется и не освобождается фильтром. После создания
+// изменять set нужно только через set_filter_add/remove/clear.
+// bits_per_key <= 0 - значение по умолчанию (10 бит, около 1% ложных).
+koh_SetFilter *set_filter_new(koh_Set *set, int bits_per_key);
+void set_filter_free(koh_SetFilter *f);
+
+bool set_filter_add(koh_SetFilter *f, const void *key, int key_len);
+bool set_filter_exist(koh_SetFilter *f, const void *key, int key_len);
+bool set_filter_remove(koh_SetFilter *f, const void *key, int key_len);
+void set_filter_clear(koh_SetFilter *f);
+void set_filter_rebuild(koh_SetFilter *f);
+
+koh_Set *set_filter_set(koh_SetFilter *f);
+struct koh_SetFilterStats set_filter_stats(const koh_SetFilter *f);
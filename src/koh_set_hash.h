@@ -0,0 +1,40 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// Общая хеш-функция для таблиц-компаньонов koh_Set.
+// Результат не зависит от адреса ключа и одинаков между запусками, поэтому
+// его можно сохранять на диск.
+
+static inline uint64_t set_hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint64_t set_hash_bytes(const void *key, int key_len) {
+    const uint8_t *p = key;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ (uint64_t)key_len;
+
+    while (key_len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        h = (h ^ set_hash_mix(w)) * 0x9fb21c651e98df25ULL;
+        p += 8;
+        key_len -= 8;
+    }
+
+    if (key_len > 0) {
+        uint64_t w = 0;
+        memcpy(&w, p, key_len);
+        h = (h ^ set_hash_mix(w)) * 0x9fb21c651e98df25ULL;
+    }
+
+    return set_hash_mix(h);
+}
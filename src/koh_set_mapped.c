@@ -0,0 +1,265 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+
+#include "koh_set_mapped.h"
+#include "koh_set_hash.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct koh_SetMapped {
+    const uint8_t                       *base;
+    size_t                              size;
+    const struct koh_SetMappedHeader    *hdr;
+    const struct koh_SetMappedSlot      *slots;
+};
+
+static uint64_t align8(uint64_t n) {
+    return (n + 7) & ~(uint64_t)7;
+}
+
+static bool write_all(FILE *f, const void *data, size_t len) {
+    return fwrite(data, 1, len, f) == len;
+}
+
+bool set_save(koh_Set *set, const char *path) {
+    assert(set);
+    assert(path);
+
+    uint64_t num = set_size(set);
+    uint64_t cap = 8;
+    // Загрузка не больше 50%, чтобы промахи заканчивались быстро.
+    while (cap < num * 2)
+        cap *= 2;
+
+    struct koh_SetMappedSlot *slots = malloc(sizeof(*slots) * cap);
+    if (!slots)
+        return false;
+    for (uint64_t i = 0; i < cap; i++)
+        slots[i] = (struct koh_SetMappedSlot) { .key_len = -1, };
+
+    struct koh_SetMappedHeader hdr = {
+        .magic = KOH_SET_MAPPED_MAGIC,
+        .version = KOH_SET_MAPPED_VERSION,
+        .header_size = sizeof(hdr),
+        .num = num,
+        .cap = cap,
+        .slots_offset = align8(sizeof(hdr)),
+    };
+    hdr.keys_offset = hdr.slots_offset + sizeof(*slots) * cap;
+
+    uint64_t keys_len = 0;
+    for (struct koh_SetView v = set_each_begin(set);
+            set_each_valid(&v); set_each_next(&v)) {
+        const void *key = set_each_key(&v);
+        int key_len = set_each_key_len(&v);
+        uint64_t h = set_hash_bytes(key, key_len);
+        uint64_t j = h & (cap - 1);
+        while (slots[j].key_len != -1)
+            j = (j + 1) & (cap - 1);
+        slots[j].hash = h;
+        slots[j].key_len = key_len;
+        slots[j].key_offset = hdr.keys_offset + keys_len;
+        keys_len += align8(key_len);
+    }
+    hdr.file_size = hdr.keys_offset + keys_len;
+
+    size_t tmp_path_len = strlen(path) + 5;
+    char tmp_path[tmp_path_len];
+    snprintf(tmp_path, tmp_path_len, "%s.tmp", path);
+
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        free(slots);
+        return false;
+    }
+
+    const uint8_t zeros[8] = {};
+    bool ok = write_all(f, &hdr, sizeof(hdr));
+    ok = ok && write_all(f, zeros, hdr.slots_offset - sizeof(hdr));
+    ok = ok && write_all(f, slots, sizeof(*slots) * cap);
+
+    // Порядок обхода тот же, что и при заполнении слотов.
+    for (struct koh_SetView v = set_each_begin(set);
+            ok && set_each_valid(&v); set_each_next(&v)) {
+        int key_len = set_each_key_len(&v);
+        ok = write_all(f, set_each_key(&v), key_len);
+        ok = ok && write_all(f, zeros, align8(key_len) - key_len);
+    }
+
+    free(slots);
+    ok = (fclose(f) == 0) && ok;
+    if (ok)
+        ok = rename(tmp_path, path) == 0;
+    if (!ok)
+        remove(tmp_path);
+    return ok;
+}
+
+static bool header_valid(const struct koh_SetMappedHeader *hdr, size_t size) {
+    if (size < sizeof(*hdr))
+        return false;
+    if (memcmp(hdr->magic, KOH_SET_MAPPED_MAGIC, sizeof(hdr->magic)))
+        return false;
+    if (hdr->version != KOH_SET_MAPPED_VERSION)
+        return false;
+    if (hdr->header_size != sizeof(*hdr) || hdr->file_size != size)
+        return false;
+    if (!hdr->cap || (hdr->cap & (hdr->cap - 1)) || hdr->num >= hdr->cap)
+        return false;
+    if (hdr->slots_offset % 8 || hdr->slots_offset < sizeof(*hdr))
+        return false;
+    uint64_t slots_size = hdr->cap * sizeof(struct koh_SetMappedSlot);
+    return hdr->keys_offset == hdr->slots_offset + slots_size &&
+           hdr->keys_offset <= size;
+}
+
+koh_SetMapped *set_open_mapped(const char *path) {
+    assert(path);
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = st.st_size;
+    void *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    const struct koh_SetMappedHeader *hdr = base;
+    if (!header_valid(hdr, size)) {
+        munmap(base, size);
+        return NULL;
+    }
+
+    koh_SetMapped *set = calloc(1, sizeof(*set));
+    if (!set) {
+        munmap(base, size);
+        return NULL;
+    }
+    set->base = base;
+    set->size = size;
+    set->hdr = hdr;
+    set->slots = (const void*)(set->base + hdr->slots_offset);
+    return set;
+}
+
+void set_mapped_close(koh_SetMapped *set) {
+    if (!set)
+        return;
+    munmap((void*)set->base, set->size);
+    free(set);
+}
+
+static const void *slot_key(
+    const koh_SetMapped *set, const struct koh_SetMappedSlot *slot
+) {
+    // Ключ за пределами файла считаем отсутствующим, а не падаем.
+    if (slot->key_offset + (uint64_t)slot->key_len > set->size)
+        return NULL;
+    return set->base + slot->key_offset;
+}
+
+bool set_mapped_exist(const koh_SetMapped *set, const void *key, int key_len) {
+    assert(set);
+    assert(key);
+
+    uint64_t mask = set->hdr->cap - 1;
+    uint64_t h = set_hash_bytes(key, key_len);
+    uint64_t j = h & mask;
+    for (uint64_t probes = 0; probes <= mask; probes++, j = (j + 1) & mask) {
+        const struct koh_SetMappedSlot *slot = &set->slots[j];
+        if (slot->key_len == -1)
+            return false;
+        if (slot->hash == h && slot->key_len == key_len) {
+            const void *slot_k = slot_key(set, slot);
+            if (slot_k && !memcmp(slot_k, key, key_len))
+                return true;
+        }
+    }
+    return false;
+}
+
+int set_mapped_size(const koh_SetMapped *set) {
+    assert(set);
+    return set->hdr->num;
+}
+
+void set_mapped_each(
+    const koh_SetMapped *set, koh_SetAction (*cb)(
+        const void *key, int key_len, void *udata
+    ), void *udata
+) {
+    assert(set);
+    assert(cb);
+
+    for (struct koh_SetMappedView v = set_mapped_each_begin(set);
+            set_mapped_each_valid(&v); set_mapped_each_next(&v)) {
+        koh_SetAction action = cb(
+            set_mapped_each_key(&v), set_mapped_each_key_len(&v), udata
+        );
+        if (action == koh_SA_break || action == koh_SA_remove_break)
+            break;
+    }
+}
+
+koh_Set *set_mapped_to_set(const koh_SetMapped *set) {
+    assert(set);
+
+    koh_Set *copy = set_new();
+    if (!copy)
+        return NULL;
+    for (struct koh_SetMappedView v = set_mapped_each_begin(set);
+            set_mapped_each_valid(&v); set_mapped_each_next(&v)) {
+        set_add(copy, set_mapped_each_key(&v), set_mapped_each_key_len(&v));
+    }
+    return copy;
+}
+
+static int64_t next_taken(const koh_SetMapped *set, int64_t i) {
+    int64_t cap = set->hdr->cap;
+    while (i < cap &&
+            (set->slots[i].key_len == -1 || !slot_key(set, &set->slots[i])))
+        i++;
+    return i;
+}
+
+struct koh_SetMappedView set_mapped_each_begin(const koh_SetMapped *set) {
+    assert(set);
+    return (struct koh_SetMappedView) {
+        .set = set,
+        .i = next_taken(set, 0),
+    };
+}
+
+bool set_mapped_each_valid(struct koh_SetMappedView *v) {
+    assert(v);
+    return v->i < (int64_t)v->set->hdr->cap;
+}
+
+void set_mapped_each_next(struct koh_SetMappedView *v) {
+    assert(v);
+    v->i = next_taken(v->set, v->i + 1);
+}
+
+const void *set_mapped_each_key(struct koh_SetMappedView *v) {
+    assert(v);
+    return slot_key(v->set, &v->set->slots[v->i]);
+}
+
+int set_mapped_each_key_len(struct koh_SetMappedView *v) {
+    assert(v);
+    return v->set->slots[v->i].key_len;
+}
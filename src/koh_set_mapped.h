@@ -0,0 +1,66 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+#pragma once
+
+#include "koh_set.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+Формат файла (все смещения от начала файла, таблица не зависит от адреса
+отображения):
+
+    struct koh_SetMappedHeader
+    struct koh_SetMappedSlot    slots[cap]      cap - степень двойки
+    uint8_t                     keys[]          ключи, выровнены на 8 байт
+
+Поиск - линейное пробирование от hash & (cap - 1), пустой слот имеет
+key_len == -1.
+*/
+
+#define KOH_SET_MAPPED_MAGIC    "KOHSETM"
+#define KOH_SET_MAPPED_VERSION  1
+
+struct koh_SetMappedHeader {
+    char        magic[8];
+    uint32_t    version, header_size;
+    uint64_t    num, cap;
+    uint64_t    slots_offset, keys_offset, file_size;
+};
+
+struct koh_SetMappedSlot {
+    uint64_t    hash, key_offset;
+    int32_t     key_len;
+    uint32_t    reserved;
+};
+
+typedef struct koh_SetMapped koh_SetMapped;
+
+struct koh_SetMappedView {
+    const koh_SetMapped *set;
+    int64_t             i;
+};
+
+// Записывает множество во временный файл и переименовывает в path.
+bool set_save(koh_Set *set, const char *path);
+
+// Только для чтения. Возвращает NULL если файл не найден или поврежден.
+koh_SetMapped *set_open_mapped(const char *path);
+void set_mapped_close(koh_SetMapped *set);
+
+bool set_mapped_exist(const koh_SetMapped *set, const void *key, int key_len);
+int set_mapped_size(const koh_SetMapped *set);
+// Действия удаления игнорируются, koh_SA_remove_break работает как break.
+void set_mapped_each(
+    const koh_SetMapped *set, koh_SetAction (*cb)(
+        const void *key, int key_len, void *udata
+    ), void *udata
+);
+// Копирует ключи в новое изменяемое множество.
+koh_Set *set_mapped_to_set(const koh_SetMapped *set);
+
+struct koh_SetMappedView set_mapped_each_begin(const koh_SetMapped *set);
+bool set_mapped_each_valid(struct koh_SetMappedView *v);
+void set_mapped_each_next(struct koh_SetMappedView *v);
+const void *set_mapped_each_key(struct koh_SetMappedView *v);
+int set_mapped_each_key_len(struct koh_SetMappedView *v);
@@ -0,0 +1,231 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+
+#include "koh_set_stream.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNK_SIZE  4096
+
+struct StreamHeader {
+    char        magic[4];
+    uint8_t     version, mode;
+    uint16_t    reserved;
+    uint32_t    key_len;
+    uint64_t    num;
+};
+
+struct Writer {
+    koh_SetStreamWrite  write;
+    void                *udata;
+    size_t              len;
+    bool                ok;
+    uint8_t             chunk[CHUNK_SIZE];
+};
+
+static void writer_flush(struct Writer *w) {
+    if (w->ok && w->len)
+        w->ok = w->write(w->chunk, w->len, w->udata);
+    w->len = 0;
+}
+
+static void writer_put(struct Writer *w, const void *data, size_t len) {
+    if (len > CHUNK_SIZE / 2) {
+        // Крупный ключ уходит без копирования, после накопленного в куске.
+        writer_flush(w);
+        if (w->ok)
+            w->ok = w->write(data, len, w->udata);
+        return;
+    }
+    if (w->len + len > CHUNK_SIZE)
+        writer_flush(w);
+    memcpy(w->chunk + w->len, data, len);
+    w->len += len;
+}
+
+static void writer_put_varint(struct Writer *w, uint32_t value) {
+    uint8_t buf[5];
+    int n = 0;
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        buf[n++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    writer_put(w, buf, n);
+}
+
+bool set_write_stream(koh_Set *set, koh_SetStreamWrite write, void *udata) {
+    assert(set);
+    assert(write);
+
+    struct StreamHeader hdr = {
+        .magic = { 'K', 'S', 'S', 'T', },
+        .version = KOH_SET_STREAM_VERSION,
+        .mode = koh_SSM_fixed,
+        .num = set_size(set),
+    };
+
+    // Первый проход только по длинам, чтобы выбрать кодировку.
+    bool first = true;
+    for (struct koh_SetView v = set_each_begin(set);
+            set_each_valid(&v); set_each_next(&v)) {
+        uint32_t key_len = set_each_key_len(&v);
+        if (first) {
+            hdr.key_len = key_len;
+            first = false;
+        } else if (key_len != hdr.key_len) {
+            hdr.mode = koh_SSM_var;
+            hdr.key_len = 0;
+            break;
+        }
+    }
+
+    struct Writer *w = malloc(sizeof(*w));
+    if (!w)
+        return false;
+    w->write = write;
+    w->udata = udata;
+    w->len = 0;
+    w->ok = true;
+
+    writer_put(w, &hdr, sizeof(hdr));
+    for (struct koh_SetView v = set_each_begin(set);
+            w->ok && set_each_valid(&v); set_each_next(&v)) {
+        int key_len = set_each_key_len(&v);
+        if (hdr.mode == koh_SSM_var)
+            writer_put_varint(w, key_len);
+        writer_put(w, set_each_key(&v), key_len);
+    }
+    writer_flush(w);
+
+    bool ok = w->ok;
+    free(w);
+    return ok;
+}
+
+struct Reader {
+    koh_SetStreamRead   read;
+    void                *udata;
+    size_t              pos, end;
+    uint8_t             chunk[CHUNK_SIZE];
+};
+
+// Гарантирует n непрочитанных байт в куске, n <= CHUNK_SIZE.
+static bool reader_need(struct Reader *r, size_t n) {
+    if (r->end - r->pos >= n)
+        return true;
+
+    memmove(r->chunk, r->chunk + r->pos, r->end - r->pos);
+    r->end -= r->pos;
+    r->pos = 0;
+    while (r->end < n) {
+        size_t got = r->read(r->chunk + r->end, CHUNK_SIZE - r->end, r->udata);
+        if (!got)
+            return false;
+        r->end += got;
+    }
+    return true;
+}
+
+// Ключ крупнее куска собирается в отдельный буфер.
+static bool reader_take_big(struct Reader *r, uint8_t *dst, size_t n) {
+    size_t have = r->end - r->pos;
+    memcpy(dst, r->chunk + r->pos, have);
+    r->pos = r->end = 0;
+    while (have < n) {
+        size_t got = r->read(dst + have, n - have, r->udata);
+        if (!got)
+            return false;
+        have += got;
+    }
+    return true;
+}
+
+static bool reader_varint(struct Reader *r, uint32_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (!reader_need(r, 1))
+            return false;
+        uint8_t byte = r->chunk[r->pos++];
+        *value |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static bool reader_add_key(struct Reader *r, koh_Set *set, uint32_t key_len) {
+    if (key_len > INT_MAX)
+        return false;
+
+    if (key_len <= CHUNK_SIZE) {
+        if (!reader_need(r, key_len))
+            return false;
+        // Ключ добавляется прямо из куска чтения.
+        set_add(set, r->chunk + r->pos, key_len);
+        r->pos += key_len;
+        return true;
+    }
+
+    uint8_t *big = malloc(key_len);
+    if (!big)
+        return false;
+    bool ok = reader_take_big(r, big, key_len);
+    if (ok)
+        set_add(set, big, key_len);
+    free(big);
+    return ok;
+}
+
+int64_t set_read_stream(koh_Set *set, koh_SetStreamRead read, void *udata) {
+    assert(set);
+    assert(read);
+
+    struct Reader *r = malloc(sizeof(*r));
+    if (!r)
+        return -1;
+    r->read = read;
+    r->udata = udata;
+    r->pos = r->end = 0;
+
+    struct StreamHeader hdr;
+    int64_t num = -1;
+
+    if (!reader_need(r, sizeof(hdr)))
+        goto cleanup;
+    memcpy(&hdr, r->chunk, sizeof(hdr));
+    r->pos += sizeof(hdr);
+
+    if (memcmp(hdr.magic, KOH_SET_STREAM_MAGIC, sizeof(hdr.magic)) ||
+            hdr.version != KOH_SET_STREAM_VERSION ||
+            hdr.num > INT64_MAX)
+        goto cleanup;
+
+    for (uint64_t i = 0; i < hdr.num; i++) {
+        uint32_t key_len = hdr.key_len;
+        if (hdr.mode == koh_SSM_var) {
+            if (!reader_varint(r, &key_len))
+                goto cleanup;
+        } else if (hdr.mode != koh_SSM_fixed) {
+            goto cleanup;
+        }
+        if (!reader_add_key(r, set, key_len))
+            goto cleanup;
+    }
+    num = hdr.num;
+
+cleanup:
+    free(r);
+    return num;
+}
+
+bool set_stream_fwrite(const void *data, size_t len, void *udata) {
+    return fwrite(data, 1, len, udata) == len;
+}
+
+size_t set_stream_fread(void *data, size_t len, void *udata) {
+    return fread(data, 1, len, udata);
+}
@@ -0,0 +1,47 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+#pragma once
+
+#include "koh_set.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Потоковый формат koh_Set:
+
+    char        magic[4]        "KSST"
+    uint8_t     version
+    uint8_t     mode            koh_SSM_fixed или koh_SSM_var
+    uint16_t    reserved
+    uint32_t    key_len         только для koh_SSM_fixed
+    uint64_t    num
+
+koh_SSM_fixed - далее num * key_len байт ключей подряд.
+koh_SSM_var   - для каждого ключа varint(LEB128) длины и байты ключа.
+*/
+
+#define KOH_SET_STREAM_MAGIC    "KSST"
+#define KOH_SET_STREAM_VERSION  1
+
+enum koh_SetStreamMode {
+    koh_SSM_fixed   = 0,
+    koh_SSM_var     = 1,
+};
+
+// Возвращает false при ошибке записи, кодирование прерывается.
+typedef bool (*koh_SetStreamWrite)(const void *data, size_t len, void *udata);
+// Возвращает количество прочитанных байт, 0 - конец потока или ошибка.
+typedef size_t (*koh_SetStreamRead)(void *data, size_t len, void *udata);
+
+// Мелкие ключи собираются в кусок внутри кодировщика, ключи крупнее
+// половины куска отдаются в write() напрямую из памяти множества.
+bool set_write_stream(koh_Set *set, koh_SetStreamWrite write, void *udata);
+
+// Добавляет прочитанные ключи в set. Возвращает количество ключей в потоке
+// или -1 если поток поврежден или оборван.
+int64_t set_read_stream(koh_Set *set, koh_SetStreamRead read, void *udata);
+
+// Обертки над FILE*, udata - открытый файл.
+bool set_stream_fwrite(const void *data, size_t len, void *udata);
+size_t set_stream_fread(void *data, size_t len, void *udata);
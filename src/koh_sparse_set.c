@@ -0,0 +1,148 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+
+#include "koh_sparse_set.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PAGES_NUM   ((KOH_SPARSE_ID_MASK + 1) / KOH_SPARSE_PAGE)
+
+struct koh_SparseSet {
+    // позиция в dense, значимы только записи с dense[pos] == сущность
+    uint32_t    *pages[PAGES_NUM];
+    de_entity   *dense;
+    int         num, cap;
+};
+
+static inline uint32_t *sparse_slot(koh_SparseSet *ss, de_entity e) {
+    uint32_t id = e & KOH_SPARSE_ID_MASK;
+    uint32_t *page = ss->pages[id / KOH_SPARSE_PAGE];
+    return page ? &page[id % KOH_SPARSE_PAGE] : NULL;
+}
+
+koh_SparseSet *sset_new(void) {
+    return calloc(1, sizeof(koh_SparseSet));
+}
+
+void sset_free(koh_SparseSet *ss) {
+    if (!ss)
+        return;
+    for (size_t i = 0; i < PAGES_NUM; i++)
+        free(ss->pages[i]);
+    free(ss->dense);
+    free(ss);
+}
+
+bool sset_exist(koh_SparseSet *ss, de_entity e) {
+    assert(ss);
+    uint32_t *slot = sparse_slot(ss, e);
+    return slot && *slot < (uint32_t)ss->num && ss->dense[*slot] == e;
+}
+
+bool sset_add(koh_SparseSet *ss, de_entity e) {
+    assert(ss);
+
+    if (sset_exist(ss, e))
+        return false;
+
+    uint32_t id = e & KOH_SPARSE_ID_MASK;
+    uint32_t **page = &ss->pages[id / KOH_SPARSE_PAGE];
+    if (!*page) {
+        *page = calloc(KOH_SPARSE_PAGE, sizeof(**page));
+        if (!*page)
+            return false;
+    }
+
+    // id занят другой версией - старая сущность уже мертва, ее место в
+    // плотном массиве занимает новая.
+    uint32_t pos = (*page)[id % KOH_SPARSE_PAGE];
+    if (pos < (uint32_t)ss->num && (ss->dense[pos] & KOH_SPARSE_ID_MASK) == id) {
+        ss->dense[pos] = e;
+        return true;
+    }
+
+    if (ss->num == ss->cap) {
+        int cap = ss->cap ? ss->cap * 2 : 64;
+        de_entity *dense = realloc(ss->dense, sizeof(*dense) * cap);
+        if (!dense)
+            return false;
+        ss->dense = dense;
+        ss->cap = cap;
+    }
+
+    (*page)[id % KOH_SPARSE_PAGE] = ss->num;
+    ss->dense[ss->num++] = e;
+    return true;
+}
+
+static void sset_remove_at(koh_SparseSet *ss, uint32_t pos) {
+    de_entity last = ss->dense[--ss->num];
+    ss->dense[pos] = last;
+    *sparse_slot(ss, last) = pos;
+}
+
+bool sset_remove(koh_SparseSet *ss, de_entity e) {
+    assert(ss);
+
+    if (!sset_exist(ss, e))
+        return false;
+    sset_remove_at(ss, *sparse_slot(ss, e));
+    return true;
+}
+
+void sset_clear(koh_SparseSet *ss) {
+    assert(ss);
+    ss->num = 0;
+}
+
+int sset_size(koh_SparseSet *ss) {
+    assert(ss);
+    return ss->num;
+}
+
+const de_entity *sset_dense(koh_SparseSet *ss) {
+    assert(ss);
+    return ss->dense;
+}
+
+void sset_each(koh_SparseSet *ss, koh_SparseSetEachCb cb, void *udata) {
+    assert(ss);
+    assert(cb);
+
+    // С конца: на место удаленной встает уже пройденная сущность.
+    for (int64_t i = ss->num - 1; i >= 0; i--) {
+        switch (cb(ss->dense[i], udata)) {
+            case koh_SA_next:
+                break;
+            case koh_SA_break:
+                return;
+            case koh_SA_remove_next:
+                sset_remove_at(ss, i);
+                break;
+            case koh_SA_remove_break:
+                sset_remove_at(ss, i);
+                return;
+        }
+    }
+}
+
+struct koh_SparseSetView sset_each_begin(koh_SparseSet *ss) {
+    assert(ss);
+    return (struct koh_SparseSetView) { .ss = ss, .i = 0, };
+}
+
+bool sset_each_valid(struct koh_SparseSetView *v) {
+    assert(v);
+    return v->i < v->ss->num;
+}
+
+void sset_each_next(struct koh_SparseSetView *v) {
+    assert(v);
+    v->i++;
+}
+
+de_entity sset_each_entity(struct koh_SparseSetView *v) {
+    assert(v);
+    return v->ss->dense[v->i];
+}
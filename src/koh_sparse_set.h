@@ -0,0 +1,54 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+#pragma once
+
+#include "koh_destral_ecs.h"
+#include "koh_set.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+Разреженное множество сущностей ECS. sparse[id] хранит позицию в плотном
+массиве сущностей, поэтому add/exist/remove - два обращения к памяти без
+хеширования, а обход идет по непрерывному массиву.
+
+sparse разбит на страницы по KOH_SPARSE_PAGE записей, страница выделяется
+при первом id из ее диапазона. Индексом служат младшие биты сущности
+по маске DE_ENTITY_ID_MASK, в плотном массиве хранится сущность целиком,
+поэтому сущность с другой версией не найдется.
+*/
+
+#define KOH_SPARSE_ID_MASK  DE_ENTITY_ID_MASK
+#define KOH_SPARSE_PAGE     4096
+
+typedef struct koh_SparseSet koh_SparseSet;
+
+struct koh_SparseSetView {
+    koh_SparseSet   *ss;
+    int64_t         i;
+};
+
+typedef koh_SetAction (*koh_SparseSetEachCb)(de_entity e, void *udata);
+
+koh_SparseSet *sset_new(void);
+void sset_free(koh_SparseSet *ss);
+
+// false если сущность уже есть или не хватило памяти. Сущность с тем же id,
+// но другой версией заменяется новой.
+bool sset_add(koh_SparseSet *ss, de_entity e);
+bool sset_exist(koh_SparseSet *ss, de_entity e);
+// Последняя сущность переносится на место удаленной.
+bool sset_remove(koh_SparseSet *ss, de_entity e);
+// Страницы sparse остаются выделенными.
+void sset_clear(koh_SparseSet *ss);
+int sset_size(koh_SparseSet *ss);
+// Плотный массив из sset_size() сущностей, действителен до изменения.
+const de_entity *sset_dense(koh_SparseSet *ss);
+
+// Обход с конца, поддерживает koh_SA_remove_next и koh_SA_remove_break.
+void sset_each(koh_SparseSet *ss, koh_SparseSetEachCb cb, void *udata);
+
+struct koh_SparseSetView sset_each_begin(koh_SparseSet *ss);
+bool sset_each_valid(struct koh_SparseSetView *v);
+void sset_each_next(struct koh_SparseSetView *v);
+de_entity sset_each_entity(struct koh_SparseSetView *v);
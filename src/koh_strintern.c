@@ -0,0 +1,182 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+
+#include "koh_strintern.h"
+#include "koh_set_hash.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK     (64 * 1024)
+#define TABLE_MIN_CAP   64
+
+struct ArenaBlock {
+    struct ArenaBlock   *next;
+    size_t              used, cap;
+    char                data[];
+};
+
+// Строка в арене: длина перед символами.
+struct StrRecord {
+    uint32_t    hash, len;
+    char        s[];
+};
+
+struct koh_StrIntern {
+    struct ArenaBlock   *arena;
+    // id -> запись, records[0] не используется
+    struct StrRecord    **records;
+    uint32_t            records_num, records_cap;
+    // открытая адресация, 0 - пустая ячейка
+    uint32_t            *table;
+    uint32_t            table_cap;
+};
+
+static void oom(const char *where) {
+    fprintf(stderr, "%s: allocation failed\n", where);
+    abort();
+}
+
+koh_StrIntern *strint_new(void) {
+    koh_StrIntern *si = calloc(1, sizeof(*si));
+    if (!si)
+        return NULL;
+    si->table_cap = TABLE_MIN_CAP;
+    si->table = calloc(si->table_cap, sizeof(*si->table));
+    si->records_cap = TABLE_MIN_CAP;
+    si->records = malloc(sizeof(*si->records) * si->records_cap);
+    if (!si->table || !si->records) {
+        free(si->table);
+        free(si->records);
+        free(si);
+        return NULL;
+    }
+    si->records[0] = NULL;
+    si->records_num = 1;
+    return si;
+}
+
+void strint_free(koh_StrIntern *si) {
+    if (!si)
+        return;
+    for (struct ArenaBlock *b = si->arena, *next; b; b = next) {
+        next = b->next;
+        free(b);
+    }
+    free(si->records);
+    free(si->table);
+    free(si);
+}
+
+static struct StrRecord *arena_alloc(koh_StrIntern *si, uint32_t len) {
+    size_t need = (sizeof(struct StrRecord) + len + 1 + 7) & ~(size_t)7;
+    struct ArenaBlock *b = si->arena;
+    if (!b || b->used + need > b->cap) {
+        size_t cap = need > ARENA_BLOCK ? need : ARENA_BLOCK;
+        b = malloc(sizeof(*b) + cap);
+        if (!b)
+            oom("strint arena_alloc");
+        b->used = 0;
+        b->cap = cap;
+        b->next = si->arena;
+        si->arena = b;
+    }
+    struct StrRecord *rec = (void*)(b->data + b->used);
+    b->used += need;
+    return rec;
+}
+
+static uint32_t *table_find(
+    koh_StrIntern *si, const char *s, uint32_t len, uint32_t h
+) {
+    uint32_t mask = si->table_cap - 1;
+    for (uint32_t i = h & mask;; i = (i + 1) & mask) {
+        uint32_t id = si->table[i];
+        if (id == KOH_STRINT_NONE)
+            return &si->table[i];
+        const struct StrRecord *rec = si->records[id];
+        if (rec->hash == h && rec->len == len && !memcmp(rec->s, s, len))
+            return &si->table[i];
+    }
+}
+
+static void table_grow(koh_StrIntern *si) {
+    uint32_t cap = si->table_cap * 2;
+    uint32_t *table = calloc(cap, sizeof(*table));
+    if (!table)
+        oom("strint table_grow");
+    for (uint32_t id = 1; id < si->records_num; id++) {
+        uint32_t i = si->records[id]->hash & (cap - 1);
+        while (table[i] != KOH_STRINT_NONE)
+            i = (i + 1) & (cap - 1);
+        table[i] = id;
+    }
+    free(si->table);
+    si->table = table;
+    si->table_cap = cap;
+}
+
+static uint32_t str_len(const char *s, int len) {
+    return len < 0 ? strlen(s) : (uint32_t)len;
+}
+
+uint32_t strint_intern(koh_StrIntern *si, const char *s, int len) {
+    assert(si);
+    assert(s);
+
+    uint32_t n = str_len(s, len);
+    uint32_t h = set_hash_bytes(s, n);
+    uint32_t *slot = table_find(si, s, n, h);
+    if (*slot != KOH_STRINT_NONE)
+        return *slot;
+
+    if (si->records_num == si->records_cap) {
+        uint32_t cap = si->records_cap * 2;
+        struct StrRecord **records = realloc(
+            si->records, sizeof(*records) * cap
+        );
+        if (!records)
+            oom("strint_intern");
+        si->records = records;
+        si->records_cap = cap;
+    }
+
+    struct StrRecord *rec = arena_alloc(si, n);
+    rec->hash = h;
+    rec->len = n;
+    memcpy(rec->s, s, n);
+    rec->s[n] = 0;
+
+    uint32_t id = si->records_num++;
+    si->records[id] = rec;
+    *slot = id;
+
+    // Загрузка таблицы не больше 1/2.
+    if (si->records_num * 2 > si->table_cap)
+        table_grow(si);
+    return id;
+}
+
+uint32_t strint_find(koh_StrIntern *si, const char *s, int len) {
+    assert(si);
+    assert(s);
+
+    uint32_t n = str_len(s, len);
+    return *table_find(si, s, n, set_hash_bytes(s, n));
+}
+
+const char *strint_str(koh_StrIntern *si, uint32_t id, int *len) {
+    assert(si);
+
+    if (id == KOH_STRINT_NONE || id >= si->records_num)
+        return NULL;
+    if (len)
+        *len = si->records[id]->len;
+    return si->records[id]->s;
+}
+
+int strint_size(koh_StrIntern *si) {
+    assert(si);
+    return si->records_num - 1;
+}
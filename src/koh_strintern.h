@@ -0,0 +1,36 @@
+// vim: set colorcolumn=85
+// vim: fdm=marker
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+Таблица интернирования строк: имя -> постоянный 32-битный id. Символы
+хранятся в арене блоками, строки не перемещаются до strint_free().
+Сравнение сначала по хешу и длине, memcmp только при совпадении.
+
+Позволяет заменить в ключе char name[128] на uint32_t name_id:
+
+    struct MetaObjectId {
+        Rectangle   rect;
+        uint32_t    name_id;
+    };
+*/
+
+// Не бывает id интернированной строки.
+#define KOH_STRINT_NONE 0
+
+typedef struct koh_StrIntern koh_StrIntern;
+
+koh_StrIntern *strint_new(void);
+void strint_free(koh_StrIntern *si);
+
+// len < 0 - строка до нуля. Возвращает id, новый если строки не было.
+uint32_t strint_intern(koh_StrIntern *si, const char *s, int len);
+// KOH_STRINT_NONE если строка не интернирована.
+uint32_t strint_find(koh_StrIntern *si, const char *s, int len);
+// Строка с нулем в конце, NULL для неизвестного id. len может быть NULL.
+const char *strint_str(koh_StrIntern *si, uint32_t id, int *len);
+// Количество различных строк.
+int strint_size(koh_StrIntern *si);
@@ -74,6 +74,16 @@
 #  endif
 #endif
 
+/* wait4() and syscall() are only declared for _DEFAULT_SOURCE (glibc,
+ * musl) or _DARWIN_C_SOURCE.  Unlike _GNU_SOURCE these keep the POSIX
+ * strerror_r(). */
+#if !defined(_DEFAULT_SOURCE)
+#  define _DEFAULT_SOURCE
+#endif
+#if defined(__APPLE__) && !defined(_DARWIN_C_SOURCE)
+#  define _DARWIN_C_SOURCE
+#endif
+
 /* Because, according to Microsoft, POSIX is deprecated.  You've got
  * to appreciate the chutzpah. */
 #if defined(_MSC_VER) && !defined(_CRT_NONSTDC_NO_DEPRECATE)
@@ -91,9 +101,11 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <setjmp.h>
+#include <math.h>
 
 #if !defined(MUNIT_NO_NL_LANGINFO) && !defined(_WIN32)
 #define MUNIT_NL_LANGINFO
@@ -104,8 +116,12 @@
 
 #if !defined(_WIN32)
 #  include <unistd.h>
+#  include <poll.h>
+#  include <signal.h>
 #  include <sys/types.h>
 #  include <sys/wait.h>
+#  include <sys/resource.h>
+#  define MUNIT_RUSAGE
 #else
 #  include <windows.h>
 #  include <io.h>
@@ -117,6 +133,15 @@
 
 #include "munit.h"
 
+/* Hardware counters for --perf need perf_event_open(2), which glibc
+ * only provides through syscall(). */
+#if defined(__linux__) && defined(MUNIT_ENABLE_TIMING) && !defined(MUNIT_NO_PERF)
+#  define MUNIT_PERF
+#  include <linux/perf_event.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#endif
+
 #define MUNIT_STRINGIFY(x) #x
 #define MUNIT_XSTRINGIFY(x) MUNIT_STRINGIFY(x)
 
@@ -285,6 +310,227 @@ munit_malloc_ex(const char* filename, int line, size_t size) {
   return ptr;
 }
 
+/*** Allocation tracking ***/
+
+/* On glibc munit replaces malloc and friends with wrappers around the
+ * __libc_ entry points, so allocations made by a test can be counted.
+ * Sanitizers install their own allocator, so the wrappers are left out
+ * under them. */
+#if defined(__has_feature)
+#  if __has_feature(address_sanitizer) || __has_feature(memory_sanitizer) || __has_feature(thread_sanitizer)
+#    define MUNIT_NO_ALLOC_TRACKING
+#  endif
+#endif
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#  define MUNIT_NO_ALLOC_TRACKING
+#endif
+
+#if defined(__GLIBC__) && !defined(MUNIT_NO_ALLOC_TRACKING)
+#define MUNIT_ALLOC_TRACKING
+
+#include <malloc.h>
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void* __libc_valloc(size_t size);
+extern void* __libc_pvalloc(size_t size);
+extern void __libc_free(void* ptr);
+
+/* Nonzero while allocations are counted: the whole iteration with
+ * --allocs, otherwise from munit_alloc_reset() to the end of the
+ * iteration.  While it is zero the wrappers only load this flag. */
+static int munit_alloc_active = 0;
+/* Changes while counting; usable sizes, not requested ones.  A block
+ * allocated before counting started and freed during it makes live
+ * and blocks go down, so only differences of them are meaningful. */
+static munit_uint64_t munit_alloc_count = 0;
+static munit_uint64_t munit_alloc_bytes = 0;
+static munit_int64_t munit_alloc_live = 0;
+static munit_int64_t munit_alloc_blocks = 0;
+static munit_int64_t munit_alloc_peak = 0;
+/* Start of the munit_alloc_stats() window */
+static munit_uint64_t munit_alloc_window_count = 0;
+static munit_uint64_t munit_alloc_window_bytes = 0;
+static munit_int64_t munit_alloc_window_live = 0;
+static munit_int64_t munit_alloc_window_peak = 0;
+
+#define MUNIT_ALLOC_COUNTING() \
+  MUNIT_UNLIKELY(__atomic_load_n(&munit_alloc_active, __ATOMIC_RELAXED))
+
+static void
+munit_alloc_raise(munit_int64_t* peak, munit_int64_t live) {
+  munit_int64_t old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+
+  while (live > old && !__atomic_compare_exchange_n(peak, &old, live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+static void
+munit_alloc_note(void* ptr, size_t size) {
+  munit_int64_t live;
+
+  if (ptr == NULL)
+    return;
+
+  live = __atomic_add_fetch(&munit_alloc_live, (munit_int64_t) malloc_usable_size(ptr), __ATOMIC_RELAXED);
+  __atomic_add_fetch(&munit_alloc_blocks, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&munit_alloc_count, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&munit_alloc_bytes, size, __ATOMIC_RELAXED);
+  munit_alloc_raise(&munit_alloc_peak, live);
+  munit_alloc_raise(&munit_alloc_window_peak, live);
+}
+
+static void
+munit_alloc_forget(size_t usable_size) {
+  __atomic_sub_fetch(&munit_alloc_live, (munit_int64_t) usable_size, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&munit_alloc_blocks, 1, __ATOMIC_RELAXED);
+}
+
+void*
+malloc(size_t size) {
+  void* ptr = __libc_malloc(size);
+  if (MUNIT_ALLOC_COUNTING())
+    munit_alloc_note(ptr, size);
+  return ptr;
+}
+
+void*
+calloc(size_t nmemb, size_t size) {
+  void* ptr = __libc_calloc(nmemb, size);
+  if (MUNIT_ALLOC_COUNTING())
+    munit_alloc_note(ptr, nmemb * size);
+  return ptr;
+}
+
+void*
+realloc(void* ptr, size_t size) {
+  size_t old_size;
+  void* new_ptr;
+
+  if (!MUNIT_ALLOC_COUNTING())
+    return __libc_realloc(ptr, size);
+
+  old_size = (ptr != NULL) ? malloc_usable_size(ptr) : 0;
+  new_ptr = __libc_realloc(ptr, size);
+  /* On failure the old block is left alone; size 0 frees it. */
+  if (new_ptr != NULL || size == 0) {
+    if (ptr != NULL)
+      munit_alloc_forget(old_size);
+    munit_alloc_note(new_ptr, size);
+  }
+  return new_ptr;
+}
+
+/* glibc requires the whole family to be replaced together, or blocks
+ * from the missing ones would reach free() uncounted. */
+
+void*
+memalign(size_t alignment, size_t size) {
+  void* ptr = __libc_memalign(alignment, size);
+  if (MUNIT_ALLOC_COUNTING())
+    munit_alloc_note(ptr, size);
+  return ptr;
+}
+
+void*
+aligned_alloc(size_t alignment, size_t size) {
+  return memalign(alignment, size);
+}
+
+int
+posix_memalign(void** memptr, size_t alignment, size_t size) {
+  void* ptr;
+
+  if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0)
+    return EINVAL;
+
+  ptr = memalign(alignment, size);
+  if (ptr == NULL)
+    return ENOMEM;
+  *memptr = ptr;
+  return 0;
+}
+
+void*
+valloc(size_t size) {
+  void* ptr = __libc_valloc(size);
+  if (MUNIT_ALLOC_COUNTING())
+    munit_alloc_note(ptr, size);
+  return ptr;
+}
+
+void*
+pvalloc(size_t size) {
+  void* ptr = __libc_pvalloc(size);
+  if (MUNIT_ALLOC_COUNTING())
+    munit_alloc_note(ptr, size);
+  return ptr;
+}
+
+void
+free(void* ptr) {
+  if (MUNIT_ALLOC_COUNTING() && ptr != NULL)
+    munit_alloc_forget(malloc_usable_size(ptr));
+  __libc_free(ptr);
+}
+
+int
+munit_alloc_tracking(void) {
+  return 1;
+}
+
+MunitAllocStats
+munit_alloc_stats(void) {
+  MunitAllocStats stats = { 0, 0, 0 };
+  munit_int64_t peak;
+
+  if (!__atomic_load_n(&munit_alloc_active, __ATOMIC_RELAXED))
+    return stats;
+
+  stats.count = __atomic_load_n(&munit_alloc_count, __ATOMIC_RELAXED) - munit_alloc_window_count;
+  stats.bytes = __atomic_load_n(&munit_alloc_bytes, __ATOMIC_RELAXED) - munit_alloc_window_bytes;
+  peak = __atomic_load_n(&munit_alloc_window_peak, __ATOMIC_RELAXED) - munit_alloc_window_live;
+  stats.peak = peak > 0 ? (munit_uint64_t) peak : 0;
+  return stats;
+}
+
+void
+munit_alloc_reset(void) {
+  munit_alloc_window_count = __atomic_load_n(&munit_alloc_count, __ATOMIC_RELAXED);
+  munit_alloc_window_bytes = __atomic_load_n(&munit_alloc_bytes, __ATOMIC_RELAXED);
+  munit_alloc_window_live = __atomic_load_n(&munit_alloc_live, __ATOMIC_RELAXED);
+  __atomic_store_n(&munit_alloc_window_peak, munit_alloc_window_live, __ATOMIC_RELAXED);
+  __atomic_store_n(&munit_alloc_active, 1, __ATOMIC_RELAXED);
+}
+
+int
+munit_alloc_counting(void) {
+  return __atomic_load_n(&munit_alloc_active, __ATOMIC_RELAXED);
+}
+#else
+int
+munit_alloc_tracking(void) {
+  return 0;
+}
+
+MunitAllocStats
+munit_alloc_stats(void) {
+  MunitAllocStats stats = { 0, 0, 0 };
+  return stats;
+}
+
+void
+munit_alloc_reset(void) {
+}
+
+int
+munit_alloc_counting(void) {
+  return 0;
+}
+#endif
+
 /*** Timer code ***/
 
 #if defined(MUNIT_ENABLE_TIMING)
@@ -879,6 +1125,13 @@ munit_atomic_cas(ATOMIC_UINT32_T* dest, ATOMIC_UINT32_T* expected, ATOMIC_UINT32
 }
 #endif
 
+/* Seed and generation of the fast per-thread generator; a thread
+ * reseeds its lanes when it sees a new generation.  Streams are
+ * handed out in the order threads first draw after a reseed. */
+static ATOMIC_UINT32_T munit_rand_fast_seed = ATOMIC_UINT32_INIT(42);
+static ATOMIC_UINT32_T munit_rand_fast_generation = ATOMIC_UINT32_INIT(1);
+static ATOMIC_UINT32_T munit_rand_fast_streams = ATOMIC_UINT32_INIT(0);
+
 #define MUNIT_PRNG_MULTIPLIER (747796405U)
 #define MUNIT_PRNG_INCREMENT  (1729U)
 
@@ -897,7 +1150,15 @@ munit_rand_from_state(munit_uint32_t state) {
 void
 munit_rand_seed(munit_uint32_t seed) {
   munit_uint32_t state = munit_rand_next_state(seed + MUNIT_PRNG_INCREMENT);
+  munit_uint32_t generation;
   munit_atomic_store(&munit_rand_state, state);
+
+  munit_atomic_store(&munit_rand_fast_seed, seed);
+  munit_atomic_store(&munit_rand_fast_streams, 0);
+  do {
+    generation = munit_atomic_load(&munit_rand_fast_generation);
+  } while (!munit_atomic_cas(&munit_rand_fast_generation, &generation,
+                             (generation + 1 == 0) ? 1 : generation + 1));
 }
 
 static munit_uint32_t
@@ -1026,8 +1287,248 @@ munit_rand_double(void) {
   return retval;
 }
 
+/* xoshiro256** (Blackman and Vigna), four lanes stored word by word
+ * so the loop over lanes in munit_rand_fast_step maps onto SIMD
+ * registers (two AVX2 or four SSE2 operations per word).  Scalar
+ * calls are served from a buffer of one step. */
+
+#define MUNIT_RAND_FAST_LANES 4
+
+typedef struct {
+  munit_uint64_t s[4][MUNIT_RAND_FAST_LANES];
+  munit_uint64_t buffer[MUNIT_RAND_FAST_LANES];
+  unsigned int buffered;
+  munit_uint32_t generation;
+} MunitRandFast;
+
+#if defined(MUNIT_THREAD_LOCAL)
+static MUNIT_THREAD_LOCAL MunitRandFast munit_rand_fast;
+#else
+static MunitRandFast munit_rand_fast;
+#endif
+
+#define MUNIT_ROTL64(x, k) (((x) << (k)) | ((x) >> (64 - (k))))
+
+static munit_uint64_t
+munit_splitmix64(munit_uint64_t* x) {
+  munit_uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static MunitRandFast*
+munit_rand_fast_get(void) {
+  MunitRandFast* r = &munit_rand_fast;
+  const munit_uint32_t generation = munit_atomic_load(&munit_rand_fast_generation);
+  munit_uint32_t stream;
+  munit_uint64_t x;
+  size_t w, l;
+
+  if (MUNIT_LIKELY(r->generation == generation))
+    return r;
+
+  do {
+    stream = munit_atomic_load(&munit_rand_fast_streams);
+  } while (!munit_atomic_cas(&munit_rand_fast_streams, &stream, stream + 1));
+
+  x = ((munit_uint64_t) munit_atomic_load(&munit_rand_fast_seed) << 32) | stream;
+  for (w = 0 ; w < 4 ; w++)
+    for (l = 0 ; l < MUNIT_RAND_FAST_LANES ; l++)
+      r->s[w][l] = munit_splitmix64(&x);
+  r->buffered = 0;
+  r->generation = generation;
+
+  return r;
+}
+
+static void
+munit_rand_fast_step(munit_uint64_t s[4][MUNIT_RAND_FAST_LANES], munit_uint64_t out[MUNIT_RAND_FAST_LANES]) {
+  size_t l;
+
+  for (l = 0 ; l < MUNIT_RAND_FAST_LANES ; l++) {
+    const munit_uint64_t r = s[1][l] * 5;
+    const munit_uint64_t t = s[1][l] << 17;
+    out[l] = MUNIT_ROTL64(r, 7) * 9;
+    s[2][l] ^= s[0][l];
+    s[3][l] ^= s[1][l];
+    s[1][l] ^= s[2][l];
+    s[0][l] ^= s[3][l];
+    s[2][l] ^= t;
+    s[3][l] = MUNIT_ROTL64(s[3][l], 45);
+  }
+}
+
+static munit_uint64_t
+munit_rand_fast_next(MunitRandFast* r) {
+  if (r->buffered == 0) {
+    munit_rand_fast_step(r->s, r->buffer);
+    r->buffered = MUNIT_RAND_FAST_LANES;
+  }
+  return r->buffer[--r->buffered];
+}
+
+munit_uint64_t
+munit_rand_fast_uint64(void) {
+  return munit_rand_fast_next(munit_rand_fast_get());
+}
+
+/* The bulk loops work on a local copy of the lanes so the state
+ * stays in registers instead of being reloaded through the
+ * thread-local pointer after every store to the output. */
+
+void
+munit_rand_fill_uint32(size_t n, munit_uint32_t values[MUNIT_ARRAY_PARAM(n)]) {
+  MunitRandFast* r = munit_rand_fast_get();
+  munit_uint64_t s[4][MUNIT_RAND_FAST_LANES];
+  munit_uint64_t out[MUNIT_RAND_FAST_LANES];
+  size_t i = 0, l;
+
+  memcpy(s, r->s, sizeof(s));
+  for ( ; n - i >= 2 * MUNIT_RAND_FAST_LANES ; i += 2 * MUNIT_RAND_FAST_LANES) {
+    munit_rand_fast_step(s, out);
+    for (l = 0 ; l < MUNIT_RAND_FAST_LANES ; l++) {
+      values[i + l] = (munit_uint32_t) (out[l] >> 32);
+      values[i + MUNIT_RAND_FAST_LANES + l] = (munit_uint32_t) out[l];
+    }
+  }
+  memcpy(r->s, s, sizeof(s));
+
+  for ( ; i < n ; i++)
+    values[i] = (munit_uint32_t) (munit_rand_fast_next(r) >> 32);
+}
+
+/* 24 random bits per float, two floats per 64-bit output. */
+#define MUNIT_RAND_FLOAT_HI(x) ((float) ((x) >> 40) * (1.0f / 16777216.0f))
+#define MUNIT_RAND_FLOAT_LO(x) ((float) (((x) >> 8) & 0xFFFFFFU) * (1.0f / 16777216.0f))
+
+void
+munit_rand_fill_float(size_t n, float values[MUNIT_ARRAY_PARAM(n)], float min, float max) {
+  MunitRandFast* r = munit_rand_fast_get();
+  munit_uint64_t s[4][MUNIT_RAND_FAST_LANES];
+  munit_uint64_t out[MUNIT_RAND_FAST_LANES];
+  const float span = max - min;
+  size_t i = 0, l;
+
+  memcpy(s, r->s, sizeof(s));
+  for ( ; n - i >= 2 * MUNIT_RAND_FAST_LANES ; i += 2 * MUNIT_RAND_FAST_LANES) {
+    munit_rand_fast_step(s, out);
+    for (l = 0 ; l < MUNIT_RAND_FAST_LANES ; l++) {
+      values[i + l] = min + MUNIT_RAND_FLOAT_HI(out[l]) * span;
+      values[i + MUNIT_RAND_FAST_LANES + l] = min + MUNIT_RAND_FLOAT_LO(out[l]) * span;
+    }
+  }
+  memcpy(r->s, s, sizeof(s));
+
+  for ( ; i < n ; i++)
+    values[i] = min + MUNIT_RAND_FLOAT_HI(munit_rand_fast_next(r)) * span;
+}
+
+void
+munit_rand_fill_float2(size_t n, float values[], float x_min, float x_max, float y_min, float y_max) {
+  MunitRandFast* r = munit_rand_fast_get();
+  munit_uint64_t s[4][MUNIT_RAND_FAST_LANES];
+  munit_uint64_t out[MUNIT_RAND_FAST_LANES];
+  const float x_span = x_max - x_min;
+  const float y_span = y_max - y_min;
+  munit_uint64_t x;
+  size_t i = 0, l;
+
+  memcpy(s, r->s, sizeof(s));
+  for ( ; n - i >= MUNIT_RAND_FAST_LANES ; i += MUNIT_RAND_FAST_LANES) {
+    munit_rand_fast_step(s, out);
+    for (l = 0 ; l < MUNIT_RAND_FAST_LANES ; l++) {
+      values[2 * (i + l)] = x_min + MUNIT_RAND_FLOAT_HI(out[l]) * x_span;
+      values[2 * (i + l) + 1] = y_min + MUNIT_RAND_FLOAT_LO(out[l]) * y_span;
+    }
+  }
+  memcpy(r->s, s, sizeof(s));
+
+  for ( ; i < n ; i++) {
+    x = munit_rand_fast_next(r);
+    values[2 * i] = x_min + MUNIT_RAND_FLOAT_HI(x) * x_span;
+    values[2 * i + 1] = y_min + MUNIT_RAND_FLOAT_LO(x) * y_span;
+  }
+}
+
 /*** Test suite handling ***/
 
+#if defined(MUNIT_ENABLE_TIMING)
+#define MUNIT_BENCH_SAMPLES_MAX 1000
+
+/* Per-operation wall clock statistics of a --bench run, in
+ * nanoseconds.  Computed in the child so they fit in the report. */
+typedef struct {
+  unsigned int samples;
+  unsigned int outliers;
+  munit_uint64_t ops;
+  double min;
+  double median;
+  double mean;
+  double p90;
+  double p99;
+  double mad;
+} MunitBenchStats;
+
+/* A --bench result loaded from a --baseline file. */
+typedef struct {
+  char* name;
+  /* Parameters as name=value pairs joined with ';' */
+  char* params;
+  double median;
+  double* samples;
+  unsigned int samples_l;
+} MunitBaselineEntry;
+
+/* A line of the comparison table printed after the run. */
+typedef struct {
+  char* name;
+  double baseline;
+  double current;
+  double change;
+  double p;
+  munit_bool regression;
+} MunitBaselineRow;
+#endif
+
+#if defined(MUNIT_PERF)
+#define MUNIT_PERF_COUNTERS 6
+
+/* Hardware counter totals over the timed iterations (--perf). */
+typedef struct {
+  /* Bit i is set if counter i could be opened, 0 without counters */
+  munit_uint32_t available;
+  munit_uint64_t ops;
+  munit_uint64_t value[MUNIT_PERF_COUNTERS];
+} MunitPerfCounters;
+#endif
+
+#if defined(MUNIT_ALLOC_TRACKING)
+/* Heap use of a test summed over its iterations, including setup and
+ * tear down.  Leaks are blocks still live after tear down. */
+typedef struct {
+  munit_uint64_t count;
+  munit_uint64_t bytes;
+  munit_uint64_t peak;
+  munit_uint64_t leaked_blocks;
+  munit_uint64_t leaked_bytes;
+} MunitAllocReport;
+#endif
+
+#if defined(MUNIT_RUSAGE)
+/* Resource use of the process running a test.  For a forked child the
+ * parent fills it from wait4(); with --pool or --no-fork the faults and
+ * context switches are getrusage() deltas and maxrss is the high-water
+ * mark of the whole process. */
+typedef struct {
+  munit_uint64_t maxrss_kb;
+  munit_uint64_t minor_faults;
+  munit_uint64_t major_faults;
+  munit_uint64_t voluntary_switches;
+  munit_uint64_t involuntary_switches;
+} MunitRusage;
+#endif
+
 typedef struct {
   unsigned int successful;
   unsigned int skipped;
@@ -1036,9 +1537,81 @@ typedef struct {
 #if defined(MUNIT_ENABLE_TIMING)
   munit_uint64_t cpu_clock;
   munit_uint64_t wall_clock;
+  MunitBenchStats bench;
+#endif
+#if defined(MUNIT_PERF)
+  MunitPerfCounters perf;
+#endif
+#if defined(MUNIT_ALLOC_TRACKING)
+  MunitAllocReport allocs;
+#endif
+#if defined(MUNIT_RUSAGE)
+  MunitRusage rusage;
+#endif
+#if defined(MUNIT_ENABLE_TIMING)
+  /* bench.samples values left after outlier rejection, sorted;
+   * compared against a --baseline run.  Owned by the report and sent
+   * after the fixed part, so it must stay the last member. */
+  double* bench_sample;
 #endif
 } MunitReport;
 
+/* Size of the part of a report which is always sent through a pipe */
+#if defined(MUNIT_ENABLE_TIMING)
+#define MUNIT_REPORT_SIZE offsetof(MunitReport, bench_sample)
+#else
+#define MUNIT_REPORT_SIZE sizeof(MunitReport)
+#endif
+
+#if !defined(MUNIT_NO_FORK)
+/* A forked test whose result has not been printed yet (--jobs). */
+typedef struct MunitJob_ {
+  const MunitTest* test;
+  /* Full test name, for --output-json and --output-csv */
+  char* name;
+  /* Copy of the parameter array, NULL for tests without parameters */
+  MunitParameter* params;
+  /* Test name and parameters, printed before the result */
+  char* header;
+  /* A tmpfile, or a memory stream over stderr_data with --pool */
+  FILE* stderr_buf;
+  char* stderr_data;
+  size_t stderr_len;
+  int pipefd;
+  pid_t pid;
+  /* Index in runner->workers, -1 for a child forked for this job */
+  int worker;
+  MunitReport report;
+  size_t report_read;
+  /* Monotonic milliseconds at which the job is killed, 0 for none */
+  munit_uint64_t deadline;
+  double timeout;
+  munit_bool timed_out;
+  MunitResult result;
+  munit_bool done;
+  struct MunitJob_* next;
+} MunitJob;
+
+/* A long-lived forked process running tests one after another
+ * (--pool).  Pointers in requests stay valid because the worker is a
+ * fork of the runner. */
+typedef struct {
+  pid_t pid;
+  /* Requests to the worker and reports from it */
+  int cmd_fd;
+  int result_fd;
+  /* The worker's stderr, truncated before every test */
+  int stderr_fd;
+  MunitJob* job;
+} MunitWorker;
+
+typedef struct {
+  const MunitTest* test;
+  munit_bool has_params;
+  unsigned int params_l;
+} MunitWorkerRequest;
+#endif
+
 typedef struct {
   const char* prefix;
   const MunitSuite* suite;
@@ -1053,6 +1626,45 @@ typedef struct {
   munit_bool fork;
   munit_bool show_stderr;
   munit_bool fatal_failures;
+  /* Machine-readable results, written as tests finish */
+  FILE* json_file;
+  FILE* csv_file;
+  munit_bool json_first;
+  /* Name of the test being run, including the suite prefix */
+  const char* test_name;
+#if defined(MUNIT_ENABLE_TIMING)
+  munit_bool bench;
+  unsigned int bench_warmup;
+  unsigned int bench_samples;
+  MunitBaselineEntry* baseline;
+  size_t baseline_l;
+  MunitBaselineRow* baseline_rows;
+  size_t baseline_rows_l;
+  /* Slowdown in percent which fails the run, negative to only report */
+  double max_regression;
+#endif
+#if defined(MUNIT_PERF)
+  munit_bool perf;
+#endif
+  munit_bool allocs;
+  munit_bool rusage;
+  /* Number of forked children running at once */
+  unsigned int jobs;
+  /* Output written before the next job is submitted */
+  char* pending;
+  size_t pending_len;
+  size_t pending_cap;
+#if !defined(MUNIT_NO_FORK)
+  /* Jobs in submission order; results are printed from the head */
+  MunitJob* queue_head;
+  MunitJob* queue_tail;
+  unsigned int running;
+  munit_bool pool;
+  /* runner->jobs entries, pid == -1 when not started */
+  MunitWorker* workers;
+  /* Seconds before a forked test is killed, 0 for no limit */
+  double timeout;
+#endif
 } MunitTestRunner;
 
 const char*
@@ -1167,81 +1779,519 @@ munit_splice(int from, int to) {
 }
 
 /* This is the part that should be handled in the child process */
-static MunitResult
-munit_test_runner_exec(MunitTestRunner* runner, const MunitTest* test, const MunitParameter params[], MunitReport* report) {
-  unsigned int iterations = runner->iterations;
-  MunitResult result = MUNIT_FAIL;
 #if defined(MUNIT_ENABLE_TIMING)
-  struct PsnipClockTimespec wall_clock_begin = { 0, }, wall_clock_end = { 0, };
-  struct PsnipClockTimespec cpu_clock_begin = { 0, }, cpu_clock_end = { 0, };
+static munit_uint64_t munit_bench_ops = 0;
 #endif
-  unsigned int i = 0;
-
-  if ((test->options & MUNIT_TEST_OPTION_SINGLE_ITERATION) == MUNIT_TEST_OPTION_SINGLE_ITERATION)
-    iterations = 1;
-  else if (iterations == 0)
-    iterations = runner->suite->iterations;
-
-  munit_rand_seed(runner->seed);
-
-  do {
-    void* data = (test->setup == NULL) ? runner->user_data : test->setup(params, runner->user_data);
 
+void
+munit_bench_set_ops(munit_uint64_t ops) {
 #if defined(MUNIT_ENABLE_TIMING)
-    psnip_clock_get_time(PSNIP_CLOCK_TYPE_WALL, &wall_clock_begin);
-    psnip_clock_get_time(PSNIP_CLOCK_TYPE_CPU, &cpu_clock_begin);
+  munit_bench_ops = ops;
+#else
+  (void) ops;
 #endif
+}
 
-    result = test->test(params, data);
+/* Per-test limits from munit_test_set_timeout(), looked up by the
+ * address of the test. */
+typedef struct {
+  const MunitTest* test;
+  double seconds;
+} MunitTestTimeout;
 
-#if defined(MUNIT_ENABLE_TIMING)
-    psnip_clock_get_time(PSNIP_CLOCK_TYPE_WALL, &wall_clock_end);
-    psnip_clock_get_time(PSNIP_CLOCK_TYPE_CPU, &cpu_clock_end);
-#endif
+static MunitTestTimeout* munit_test_timeouts = NULL;
+static size_t munit_test_timeouts_l = 0;
 
-    if (test->tear_down != NULL)
-      test->tear_down(data);
+void
+munit_test_set_timeout(const MunitTest* test, double seconds) {
+  MunitTestTimeout* timeouts;
+  size_t i;
 
-    if (MUNIT_LIKELY(result == MUNIT_OK)) {
-      report->successful++;
-#if defined(MUNIT_ENABLE_TIMING)
-      report->wall_clock += munit_clock_get_elapsed(&wall_clock_begin, &wall_clock_end);
-      report->cpu_clock += munit_clock_get_elapsed(&cpu_clock_begin, &cpu_clock_end);
-#endif
-    } else {
-      switch ((int) result) {
-        case MUNIT_SKIP:
-          report->skipped++;
-          break;
-        case MUNIT_FAIL:
-          report->failed++;
-          break;
-        case MUNIT_ERROR:
-          report->errored++;
-          break;
-        default:
-          break;
-      }
-      break;
+  for (i = 0 ; i < munit_test_timeouts_l ; i++) {
+    if (munit_test_timeouts[i].test == test) {
+      munit_test_timeouts[i].seconds = seconds;
+      return;
     }
-  } while (++i < iterations);
+  }
 
-  return result;
+  timeouts = realloc(munit_test_timeouts, sizeof(MunitTestTimeout) * (munit_test_timeouts_l + 1));
+  if (timeouts == NULL) {
+    munit_log_internal(MUNIT_LOG_ERROR, stderr, "failed to allocate memory");
+    return;
+  }
+  munit_test_timeouts = timeouts;
+  munit_test_timeouts[munit_test_timeouts_l].test = test;
+  munit_test_timeouts[munit_test_timeouts_l].seconds = seconds;
+  munit_test_timeouts_l++;
 }
 
-#if defined(MUNIT_EMOTICON)
-#  define MUNIT_RESULT_STRING_OK    ":)"
-#  define MUNIT_RESULT_STRING_SKIP  ":|"
-#  define MUNIT_RESULT_STRING_FAIL  ":("
-#  define MUNIT_RESULT_STRING_ERROR ":o"
-#  define MUNIT_RESULT_STRING_TODO  ":/"
-#else
-#  define MUNIT_RESULT_STRING_OK    "OK   "
-#  define MUNIT_RESULT_STRING_SKIP  "SKIP "
-#  define MUNIT_RESULT_STRING_FAIL  "FAIL "
-#  define MUNIT_RESULT_STRING_ERROR "ERROR"
-#  define MUNIT_RESULT_STRING_TODO  "TODO "
-#endif
+#if defined(MUNIT_ENABLE_TIMING)
+static int
+munit_double_compare(const void* a, const void* b) {
+  const double x = *((const double*) a);
+  const double y = *((const double*) b);
+
+  return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of a sorted array, p in (0, 1]. */
+static double
+munit_percentile(const double* sorted, unsigned int n, double p) {
+  unsigned int rank = (unsigned int) (p * n + 0.999999);
+
+  if (rank < 1)
+    rank = 1;
+  if (rank > n)
+    rank = n;
+  return sorted[rank - 1];
+}
+
+static double
+munit_median(const double* sorted, unsigned int n) {
+  if (n % 2 == 0)
+    return (sorted[n / 2 - 1] + sorted[n / 2]) / 2.0;
+  return sorted[n / 2];
+}
+
+/* Median absolute deviation; uses values[n..2n) as scratch space. */
+static double
+munit_mad(double* values, unsigned int n, double median) {
+  double* dev = values + n;
+  unsigned int i;
+
+  for (i = 0 ; i < n ; i++)
+    dev[i] = values[i] > median ? values[i] - median : median - values[i];
+  qsort(dev, n, sizeof(double), munit_double_compare);
+  return munit_median(dev, n);
+}
+
+/* Summarize samples, dropping those further than 3 scaled MADs from the
+ * median.  The kept samples are left sorted at the start of the
+ * array. */
+static void
+munit_bench_compute(MunitBenchStats* stats, double* samples, unsigned int n) {
+  double* values;
+  double median, mad, limit, sum = 0.0;
+  unsigned int kept = 0;
+  unsigned int i;
+
+  if (n == 0)
+    return;
+
+  values = malloc(sizeof(double) * n * 2);
+  if (values == NULL)
+    return;
+
+  qsort(samples, n, sizeof(double), munit_double_compare);
+  memcpy(values, samples, sizeof(double) * n);
+  median = munit_median(values, n);
+  mad = munit_mad(values, n, median);
+
+  /* 1.4826 scales the MAD to a standard deviation for normal data. */
+  limit = 3.0 * 1.4826 * mad;
+  for (i = 0 ; i < n ; i++) {
+    if (mad == 0.0 || (samples[i] >= median - limit && samples[i] <= median + limit))
+      values[kept++] = samples[i];
+  }
+
+  for (i = 0 ; i < kept ; i++)
+    sum += values[i];
+
+  stats->samples = kept;
+  stats->outliers = n - kept;
+  stats->min = values[0];
+  stats->median = munit_median(values, kept);
+  stats->mean = sum / kept;
+  stats->p90 = munit_percentile(values, kept, 0.90);
+  stats->p99 = munit_percentile(values, kept, 0.99);
+  stats->mad = munit_mad(values, kept, stats->median);
+  memcpy(samples, values, sizeof(double) * kept);
+
+  free(values);
+}
+
+static void
+munit_print_per_op(FILE* fp, double nanoseconds) {
+  if (nanoseconds < 1000.0)
+    fprintf(fp, "%.2f ns", nanoseconds);
+  else if (nanoseconds < 1000000.0)
+    fprintf(fp, "%.2f us", nanoseconds / 1000.0);
+  else
+    fprintf(fp, "%.2f ms", nanoseconds / 1000000.0);
+}
+
+static void
+munit_print_bench(FILE* fp, const MunitBenchStats* stats) {
+  fprintf(fp, "  %-" MUNIT_XSTRINGIFY(MUNIT_TEST_NAME_LEN) "s Bench: [ ", "");
+  munit_print_per_op(fp, stats->median);
+  fprintf(fp, "/op median, %u samples, %u outliers, %" PRIu64 " ops ]\n", stats->samples, stats->outliers, stats->ops);
+  fprintf(fp, "  %-" MUNIT_XSTRINGIFY(MUNIT_TEST_NAME_LEN) "s        [ min ", "");
+  munit_print_per_op(fp, stats->min);
+  fputs(", mean ", fp);
+  munit_print_per_op(fp, stats->mean);
+  fputs(", p90 ", fp);
+  munit_print_per_op(fp, stats->p90);
+  fputs(", p99 ", fp);
+  munit_print_per_op(fp, stats->p99);
+  fputs(", MAD ", fp);
+  munit_print_per_op(fp, stats->mad);
+}
+#endif
+
+#if defined(MUNIT_PERF)
+static const struct {
+  const char* name;
+  munit_uint32_t type;
+  munit_uint64_t config;
+} munit_perf_events[MUNIT_PERF_COUNTERS] = {
+  { "cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "cache-misses",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { "LLC-loads",     PERF_TYPE_HW_CACHE,
+    PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16) },
+  { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  { "dTLB-misses",   PERF_TYPE_HW_CACHE,
+    PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) }
+};
+
+typedef struct {
+  int leader;
+  int fd[MUNIT_PERF_COUNTERS];
+  /* Counter index of each group member, in group read order */
+  int order[MUNIT_PERF_COUNTERS];
+  int members;
+} MunitPerfGroup;
+
+/* Open the counters of the calling thread as one group, user space
+ * only.  Counters the kernel or CPU refuse are left out; returns false
+ * if none could be opened, e.g. under perf_event_paranoid. */
+static munit_bool
+munit_perf_open(MunitPerfGroup* group) {
+  struct perf_event_attr attr;
+  int i;
+
+  group->leader = -1;
+  group->members = 0;
+  for (i = 0 ; i < MUNIT_PERF_COUNTERS ; i++) {
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = munit_perf_events[i].type;
+    attr.config = munit_perf_events[i].config;
+    attr.disabled = group->leader == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    group->fd[i] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, group->leader, 0);
+    if (group->fd[i] < 0)
+      continue;
+    if (group->leader == -1)
+      group->leader = group->fd[i];
+    group->order[group->members++] = i;
+  }
+
+  return group->leader != -1;
+}
+
+static void
+munit_perf_enable(MunitPerfGroup* group, munit_bool enable) {
+  ioctl(group->leader, enable ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/* Read the totals, scaled up if the group was multiplexed, and close
+ * the counters. */
+static void
+munit_perf_close(MunitPerfGroup* group, MunitPerfCounters* counters) {
+  munit_uint64_t data[3 + MUNIT_PERF_COUNTERS];
+  double scale = 1.0;
+  int i;
+
+  if (read(group->leader, data, sizeof(data)) >= (ssize_t) (sizeof(munit_uint64_t) * (3 + group->members)) &&
+      data[0] == (munit_uint64_t) group->members) {
+    if (data[2] > 0 && data[2] < data[1])
+      scale = (double) data[1] / (double) data[2];
+    for (i = 0 ; i < group->members ; i++) {
+      counters->value[group->order[i]] = (munit_uint64_t) (data[3 + i] * scale);
+      counters->available |= 1U << group->order[i];
+    }
+  }
+
+  for (i = 0 ; i < MUNIT_PERF_COUNTERS ; i++) {
+    if (group->fd[i] >= 0)
+      close(group->fd[i]);
+  }
+}
+
+/* Print a count with a K/M/G suffix. */
+static void
+munit_print_count(FILE* fp, double count) {
+  if (count < 10000.0)
+    fprintf(fp, "%.0f", count);
+  else if (count < 10000000.0)
+    fprintf(fp, "%.1fK", count / 1e3);
+  else if (count < 10000000000.0)
+    fprintf(fp, "%.1fM", count / 1e6);
+  else
+    fprintf(fp, "%.1fG", count / 1e9);
+}
+
+static void
+munit_print_perf(FILE* fp, const MunitPerfCounters* perf) {
+  int i;
+
+  fprintf(fp, "  %-" MUNIT_XSTRINGIFY(MUNIT_TEST_NAME_LEN) "s  Perf: [", "");
+  for (i = 0 ; i < MUNIT_PERF_COUNTERS ; i++) {
+    fprintf(fp, "%s %s ", i == 0 ? "" : ",", munit_perf_events[i].name);
+    if (perf->available & (1U << i))
+      munit_print_count(fp, (double) perf->value[i]);
+    else
+      fputs("n/a", fp);
+  }
+  if ((perf->available & 3) == 3 && perf->value[0] > 0)
+    fprintf(fp, ", IPC %.2f", (double) perf->value[1] / (double) perf->value[0]);
+  fputs(" ]\n", fp);
+
+  fprintf(fp, "  %-" MUNIT_XSTRINGIFY(MUNIT_TEST_NAME_LEN) "s        [ per op:", "");
+  for (i = 0 ; i < MUNIT_PERF_COUNTERS ; i++) {
+    fprintf(fp, "%s %s ", i == 0 ? "" : ",", munit_perf_events[i].name);
+    if ((perf->available & (1U << i)) && perf->ops > 0)
+      fprintf(fp, "%.2f", (double) perf->value[i] / (double) perf->ops);
+    else
+      fputs("n/a", fp);
+  }
+  fputs(" ]\n", fp);
+}
+#endif
+
+#if defined(MUNIT_ALLOC_TRACKING)
+/* Add the heap use of an iteration, given the counters before setup. */
+static void
+munit_alloc_account(MunitAllocReport* allocs, munit_uint64_t count, munit_uint64_t bytes, munit_int64_t live, munit_int64_t blocks) {
+  const munit_int64_t peak = __atomic_load_n(&munit_alloc_peak, __ATOMIC_RELAXED) - live;
+  const munit_int64_t leaked_bytes = __atomic_load_n(&munit_alloc_live, __ATOMIC_RELAXED) - live;
+  const munit_int64_t leaked_blocks = __atomic_load_n(&munit_alloc_blocks, __ATOMIC_RELAXED) - blocks;
+
+  allocs->count += __atomic_load_n(&munit_alloc_count, __ATOMIC_RELAXED) - count;
+  allocs->bytes += __atomic_load_n(&munit_alloc_bytes, __ATOMIC_RELAXED) - bytes;
+  if (peak > 0 && (munit_uint64_t) peak > allocs->peak)
+    allocs->peak = (munit_uint64_t) peak;
+  if (leaked_blocks > 0) {
+    allocs->leaked_blocks += (munit_uint64_t) leaked_blocks;
+    allocs->leaked_bytes += leaked_bytes > 0 ? (munit_uint64_t) leaked_bytes : 0;
+  }
+}
+
+static void
+munit_print_allocs(FILE* fp, const MunitAllocReport* allocs) {
+  fprintf(fp, "  %-" MUNIT_XSTRINGIFY(MUNIT_TEST_NAME_LEN) "s Allocs: [ %" PRIu64 " allocations, %" PRIu64 " bytes, peak %" PRIu64 " bytes",
+          "", allocs->count, allocs->bytes, allocs->peak);
+  if (allocs->leaked_blocks > 0)
+    fprintf(fp, ", leaked %" PRIu64 " blocks / %" PRIu64 " bytes", allocs->leaked_blocks, allocs->leaked_bytes);
+  fputs(" ]\n", fp);
+}
+#endif
+
+#if defined(MUNIT_RUSAGE)
+/* Convert a struct rusage; with begin != NULL the counters are made
+ * relative to it. */
+static void
+munit_rusage_from(MunitRusage* usage, const struct rusage* ru, const struct rusage* begin) {
+  usage->maxrss_kb = (munit_uint64_t) ru->ru_maxrss;
+  usage->minor_faults = (munit_uint64_t) (ru->ru_minflt - (begin != NULL ? begin->ru_minflt : 0));
+  usage->major_faults = (munit_uint64_t) (ru->ru_majflt - (begin != NULL ? begin->ru_majflt : 0));
+  usage->voluntary_switches = (munit_uint64_t) (ru->ru_nvcsw - (begin != NULL ? begin->ru_nvcsw : 0));
+  usage->involuntary_switches = (munit_uint64_t) (ru->ru_nivcsw - (begin != NULL ? begin->ru_nivcsw : 0));
+}
+
+static void
+munit_print_rusage(FILE* fp, const MunitRusage* usage) {
+  fprintf(fp, "  %-" MUNIT_XSTRINGIFY(MUNIT_TEST_NAME_LEN) "s Usage: [ max RSS %.1f MiB, faults %" PRIu64 " minor / %" PRIu64 " major"
+          ", context switches %" PRIu64 " voluntary / %" PRIu64 " involuntary ]\n",
+          "", (double) usage->maxrss_kb / 1024.0, usage->minor_faults, usage->major_faults,
+          usage->voluntary_switches, usage->involuntary_switches);
+}
+#endif
+
+static MunitResult
+munit_test_runner_exec(MunitTestRunner* runner, const MunitTest* test, const MunitParameter params[], MunitReport* report) {
+  unsigned int iterations = runner->iterations;
+  MunitResult result = MUNIT_FAIL;
+#if defined(MUNIT_ENABLE_TIMING)
+  struct PsnipClockTimespec wall_clock_begin = { 0, }, wall_clock_end = { 0, };
+  struct PsnipClockTimespec cpu_clock_begin = { 0, }, cpu_clock_end = { 0, };
+  munit_uint64_t wall_clock;
+  unsigned int warmup = 0;
+  double* samples = NULL;
+  unsigned int samples_l = 0;
+#endif
+#if defined(MUNIT_PERF)
+  MunitPerfGroup perf_group = { -1, { 0, }, { 0, }, 0 };
+  munit_bool perf = 0;
+#endif
+#if defined(MUNIT_ALLOC_TRACKING)
+  munit_uint64_t alloc_count = 0, alloc_bytes = 0;
+  munit_int64_t alloc_live = 0, alloc_blocks = 0;
+#endif
+#if defined(MUNIT_RUSAGE)
+  struct rusage usage_begin, usage_end;
+#endif
+  void* data;
+  unsigned int i = 0;
+
+  if ((test->options & MUNIT_TEST_OPTION_SINGLE_ITERATION) == MUNIT_TEST_OPTION_SINGLE_ITERATION)
+    iterations = 1;
+  else if (iterations == 0)
+    iterations = runner->suite->iterations;
+
+#if defined(MUNIT_ENABLE_TIMING)
+  /* Single iteration tests are not repeatable, so they are run once
+   * even with --bench. */
+  if (runner->bench && (test->options & MUNIT_TEST_OPTION_SINGLE_ITERATION) == 0) {
+    warmup = runner->bench_warmup;
+    iterations = warmup + runner->bench_samples;
+    samples = malloc(sizeof(double) * runner->bench_samples);
+    if (samples == NULL) {
+      munit_log_internal(MUNIT_LOG_ERROR, stderr, "failed to allocate memory");
+      report->errored++;
+      return MUNIT_ERROR;
+    }
+  }
+#endif
+
+#if defined(MUNIT_PERF)
+  if (runner->perf)
+    perf = munit_perf_open(&perf_group);
+#endif
+#if defined(MUNIT_RUSAGE)
+  getrusage(RUSAGE_SELF, &usage_begin);
+#endif
+
+  munit_rand_seed(runner->seed);
+
+  do {
+#if defined(MUNIT_ALLOC_TRACKING)
+    if (runner->allocs) {
+      alloc_count = __atomic_load_n(&munit_alloc_count, __ATOMIC_RELAXED);
+      alloc_bytes = __atomic_load_n(&munit_alloc_bytes, __ATOMIC_RELAXED);
+      alloc_live = __atomic_load_n(&munit_alloc_live, __ATOMIC_RELAXED);
+      alloc_blocks = __atomic_load_n(&munit_alloc_blocks, __ATOMIC_RELAXED);
+      __atomic_store_n(&munit_alloc_peak, alloc_live, __ATOMIC_RELAXED);
+      __atomic_store_n(&munit_alloc_active, 1, __ATOMIC_RELAXED);
+    }
+#endif
+
+    data = (test->setup == NULL) ? runner->user_data : test->setup(params, runner->user_data);
+
+#if defined(MUNIT_ALLOC_TRACKING)
+    if (runner->allocs)
+      munit_alloc_reset();
+#endif
+#if defined(MUNIT_PERF)
+    if (perf && i >= warmup)
+      munit_perf_enable(&perf_group, 1);
+#endif
+#if defined(MUNIT_ENABLE_TIMING)
+    munit_bench_ops = 0;
+    psnip_clock_get_time(PSNIP_CLOCK_TYPE_WALL, &wall_clock_begin);
+    psnip_clock_get_time(PSNIP_CLOCK_TYPE_CPU, &cpu_clock_begin);
+#endif
+
+    result = test->test(params, data);
+
+#if defined(MUNIT_ENABLE_TIMING)
+    psnip_clock_get_time(PSNIP_CLOCK_TYPE_WALL, &wall_clock_end);
+    psnip_clock_get_time(PSNIP_CLOCK_TYPE_CPU, &cpu_clock_end);
+#endif
+#if defined(MUNIT_PERF)
+    if (perf && i >= warmup)
+      munit_perf_enable(&perf_group, 0);
+#endif
+
+    if (test->tear_down != NULL)
+      test->tear_down(data);
+
+#if defined(MUNIT_ALLOC_TRACKING)
+    /* The test may have started counting with munit_alloc_reset(). */
+    __atomic_store_n(&munit_alloc_active, 0, __ATOMIC_RELAXED);
+    if (runner->allocs)
+      munit_alloc_account(&report->allocs, alloc_count, alloc_bytes, alloc_live, alloc_blocks);
+#endif
+
+    if (MUNIT_LIKELY(result == MUNIT_OK)) {
+#if defined(MUNIT_ENABLE_TIMING)
+      /* Warmup iterations are not counted, so successful matches the
+       * timed iterations in wall_clock and cpu_clock. */
+      if (i < warmup)
+        continue;
+#endif
+      report->successful++;
+#if defined(MUNIT_ENABLE_TIMING)
+      if (munit_bench_ops == 0)
+        munit_bench_ops = 1;
+      wall_clock = munit_clock_get_elapsed(&wall_clock_begin, &wall_clock_end);
+      report->wall_clock += wall_clock;
+      report->cpu_clock += munit_clock_get_elapsed(&cpu_clock_begin, &cpu_clock_end);
+      if (samples != NULL) {
+        report->bench.ops = munit_bench_ops;
+        samples[samples_l++] = ((double) wall_clock) / ((double) munit_bench_ops);
+      }
+#endif
+#if defined(MUNIT_PERF)
+      report->perf.ops += munit_bench_ops;
+#endif
+    } else {
+      switch ((int) result) {
+        case MUNIT_SKIP:
+          report->skipped++;
+          break;
+        case MUNIT_FAIL:
+          report->failed++;
+          break;
+        case MUNIT_ERROR:
+          report->errored++;
+          break;
+        default:
+          break;
+      }
+      break;
+    }
+  } while (++i < iterations);
+
+#if defined(MUNIT_ENABLE_TIMING)
+  if (samples != NULL) {
+    if (result == MUNIT_OK)
+      munit_bench_compute(&report->bench, samples, samples_l);
+    if (report->bench.samples > 0)
+      report->bench_sample = samples;
+    else
+      free(samples);
+  }
+#endif
+#if defined(MUNIT_PERF)
+  if (perf)
+    munit_perf_close(&perf_group, &report->perf);
+#endif
+#if defined(MUNIT_RUSAGE)
+  if (getrusage(RUSAGE_SELF, &usage_end) == 0)
+    munit_rusage_from(&report->rusage, &usage_end, &usage_begin);
+#endif
+
+  return result;
+}
+
+#if defined(MUNIT_EMOTICON)
+#  define MUNIT_RESULT_STRING_OK    ":)"
+#  define MUNIT_RESULT_STRING_SKIP  ":|"
+#  define MUNIT_RESULT_STRING_FAIL  ":("
+#  define MUNIT_RESULT_STRING_ERROR ":o"
+#  define MUNIT_RESULT_STRING_TODO  ":/"
+#else
+#  define MUNIT_RESULT_STRING_OK    "OK   "
+#  define MUNIT_RESULT_STRING_SKIP  "SKIP "
+#  define MUNIT_RESULT_STRING_FAIL  "FAIL "
+#  define MUNIT_RESULT_STRING_ERROR "ERROR"
+#  define MUNIT_RESULT_STRING_TODO  "TODO "
+#endif
 
 static void
 munit_test_runner_print_color(const MunitTestRunner* runner, const char* string, char color) {
@@ -1251,33 +2301,1547 @@ munit_test_runner_print_color(const MunitTestRunner* runner, const char* string,
     fputs(string, MUNIT_OUTPUT_FILE);
 }
 
-#if !defined(MUNIT_NO_BUFFER)
-static int
-munit_replace_stderr(FILE* stderr_buf) {
-  if (stderr_buf != NULL) {
-    const int orig_stderr = dup(STDERR_FILENO);
+#if !defined(MUNIT_NO_BUFFER)
+static int
+munit_replace_stderr(FILE* stderr_buf) {
+  if (stderr_buf != NULL) {
+    const int orig_stderr = dup(STDERR_FILENO);
+
+    int errfd = fileno(stderr_buf);
+    if (MUNIT_UNLIKELY(errfd == -1)) {
+      exit(EXIT_FAILURE);
+    }
+
+    dup2(errfd, STDERR_FILENO);
+
+    return orig_stderr;
+  }
+
+  return -1;
+}
+
+static void
+munit_restore_stderr(int orig_stderr) {
+  if (orig_stderr != -1) {
+    dup2(orig_stderr, STDERR_FILENO);
+    close(orig_stderr);
+  }
+}
+#endif /* !defined(MUNIT_NO_BUFFER) */
+
+/* Write output that precedes a test result.  With --jobs the text is
+ * kept in runner->pending and printed together with the result of the
+ * next submitted job, so the output does not depend on which child
+ * finishes first. */
+MUNIT_PRINTF(2, 3)
+static int
+munit_test_runner_printf(MunitTestRunner* runner, const char* format, ...) {
+  va_list ap;
+  int len;
+  size_t cap;
+  char* pending;
+
+  va_start(ap, format);
+  if (runner->jobs <= 1) {
+    len = vfprintf(MUNIT_OUTPUT_FILE, format, ap);
+    va_end(ap);
+    return len;
+  }
+  len = vsnprintf(NULL, 0, format, ap);
+  va_end(ap);
+  if (len < 0)
+    return len;
+
+  if (runner->pending_len + len + 1 > runner->pending_cap) {
+    cap = (runner->pending_cap != 0) ? runner->pending_cap : 256;
+    while (cap < runner->pending_len + len + 1)
+      cap *= 2;
+    pending = realloc(runner->pending, cap);
+    if (pending == NULL)
+      return -1;
+    runner->pending = pending;
+    runner->pending_cap = cap;
+  }
+
+  va_start(ap, format);
+  vsnprintf(runner->pending + runner->pending_len, len + 1, format, ap);
+  va_end(ap);
+  runner->pending_len += len;
+  return len;
+}
+
+/* Print the result line for a finished test and update the runner
+ * totals.  Returns the result the line shows. */
+static MunitResult
+munit_test_runner_print_result(MunitTestRunner* runner, const MunitTest* test, const MunitReport* report, MunitResult result, FILE* stderr_buf) {
+  fputs("[ ", MUNIT_OUTPUT_FILE);
+  if ((test->options & MUNIT_TEST_OPTION_TODO) == MUNIT_TEST_OPTION_TODO) {
+    if (report->failed != 0 || report->errored != 0 || report->skipped != 0) {
+      munit_test_runner_print_color(runner, MUNIT_RESULT_STRING_TODO, '3');
+      result = MUNIT_OK;
+    } else {
+      munit_test_runner_print_color(runner, MUNIT_RESULT_STRING_ERROR, '1');
+      if (MUNIT_LIKELY(stderr_buf != NULL))
+        munit_log_internal(MUNIT_LOG_ERROR, stderr_buf, "Test marked TODO, but was successful.");
+      runner->report.failed++;
+      result = MUNIT_ERROR;
+    }
+  } else if (report->failed > 0) {
+    munit_test_runner_print_color(runner, MUNIT_RESULT_STRING_FAIL, '1');
+    runner->report.failed++;
+    result = MUNIT_FAIL;
+  } else if (report->errored > 0) {
+    munit_test_runner_print_color(runner, MUNIT_RESULT_STRING_ERROR, '1');
+    runner->report.errored++;
+    result = MUNIT_ERROR;
+  } else if (report->skipped > 0) {
+    munit_test_runner_print_color(runner, MUNIT_RESULT_STRING_SKIP, '3');
+    runner->report.skipped++;
+    result = MUNIT_SKIP;
+  } else if (report->successful > 1) {
+    munit_test_runner_print_color(runner, MUNIT_RESULT_STRING_OK, '2');
+#if defined(MUNIT_ENABLE_TIMING)
+    if (report->bench.samples > 0) {
+      fputs(" ]\n", MUNIT_OUTPUT_FILE);
+      munit_print_bench(MUNIT_OUTPUT_FILE, &report->bench);
+    } else {
+      fputs(" ] [ ", MUNIT_OUTPUT_FILE);
+      munit_print_time(MUNIT_OUTPUT_FILE, report->wall_clock / report->successful);
+      fputs(" / ", MUNIT_OUTPUT_FILE);
+      munit_print_time(MUNIT_OUTPUT_FILE, report->cpu_clock / report->successful);
+      fprintf(MUNIT_OUTPUT_FILE, " CPU ]\n  %-" MUNIT_XSTRINGIFY(MUNIT_TEST_NAME_LEN) "s Total: [ ", "");
+      munit_print_time(MUNIT_OUTPUT_FILE, report->wall_clock);
+      fputs(" / ", MUNIT_OUTPUT_FILE);
+      munit_print_time(MUNIT_OUTPUT_FILE, report->cpu_clock);
+      fputs(" CPU", MUNIT_OUTPUT_FILE);
+    }
+#endif
+    runner->report.successful++;
+    result = MUNIT_OK;
+  } else if (report->successful > 0) {
+    munit_test_runner_print_color(runner, MUNIT_RESULT_STRING_OK, '2');
+#if defined(MUNIT_ENABLE_TIMING)
+    fputs(" ] [ ", MUNIT_OUTPUT_FILE);
+    munit_print_time(MUNIT_OUTPUT_FILE, report->wall_clock);
+    fputs(" / ", MUNIT_OUTPUT_FILE);
+    munit_print_time(MUNIT_OUTPUT_FILE, report->cpu_clock);
+    fputs(" CPU", MUNIT_OUTPUT_FILE);
+#endif
+    runner->report.successful++;
+    result = MUNIT_OK;
+  }
+  fputs(" ]\n", MUNIT_OUTPUT_FILE);
+#if defined(MUNIT_PERF)
+  if (result == MUNIT_OK && report->perf.available != 0)
+    munit_print_perf(MUNIT_OUTPUT_FILE, &report->perf);
+#endif
+#if defined(MUNIT_ALLOC_TRACKING)
+  if (runner->allocs && (result == MUNIT_OK || result == MUNIT_FAIL) && report->successful + report->failed > 0)
+    munit_print_allocs(MUNIT_OUTPUT_FILE, &report->allocs);
+#endif
+#if defined(MUNIT_RUSAGE)
+  if (runner->rusage && report->rusage.maxrss_kb > 0)
+    munit_print_rusage(MUNIT_OUTPUT_FILE, &report->rusage);
+#endif
+
+  return result;
+}
+
+static const char*
+munit_result_name(MunitResult result) {
+  switch (result) {
+    case MUNIT_OK:
+      return "OK";
+    case MUNIT_SKIP:
+      return "SKIP";
+    case MUNIT_FAIL:
+      return "FAIL";
+    case MUNIT_ERROR:
+    default:
+      return "ERROR";
+  }
+}
+
+static void
+munit_json_string(FILE* fp, const char* str) {
+  const unsigned char* c;
+
+  fputc('"', fp);
+  for (c = (const unsigned char*) str ; *c != '\0' ; c++) {
+    if (*c == '"' || *c == '\\')
+      fprintf(fp, "\\%c", *c);
+    else if (*c < 0x20)
+      fprintf(fp, "\\u%04x", *c);
+    else
+      fputc(*c, fp);
+  }
+  fputc('"', fp);
+}
+
+/* Write a CSV field, quoted if it contains a separator or a quote. */
+static void
+munit_csv_string(FILE* fp, const char* str) {
+  const char* c;
+
+  if (strpbrk(str, ",\"\r\n") == NULL) {
+    fputs(str, fp);
+    return;
+  }
+
+  fputc('"', fp);
+  for (c = str ; *c != '\0' ; c++) {
+    if (*c == '"')
+      fputc('"', fp);
+    fputc(*c, fp);
+  }
+  fputc('"', fp);
+}
+
+static void
+munit_test_runner_write_json(MunitTestRunner* runner, const char* name, const MunitParameter params[], const MunitReport* report, MunitResult result) {
+  FILE* fp = runner->json_file;
+  const MunitParameter* param;
+#if defined(MUNIT_ENABLE_TIMING)
+  unsigned int i;
+#endif
+
+  fputs(runner->json_first ? "\n  {" : ",\n  {", fp);
+  runner->json_first = 0;
+
+  fputs("\"name\": ", fp);
+  munit_json_string(fp, name);
+  fputs(", \"params\": {", fp);
+  for (param = params ; param != NULL && param->name != NULL ; param++) {
+    if (param != params)
+      fputs(", ", fp);
+    munit_json_string(fp, param->name);
+    fputs(": ", fp);
+    munit_json_string(fp, param->value);
+  }
+  fprintf(fp, "}, \"seed\": %" PRIu32 ", \"result\": \"%s\", \"iterations\": %u",
+          runner->seed, munit_result_name(result),
+          report->successful + report->skipped + report->failed + report->errored);
+#if defined(MUNIT_ENABLE_TIMING)
+  fprintf(fp, ", \"wall_ns\": %" PRIu64 ", \"cpu_ns\": %" PRIu64, report->wall_clock, report->cpu_clock);
+  if (report->bench.samples > 0) {
+    fprintf(fp, ",\n   \"bench\": {\"samples\": %u, \"outliers\": %u, \"ops\": %" PRIu64 ", "
+            "\"min_ns\": %.3f, \"median_ns\": %.3f, \"mean_ns\": %.3f, "
+            "\"p90_ns\": %.3f, \"p99_ns\": %.3f, \"mad_ns\": %.3f",
+            report->bench.samples, report->bench.outliers, report->bench.ops,
+            report->bench.min, report->bench.median, report->bench.mean,
+            report->bench.p90, report->bench.p99, report->bench.mad);
+    fputs(",\n   \"samples_ns\": [", fp);
+    for (i = 0 ; i < report->bench.samples ; i++)
+      fprintf(fp, i == 0 ? "%.3f" : ", %.3f", report->bench_sample[i]);
+    fputs("]}", fp);
+  }
+#endif
+#if defined(MUNIT_PERF)
+  if (report->perf.available != 0) {
+    fprintf(fp, ",\n   \"perf\": {\"ops\": %" PRIu64, report->perf.ops);
+    for (i = 0 ; i < MUNIT_PERF_COUNTERS ; i++) {
+      fputs(", ", fp);
+      munit_json_string(fp, munit_perf_events[i].name);
+      if (report->perf.available & (1U << i))
+        fprintf(fp, ": %" PRIu64, report->perf.value[i]);
+      else
+        fputs(": null", fp);
+    }
+    fputc('}', fp);
+  }
+#endif
+#if defined(MUNIT_ALLOC_TRACKING)
+  if (runner->allocs) {
+    fprintf(fp, ",\n   \"allocs\": {\"count\": %" PRIu64 ", \"bytes\": %" PRIu64 ", \"peak_bytes\": %" PRIu64
+            ", \"leaked_blocks\": %" PRIu64 ", \"leaked_bytes\": %" PRIu64 "}",
+            report->allocs.count, report->allocs.bytes, report->allocs.peak,
+            report->allocs.leaked_blocks, report->allocs.leaked_bytes);
+  }
+#endif
+#if defined(MUNIT_RUSAGE)
+  if (report->rusage.maxrss_kb > 0) {
+    fprintf(fp, ",\n   \"rusage\": {\"maxrss_kb\": %" PRIu64 ", \"minor_faults\": %" PRIu64 ", \"major_faults\": %" PRIu64
+            ", \"voluntary_switches\": %" PRIu64 ", \"involuntary_switches\": %" PRIu64 "}",
+            report->rusage.maxrss_kb, report->rusage.minor_faults, report->rusage.major_faults,
+            report->rusage.voluntary_switches, report->rusage.involuntary_switches);
+  }
+#endif
+  fputc('}', fp);
+  fflush(fp);
+}
+
+/* Parameters as name=value pairs joined with ';', "" for none.  The
+ * result must be freed. */
+static char*
+munit_params_join(const MunitParameter params[]) {
+  const MunitParameter* param;
+  char* joined;
+  size_t joined_l = 0;
+
+  for (param = params ; param != NULL && param->name != NULL ; param++)
+    joined_l += strlen(param->name) + strlen(param->value) + 2;
+
+  joined = malloc(joined_l + 1);
+  if (joined == NULL) {
+    munit_log_internal(MUNIT_LOG_ERROR, stderr, "failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+
+  joined_l = 0;
+  joined[0] = '\0';
+  for (param = params ; param != NULL && param->name != NULL ; param++) {
+    sprintf(joined + joined_l, "%s%s=%s", joined_l == 0 ? "" : ";", param->name, param->value);
+    joined_l += strlen(joined + joined_l);
+  }
+
+  return joined;
+}
+
+static void
+munit_test_runner_write_csv(MunitTestRunner* runner, const char* name, const MunitParameter params[], const MunitReport* report, MunitResult result) {
+  FILE* fp = runner->csv_file;
+  char* joined;
+#if defined(MUNIT_PERF)
+  int i;
+#endif
+
+  munit_csv_string(fp, name);
+  fputc(',', fp);
+  joined = munit_params_join(params);
+  munit_csv_string(fp, joined);
+  free(joined);
+  fprintf(fp, ",%" PRIu32 ",%s,%u,", runner->seed, munit_result_name(result),
+          report->successful + report->skipped + report->failed + report->errored);
+#if defined(MUNIT_ENABLE_TIMING)
+  fprintf(fp, "%" PRIu64 ",%" PRIu64, report->wall_clock, report->cpu_clock);
+  if (report->bench.samples > 0) {
+    fprintf(fp, ",%u,%u,%" PRIu64 ",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f",
+            report->bench.samples, report->bench.outliers, report->bench.ops,
+            report->bench.min, report->bench.median, report->bench.mean,
+            report->bench.p90, report->bench.p99, report->bench.mad);
+  } else {
+    fputs(",,,,,,,,,", fp);
+  }
+#else
+  fputs(",,,,,,,,,,", fp);
+#endif
+#if defined(MUNIT_PERF)
+  if (report->perf.available != 0) {
+    fprintf(fp, ",%" PRIu64, report->perf.ops);
+    for (i = 0 ; i < MUNIT_PERF_COUNTERS ; i++) {
+      if (report->perf.available & (1U << i))
+        fprintf(fp, ",%" PRIu64, report->perf.value[i]);
+      else
+        fputc(',', fp);
+    }
+  } else {
+    fputs(",,,,,,,", fp);
+  }
+#else
+  fputs(",,,,,,,", fp);
+#endif
+#if defined(MUNIT_ALLOC_TRACKING)
+  if (runner->allocs) {
+    fprintf(fp, ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64,
+            report->allocs.count, report->allocs.bytes, report->allocs.peak,
+            report->allocs.leaked_blocks, report->allocs.leaked_bytes);
+  } else {
+    fputs(",,,,,", fp);
+  }
+#else
+  fputs(",,,,,", fp);
+#endif
+#if defined(MUNIT_RUSAGE)
+  if (report->rusage.maxrss_kb > 0) {
+    fprintf(fp, ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+            report->rusage.maxrss_kb, report->rusage.minor_faults, report->rusage.major_faults,
+            report->rusage.voluntary_switches, report->rusage.involuntary_switches);
+  } else {
+    fputs(",,,,,\n", fp);
+  }
+#else
+  fputs(",,,,,\n", fp);
+#endif
+  fflush(fp);
+}
+
+#if defined(MUNIT_ENABLE_TIMING)
+typedef struct {
+  const char* pos;
+  const char* end;
+} MunitJsonReader;
+
+static void
+munit_json_skip_ws(MunitJsonReader* reader) {
+  while (reader->pos < reader->end && strchr(" \t\r\n", *reader->pos) != NULL)
+    reader->pos++;
+}
+
+static munit_bool
+munit_json_accept(MunitJsonReader* reader, char c) {
+  munit_json_skip_ws(reader);
+  if (reader->pos < reader->end && *reader->pos == c) {
+    reader->pos++;
+    return 1;
+  }
+  return 0;
+}
+
+/* Returns a newly allocated string, NULL on error.  \u escapes outside
+ * of ASCII become '?'. */
+static char*
+munit_json_read_string(MunitJsonReader* reader) {
+  const char* c;
+  char* str;
+  size_t str_l = 0;
+  unsigned int code;
+  int i;
+
+  if (!munit_json_accept(reader, '"'))
+    return NULL;
+
+  for (c = reader->pos ; c < reader->end && *c != '"' ; c++) {
+    if (*c == '\\')
+      c++;
+  }
+  if (c >= reader->end)
+    return NULL;
+
+  str = malloc(c - reader->pos + 1);
+  if (str == NULL)
+    return NULL;
+
+  while (*reader->pos != '"') {
+    if (*reader->pos != '\\') {
+      str[str_l++] = *reader->pos++;
+      continue;
+    }
+
+    reader->pos++;
+    switch (*reader->pos) {
+      case 'b': str[str_l++] = '\b'; break;
+      case 'f': str[str_l++] = '\f'; break;
+      case 'n': str[str_l++] = '\n'; break;
+      case 'r': str[str_l++] = '\r'; break;
+      case 't': str[str_l++] = '\t'; break;
+      case 'u':
+        code = 0;
+        for (i = 1 ; i <= 4 && reader->pos + i < c ; i++) {
+          code <<= 4;
+          if (reader->pos[i] >= '0' && reader->pos[i] <= '9')
+            code |= reader->pos[i] - '0';
+          else if (reader->pos[i] >= 'a' && reader->pos[i] <= 'f')
+            code |= reader->pos[i] - 'a' + 10;
+          else if (reader->pos[i] >= 'A' && reader->pos[i] <= 'F')
+            code |= reader->pos[i] - 'A' + 10;
+        }
+        reader->pos += i - 1;
+        str[str_l++] = code < 0x80 ? (char) code : '?';
+        break;
+      default:
+        str[str_l++] = *reader->pos;
+        break;
+    }
+    reader->pos++;
+  }
+  reader->pos++;
+  str[str_l] = '\0';
+
+  return str;
+}
+
+static munit_bool
+munit_json_read_number(MunitJsonReader* reader, double* value) {
+  char* endptr;
+
+  munit_json_skip_ws(reader);
+  *value = strtod(reader->pos, &endptr);
+  if (endptr == reader->pos || endptr > reader->end)
+    return 0;
+  reader->pos = endptr;
+  return 1;
+}
+
+static munit_bool
+munit_json_skip_value(MunitJsonReader* reader) {
+  char* str;
+  double number;
+
+  munit_json_skip_ws(reader);
+  if (reader->pos >= reader->end)
+    return 0;
+
+  switch (*reader->pos) {
+    case '"':
+      str = munit_json_read_string(reader);
+      free(str);
+      return str != NULL;
+    case '{':
+      reader->pos++;
+      if (munit_json_accept(reader, '}'))
+        return 1;
+      do {
+        str = munit_json_read_string(reader);
+        free(str);
+        if (str == NULL || !munit_json_accept(reader, ':') || !munit_json_skip_value(reader))
+          return 0;
+      } while (munit_json_accept(reader, ','));
+      return munit_json_accept(reader, '}');
+    case '[':
+      reader->pos++;
+      if (munit_json_accept(reader, ']'))
+        return 1;
+      do {
+        if (!munit_json_skip_value(reader))
+          return 0;
+      } while (munit_json_accept(reader, ','));
+      return munit_json_accept(reader, ']');
+    case 't':
+    case 'f':
+    case 'n':
+      while (reader->pos < reader->end && *reader->pos >= 'a' && *reader->pos <= 'z')
+        reader->pos++;
+      return 1;
+    default:
+      return munit_json_read_number(reader, &number);
+  }
+}
+
+/* Read the "bench" object of a result. */
+static munit_bool
+munit_baseline_read_bench(MunitJsonReader* reader, MunitBaselineEntry* entry) {
+  char* key;
+  munit_bool ok;
+  double value;
+
+  if (!munit_json_accept(reader, '{'))
+    return 0;
+  if (munit_json_accept(reader, '}'))
+    return 1;
+
+  do {
+    key = munit_json_read_string(reader);
+    if (key == NULL || !munit_json_accept(reader, ':')) {
+      free(key);
+      return 0;
+    }
+
+    if (strcmp(key, "median_ns") == 0) {
+      ok = munit_json_read_number(reader, &entry->median);
+    } else if (strcmp(key, "samples_ns") == 0) {
+      ok = munit_json_accept(reader, '[');
+      if (ok && !munit_json_accept(reader, ']')) {
+        do {
+          ok = munit_json_read_number(reader, &value);
+          if (!ok || entry->samples_l == MUNIT_BENCH_SAMPLES_MAX)
+            break;
+          if (entry->samples == NULL) {
+            entry->samples = malloc(sizeof(double) * MUNIT_BENCH_SAMPLES_MAX);
+            if (entry->samples == NULL)
+              break;
+          }
+          entry->samples[entry->samples_l++] = value;
+        } while (munit_json_accept(reader, ','));
+        ok = ok && munit_json_accept(reader, ']');
+      }
+    } else {
+      ok = munit_json_skip_value(reader);
+    }
+    free(key);
+
+    if (!ok)
+      return 0;
+  } while (munit_json_accept(reader, ','));
+
+  return munit_json_accept(reader, '}');
+}
+
+static munit_bool
+munit_baseline_read_params(MunitJsonReader* reader, MunitBaselineEntry* entry) {
+  char* key;
+  char* value;
+  char* joined;
+  size_t joined_l = 0;
+
+  if (!munit_json_accept(reader, '{'))
+    return 0;
+
+  entry->params = calloc(1, 1);
+  if (entry->params == NULL)
+    return 0;
+  if (munit_json_accept(reader, '}'))
+    return 1;
+
+  do {
+    key = munit_json_read_string(reader);
+    value = NULL;
+    if (key != NULL && munit_json_accept(reader, ':'))
+      value = munit_json_read_string(reader);
+    if (value == NULL) {
+      free(key);
+      return 0;
+    }
+
+    joined = realloc(entry->params, joined_l + strlen(key) + strlen(value) + 3);
+    if (joined == NULL) {
+      free(key);
+      free(value);
+      return 0;
+    }
+    entry->params = joined;
+    sprintf(joined + joined_l, "%s%s=%s", joined_l == 0 ? "" : ";", key, value);
+    joined_l += strlen(joined + joined_l);
+
+    free(key);
+    free(value);
+  } while (munit_json_accept(reader, ','));
+
+  return munit_json_accept(reader, '}');
+}
+
+static munit_bool
+munit_baseline_read_entry(MunitJsonReader* reader, MunitBaselineEntry* entry) {
+  char* key;
+  munit_bool ok;
+
+  if (!munit_json_accept(reader, '{'))
+    return 0;
+  if (munit_json_accept(reader, '}'))
+    return 1;
+
+  do {
+    key = munit_json_read_string(reader);
+    if (key == NULL || !munit_json_accept(reader, ':')) {
+      free(key);
+      return 0;
+    }
+
+    if (strcmp(key, "name") == 0 && entry->name == NULL) {
+      entry->name = munit_json_read_string(reader);
+      ok = entry->name != NULL;
+    } else if (strcmp(key, "params") == 0 && entry->params == NULL) {
+      ok = munit_baseline_read_params(reader, entry);
+    } else if (strcmp(key, "bench") == 0) {
+      ok = munit_baseline_read_bench(reader, entry);
+    } else {
+      ok = munit_json_skip_value(reader);
+    }
+    free(key);
+
+    if (!ok)
+      return 0;
+  } while (munit_json_accept(reader, ','));
+
+  return munit_json_accept(reader, '}');
+}
+
+static void
+munit_baseline_entry_free(MunitBaselineEntry* entry) {
+  free(entry->name);
+  free(entry->params);
+  free(entry->samples);
+}
+
+/* Load --bench results from an --output-json file.  A truncated file
+ * (from an interrupted run) keeps the complete results. */
+static munit_bool
+munit_test_runner_load_baseline(MunitTestRunner* runner, const char* path) {
+  FILE* fp;
+  char* data = NULL;
+  size_t data_l = 0;
+  size_t read_l;
+  MunitJsonReader reader;
+  MunitBaselineEntry entry;
+  MunitBaselineEntry* entries;
+  munit_bool ok;
+
+  fp = fopen(path, "rb");
+  if (fp == NULL) {
+    munit_logf_internal(MUNIT_LOG_ERROR, stderr, "unable to open baseline '%s': %s", path, strerror(errno));
+    return 0;
+  }
+
+  do {
+    entries = (MunitBaselineEntry*) realloc(data, data_l + 4096 + 1);
+    if (entries == NULL) {
+      munit_log_internal(MUNIT_LOG_ERROR, stderr, "failed to allocate memory");
+      free(data);
+      fclose(fp);
+      return 0;
+    }
+    data = (char*) entries;
+    read_l = fread(data + data_l, 1, 4096, fp);
+    data_l += read_l;
+  } while (read_l > 0);
+  data[data_l] = '\0';
+  fclose(fp);
+
+  reader.pos = data;
+  reader.end = data + data_l;
+  ok = munit_json_accept(&reader, '[');
+  if (ok && !munit_json_accept(&reader, ']')) {
+    do {
+      memset(&entry, 0, sizeof(entry));
+      ok = munit_baseline_read_entry(&reader, &entry);
+      if (!ok || entry.name == NULL || entry.samples_l == 0) {
+        munit_baseline_entry_free(&entry);
+        continue;
+      }
+      if (entry.params == NULL)
+        entry.params = calloc(1, 1);
+
+      entries = realloc(runner->baseline, sizeof(MunitBaselineEntry) * (runner->baseline_l + 1));
+      if (entries == NULL || entry.params == NULL) {
+        munit_log_internal(MUNIT_LOG_ERROR, stderr, "failed to allocate memory");
+        exit(EXIT_FAILURE);
+      }
+      runner->baseline = entries;
+      runner->baseline[runner->baseline_l++] = entry;
+    } while (ok && munit_json_accept(&reader, ','));
+  }
+  free(data);
+
+  if (!ok && runner->baseline_l == 0) {
+    munit_logf_internal(MUNIT_LOG_ERROR, stderr, "baseline '%s' is not a --output-json file", path);
+    return 0;
+  }
+  if (!ok)
+    munit_logf_internal(MUNIT_LOG_WARNING, stderr, "baseline '%s' is truncated, using the first %u results", path, (unsigned int) runner->baseline_l);
+  if (runner->baseline_l == 0)
+    munit_logf_internal(MUNIT_LOG_WARNING, stderr, "baseline '%s' has no --bench results", path);
+
+  return 1;
+}
+
+/* Two-sided Mann-Whitney U test p-value, normal approximation with tie
+ * correction.  Both arrays must be sorted. */
+static double
+munit_mann_whitney(const double* a, unsigned int a_l, const double* b, unsigned int b_l) {
+  const double n = (double) a_l + (double) b_l;
+  double rank_sum = 0.0, ties = 0.0;
+  double rank, u, mean, sigma, z;
+  unsigned int i = 0, j = 0, a_eq, b_eq, t;
+  double value;
+
+  if (a_l == 0 || b_l == 0)
+    return 1.0;
+
+  /* Merge the sorted arrays; equal values get the average rank. */
+  rank = 1.0;
+  while (i < a_l || j < b_l) {
+    if (j >= b_l || (i < a_l && a[i] <= b[j]))
+      value = a[i];
+    else
+      value = b[j];
+
+    for (a_eq = 0 ; i + a_eq < a_l && a[i + a_eq] == value ; a_eq++)
+      ;
+    for (b_eq = 0 ; j + b_eq < b_l && b[j + b_eq] == value ; b_eq++)
+      ;
+    t = a_eq + b_eq;
+
+    rank_sum += a_eq * (rank + (t - 1) / 2.0);
+    ties += (double) t * t * t - t;
+    rank += t;
+    i += a_eq;
+    j += b_eq;
+  }
+
+  u = rank_sum - a_l * (a_l + 1.0) / 2.0;
+  mean = a_l * (double) b_l / 2.0;
+  sigma = sqrt(a_l * (double) b_l / 12.0 * ((n + 1.0) - ties / (n * (n - 1.0))));
+  if (sigma == 0.0)
+    return 1.0;
+
+  /* continuity correction */
+  z = (fabs(u - mean) - 0.5) / sigma;
+  if (z < 0.0)
+    z = 0.0;
+  return erfc(z / sqrt(2.0));
+}
+
+/* Compare a --bench result with the --baseline and remember the row
+ * for munit_test_runner_print_baseline(). */
+static void
+munit_test_runner_compare(MunitTestRunner* runner, const char* name, const MunitParameter params[], const MunitBenchStats* bench, const double* sample) {
+  const MunitBaselineEntry* entry = NULL;
+  MunitBaselineRow* rows;
+  MunitBaselineRow* row;
+  char* joined;
+  size_t i;
+
+  joined = munit_params_join(params);
+  for (i = 0 ; i < runner->baseline_l ; i++) {
+    if (strcmp(runner->baseline[i].name, name) == 0 && strcmp(runner->baseline[i].params, joined) == 0) {
+      entry = &runner->baseline[i];
+      break;
+    }
+  }
+  if (entry == NULL) {
+    free(joined);
+    return;
+  }
+
+  rows = realloc(runner->baseline_rows, sizeof(MunitBaselineRow) * (runner->baseline_rows_l + 1));
+  if (rows == NULL) {
+    munit_log_internal(MUNIT_LOG_ERROR, stderr, "failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  runner->baseline_rows = rows;
+  row = &rows[runner->baseline_rows_l++];
+
+  row->name = malloc(strlen(name) + strlen(joined) + 2);
+  if (row->name == NULL) {
+    munit_log_internal(MUNIT_LOG_ERROR, stderr, "failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  sprintf(row->name, *joined != '\0' ? "%s %s" : "%s", name, joined);
+  free(joined);
+
+  row->baseline = entry->median;
+  row->current = bench->median;
+  row->change = entry->median > 0.0 ? (bench->median / entry->median - 1.0) * 100.0 : 0.0;
+  qsort(entry->samples, entry->samples_l, sizeof(double), munit_double_compare);
+  row->p = munit_mann_whitney(entry->samples, entry->samples_l, sample, bench->samples);
+  row->regression = runner->max_regression >= 0.0 && row->p < 0.05 && row->change > runner->max_regression;
+}
+
+/* Print the table of speedups and slowdowns.  Returns the number of
+ * regressions beyond --max-regression. */
+static unsigned int
+munit_test_runner_print_baseline(MunitTestRunner* runner) {
+  const MunitBaselineRow* row;
+  unsigned int regressions = 0;
+  size_t i;
+
+  if (runner->baseline == NULL)
+    return 0;
+
+  fputs("Baseline comparison", MUNIT_OUTPUT_FILE);
+  if (runner->max_regression >= 0.0)
+    fprintf(MUNIT_OUTPUT_FILE, ", max regression %.1f%%", runner->max_regression);
+  fprintf(MUNIT_OUTPUT_FILE, ":\n  %-" MUNIT_XSTRINGIFY(MUNIT_TEST_NAME_LEN) "s  %10s  %10s  %8s  %6s\n",
+          "test", "baseline", "current", "change", "p");
+
+  for (i = 0 ; i < runner->baseline_rows_l ; i++) {
+    row = &runner->baseline_rows[i];
+    fprintf(MUNIT_OUTPUT_FILE, "  %-" MUNIT_XSTRINGIFY(MUNIT_TEST_NAME_LEN) "s  %7.2f ns  %7.2f ns  %+7.1f%%  %6.3f  ",
+            row->name, row->baseline, row->current, row->change, row->p);
+    if (row->regression) {
+      munit_test_runner_print_color(runner, "REGRESSION", '1');
+      regressions++;
+    } else if (row->p >= 0.05) {
+      fputs("~", MUNIT_OUTPUT_FILE);
+    } else if (row->change < 0.0) {
+      munit_test_runner_print_color(runner, "faster", '2');
+    } else {
+      munit_test_runner_print_color(runner, "slower", '3');
+    }
+    fputc('\n', MUNIT_OUTPUT_FILE);
+  }
+  if (runner->baseline_rows_l == 0)
+    fputs("  no --bench results matched the baseline\n", MUNIT_OUTPUT_FILE);
+
+  return regressions;
+}
+#endif
+
+/* Append a finished test to the --output-json and --output-csv files.
+ * Each record is flushed so it survives a crash of the runner. */
+static void
+munit_test_runner_record(MunitTestRunner* runner, const char* name, const MunitParameter params[], const MunitReport* report, MunitResult result) {
+  if (runner->json_file != NULL)
+    munit_test_runner_write_json(runner, name, params, report, result);
+  if (runner->csv_file != NULL)
+    munit_test_runner_write_csv(runner, name, params, report, result);
+#if defined(MUNIT_ENABLE_TIMING)
+  if (runner->baseline != NULL && result == MUNIT_OK && report->bench.samples > 0)
+    munit_test_runner_compare(runner, name, params, &report->bench, report->bench_sample);
+#endif
+}
+
+/* Show the buffered stderr of a test if needed and close the buffer. */
+static void
+munit_test_runner_show_stderr(MunitTestRunner* runner, MunitResult result, FILE* stderr_buf) {
+  if (stderr_buf != NULL) {
+    if (result == MUNIT_FAIL || result == MUNIT_ERROR || runner->show_stderr) {
+      fflush(MUNIT_OUTPUT_FILE);
+
+      rewind(stderr_buf);
+      munit_splice(fileno(stderr_buf), STDERR_FILENO);
+
+      fflush(stderr);
+    }
+
+    fclose(stderr_buf);
+  }
+}
+
+#if !defined(MUNIT_NO_FORK)
+static munit_uint64_t
+munit_monotonic_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((munit_uint64_t) ts.tv_sec) * 1000 + ((munit_uint64_t) ts.tv_nsec) / 1000000;
+}
+
+/* Time limit of a test in seconds, 0 for none. */
+static double
+munit_test_runner_timeout(const MunitTestRunner* runner, const MunitTest* test) {
+  size_t i;
+
+  for (i = 0 ; i < munit_test_timeouts_l ; i++) {
+    if (munit_test_timeouts[i].test == test && munit_test_timeouts[i].seconds > 0.0)
+      return munit_test_timeouts[i].seconds;
+  }
+  return runner->timeout;
+}
+
+/* Deadline of a test started now, 0 for none. */
+static munit_uint64_t
+munit_deadline_after(double timeout) {
+  if (!(timeout > 0.0))
+    return 0;
+  if (timeout > 1e9)
+    timeout = 1e9;
+  return munit_monotonic_ms() + (munit_uint64_t) (timeout * 1000.0) + 1;
+}
+
+/* Timeout for poll() until the deadline, -1 for none. */
+static int
+munit_deadline_poll_timeout(munit_uint64_t deadline) {
+  munit_uint64_t now;
+
+  if (deadline == 0)
+    return -1;
+  now = munit_monotonic_ms();
+  if (now >= deadline)
+    return 0;
+  return (deadline - now > INT_MAX) ? INT_MAX : (int) (deadline - now);
+}
+
+static munit_bool
+munit_read_all(int fd, void* data, size_t len) {
+  ssize_t read_res;
+  size_t bytes_read = 0;
+
+  while (bytes_read < len) {
+    read_res = read(fd, ((munit_uint8_t*) data) + bytes_read, len - bytes_read);
+    if (read_res < 0 && errno == EINTR)
+      continue;
+    if (read_res < 1)
+      return 0;
+    bytes_read += read_res;
+  }
+  return 1;
+}
+
+static munit_bool
+munit_write_all(int fd, const void* data, size_t len) {
+  ssize_t write_res;
+  size_t bytes_written = 0;
+
+  while (bytes_written < len) {
+    write_res = write(fd, ((const munit_uint8_t*) data) + bytes_written, len - bytes_written);
+    if (write_res < 0 && errno == EINTR)
+      continue;
+    if (write_res < 0)
+      return 0;
+    bytes_written += write_res;
+  }
+  return 1;
+}
+
+/* Bytes of a report on the pipe: the fixed part, then with --bench
+ * the kept samples once the fixed part says how many there are. */
+static size_t
+munit_report_wire_size(const MunitReport* report, size_t bytes_read) {
+#if defined(MUNIT_ENABLE_TIMING)
+  if (bytes_read >= MUNIT_REPORT_SIZE)
+    return MUNIT_REPORT_SIZE + sizeof(double) * report->bench.samples;
+#else
+  (void) report;
+  (void) bytes_read;
+#endif
+  return MUNIT_REPORT_SIZE;
+}
+
+static munit_bool
+munit_report_write(int fd, const MunitReport* report) {
+  if (!munit_write_all(fd, report, MUNIT_REPORT_SIZE))
+    return 0;
+#if defined(MUNIT_ENABLE_TIMING)
+  if (report->bench.samples > 0 &&
+      !munit_write_all(fd, report->bench_sample, sizeof(double) * report->bench.samples))
+    return 0;
+#endif
+  return 1;
+}
+
+/* Read the next part of a report with a single read(), allocating the
+ * samples when the fixed part is complete. */
+static ssize_t
+munit_report_read(int fd, MunitReport* report, size_t bytes_read) {
+  munit_uint8_t* dest = ((munit_uint8_t*) report) + bytes_read;
+
+#if defined(MUNIT_ENABLE_TIMING)
+  if (bytes_read >= MUNIT_REPORT_SIZE) {
+    if (report->bench_sample == NULL) {
+      report->bench_sample = malloc(sizeof(double) * report->bench.samples);
+      if (report->bench_sample == NULL) {
+        errno = ENOMEM;
+        return -1;
+      }
+    }
+    dest = ((munit_uint8_t*) report->bench_sample) + (bytes_read - MUNIT_REPORT_SIZE);
+  }
+#endif
+
+  return read(fd, dest, munit_report_wire_size(report, bytes_read) - bytes_read);
+}
+
+/* Body of the forked child: run the test and send the report to the
+ * parent through the pipe.  Does not return. */
+static void
+munit_test_runner_fork_child(MunitTestRunner* runner, const MunitTest* test, const MunitParameter params[], FILE* stderr_buf, int pipefd[2]) {
+  MunitReport report = {
+    0, 0, 0, 0,
+#if defined(MUNIT_ENABLE_TIMING)
+    0, 0, { 0, },
+#endif
+#if defined(MUNIT_PERF)
+    { 0, },
+#endif
+#if defined(MUNIT_ALLOC_TRACKING)
+    { 0, },
+#endif
+#if defined(MUNIT_RUSAGE)
+    { 0, },
+#endif
+#if defined(MUNIT_ENABLE_TIMING)
+    NULL,
+#endif
+  };
+  int orig_stderr;
+
+  close(pipefd[0]);
+
+  orig_stderr = munit_replace_stderr(stderr_buf);
+  munit_test_runner_exec(runner, test, params, &report);
+
+  /* Note that we don't restore stderr.  This is so we can buffer
+   * things written to stderr later on (such as by
+   * asan/tsan/ubsan, valgrind, etc.) */
+  close(orig_stderr);
+
+  if (!munit_report_write(pipefd[1], &report)) {
+    if (stderr_buf != NULL) {
+      munit_log_errno(MUNIT_LOG_ERROR, stderr, "unable to write to pipe");
+    }
+    exit(EXIT_FAILURE);
+  }
+
+  if (stderr_buf != NULL)
+    fclose(stderr_buf);
+  close(pipefd[1]);
+
+  exit(EXIT_SUCCESS);
+}
+
+/* Reap the child and count a crash, a short report or a timeout as
+ * an error.  timed_out is the limit in seconds if the runner killed
+ * the child, 0 otherwise. */
+static void
+munit_test_runner_wait_child(pid_t fork_pid, size_t bytes_read, FILE* stderr_buf, MunitReport* report, double timed_out) {
+  int status = 0;
+  pid_t changed_pid;
+  struct rusage usage;
+  munit_bool complete = bytes_read == munit_report_wire_size(report, bytes_read);
+
+#if defined(MUNIT_ENABLE_TIMING)
+  /* The samples of a cut off report are not all there */
+  if (!complete)
+    report->bench.samples = 0;
+#endif
+
+  changed_pid = wait4(fork_pid, &status, 0, &usage);
+  /* Exact totals of the child, replacing what it measured itself */
+  if (changed_pid == fork_pid)
+    munit_rusage_from(&report->rusage, &usage, NULL);
+
+  if (timed_out > 0.0) {
+    munit_logf_internal(MUNIT_LOG_ERROR, stderr_buf, "timed out after %g seconds", timed_out);
+    report->errored++;
+  } else if (MUNIT_LIKELY(changed_pid == fork_pid) && MUNIT_LIKELY(WIFEXITED(status))) {
+    if (!complete) {
+      munit_logf_internal(MUNIT_LOG_ERROR, stderr_buf, "child exited unexpectedly with status %d", WEXITSTATUS(status));
+      report->errored++;
+    } else if (WEXITSTATUS(status) != EXIT_SUCCESS) {
+      munit_logf_internal(MUNIT_LOG_ERROR, stderr_buf, "child exited with status %d", WEXITSTATUS(status));
+      report->errored++;
+    }
+  } else {
+    if (WIFSIGNALED(status)) {
+#if defined(_XOPEN_VERSION) && (_XOPEN_VERSION >= 700)
+      munit_logf_internal(MUNIT_LOG_ERROR, stderr_buf, "child killed by signal %d (%s)", WTERMSIG(status), strsignal(WTERMSIG(status)));
+#else
+      munit_logf_internal(MUNIT_LOG_ERROR, stderr_buf, "child killed by signal %d", WTERMSIG(status));
+#endif
+    } else if (WIFSTOPPED(status)) {
+      munit_logf_internal(MUNIT_LOG_ERROR, stderr_buf, "child stopped by signal %d", WSTOPSIG(status));
+    }
+    report->errored++;
+  }
+}
+
+/* Print the results of finished jobs at the head of the queue. */
+static void
+munit_test_runner_flush_jobs(MunitTestRunner* runner) {
+  MunitJob* job;
+  MunitResult result;
+
+  while (runner->queue_head != NULL && runner->queue_head->done) {
+    job = runner->queue_head;
+    runner->queue_head = job->next;
+    if (runner->queue_head == NULL)
+      runner->queue_tail = NULL;
+
+    if (job->header != NULL)
+      fputs(job->header, MUNIT_OUTPUT_FILE);
+    result = munit_test_runner_print_result(runner, job->test, &job->report, job->result, job->stderr_buf);
+    munit_test_runner_record(runner, job->name, job->params, &job->report, result);
+
+    if (job->worker < 0) {
+      munit_test_runner_show_stderr(runner, result, job->stderr_buf);
+    } else {
+      fclose(job->stderr_buf);
+      if (result == MUNIT_FAIL || result == MUNIT_ERROR || runner->show_stderr) {
+        fflush(MUNIT_OUTPUT_FILE);
+        fwrite(job->stderr_data, 1, job->stderr_len, stderr);
+        fflush(stderr);
+      }
+      free(job->stderr_data);
+    }
+
+#if defined(MUNIT_ENABLE_TIMING)
+    free(job->report.bench_sample);
+#endif
+    free(job->header);
+    free(job->name);
+    free(job->params);
+    free(job);
+  }
+}
+
+/* Main loop of a pool worker: run requested tests until the runner
+ * closes the request pipe.  Does not return. */
+static void
+munit_test_runner_worker(MunitTestRunner* runner, int cmd_fd, int result_fd, int stderr_fd) {
+  MunitWorkerRequest request;
+  MunitParameter* params = NULL;
+  size_t params_cap = 0;
+  MunitReport report;
+
+  while (munit_read_all(cmd_fd, &request, sizeof(request))) {
+    if (request.has_params) {
+      if (request.params_l + 1 > params_cap) {
+        params_cap = request.params_l + 1;
+        free(params);
+        params = malloc(sizeof(MunitParameter) * params_cap);
+        if (params == NULL)
+          exit(EXIT_FAILURE);
+      }
+      if (!munit_read_all(cmd_fd, params, sizeof(MunitParameter) * (request.params_l + 1)))
+        exit(EXIT_FAILURE);
+    }
+
+    if (ftruncate(stderr_fd, 0) != 0 || lseek(stderr_fd, 0, SEEK_SET) != 0)
+      exit(EXIT_FAILURE);
+
+    memset(&report, 0, sizeof(report));
+    munit_test_runner_exec(runner, request.test, request.has_params ? params : NULL, &report);
+    fflush(stdout);
+    fflush(stderr);
+
+    if (!munit_report_write(result_fd, &report))
+      exit(EXIT_FAILURE);
+#if defined(MUNIT_ENABLE_TIMING)
+    free(report.bench_sample);
+#endif
+  }
+
+  free(params);
+  exit(EXIT_SUCCESS);
+}
+
+static void
+munit_worker_close(MunitWorker* worker) {
+  close(worker->cmd_fd);
+  close(worker->result_fd);
+  close(worker->stderr_fd);
+  worker->pid = -1;
+  worker->job = NULL;
+}
+
+static munit_bool
+munit_test_runner_spawn_worker(MunitTestRunner* runner, MunitWorker* worker) {
+  int cmd_pipe[2];
+  int result_pipe[2];
+  FILE* stderr_file;
+  unsigned int i;
+
+  /* One buffer per worker instead of a tmpfile per test. */
+  stderr_file = tmpfile();
+  if (stderr_file == NULL) {
+    munit_log_errno(MUNIT_LOG_ERROR, stderr, "unable to create buffer for stderr");
+    return 0;
+  }
+  worker->stderr_fd = dup(fileno(stderr_file));
+  fclose(stderr_file);
+  if (worker->stderr_fd < 0) {
+    munit_log_errno(MUNIT_LOG_ERROR, stderr, "unable to create buffer for stderr");
+    return 0;
+  }
+
+  if (pipe(cmd_pipe) != 0) {
+    munit_log_errno(MUNIT_LOG_ERROR, stderr, "unable to create pipe");
+    close(worker->stderr_fd);
+    return 0;
+  }
+  if (pipe(result_pipe) != 0) {
+    munit_log_errno(MUNIT_LOG_ERROR, stderr, "unable to create pipe");
+    close(cmd_pipe[0]);
+    close(cmd_pipe[1]);
+    close(worker->stderr_fd);
+    return 0;
+  }
+
+  fflush(MUNIT_OUTPUT_FILE);
+  fflush(stderr);
+
+  worker->pid = fork();
+  if (worker->pid == 0) {
+    /* Other workers must see EOF when the runner closes their pipes. */
+    for (i = 0 ; i < runner->jobs ; i++) {
+      if (&runner->workers[i] != worker && runner->workers[i].pid != -1) {
+        close(runner->workers[i].cmd_fd);
+        close(runner->workers[i].result_fd);
+        close(runner->workers[i].stderr_fd);
+      }
+    }
+    close(cmd_pipe[1]);
+    close(result_pipe[0]);
+    dup2(worker->stderr_fd, STDERR_FILENO);
+    munit_test_runner_worker(runner, cmd_pipe[0], result_pipe[1], worker->stderr_fd);
+  } else if (worker->pid == -1) {
+    munit_log_errno(MUNIT_LOG_ERROR, stderr, "unable to fork");
+    close(cmd_pipe[0]);
+    close(cmd_pipe[1]);
+    close(result_pipe[0]);
+    close(result_pipe[1]);
+    close(worker->stderr_fd);
+    return 0;
+  }
+
+  close(cmd_pipe[0]);
+  close(result_pipe[1]);
+  worker->cmd_fd = cmd_pipe[1];
+  worker->result_fd = result_pipe[0];
+  worker->job = NULL;
+  return 1;
+}
+
+/* Copy what the worker wrote to stderr during the job. */
+static void
+munit_worker_collect_stderr(MunitWorker* worker, MunitJob* job) {
+  munit_uint8_t buf[4096];
+  ssize_t read_res;
+  off_t offset = 0;
+
+  while ((read_res = pread(worker->stderr_fd, buf, sizeof(buf), offset)) > 0) {
+    fwrite(buf, 1, read_res, job->stderr_buf);
+    offset += read_res;
+  }
+}
+
+static void
+munit_test_runner_shutdown_workers(MunitTestRunner* runner) {
+  unsigned int i;
+
+  if (runner->workers == NULL)
+    return;
+
+  for (i = 0 ; i < runner->jobs ; i++) {
+    if (runner->workers[i].pid == -1)
+      continue;
+    close(runner->workers[i].cmd_fd);
+    waitpid(runner->workers[i].pid, NULL, 0);
+    close(runner->workers[i].result_fd);
+    close(runner->workers[i].stderr_fd);
+    runner->workers[i].pid = -1;
+  }
+  free(runner->workers);
+  runner->workers = NULL;
+}
+
+static void
+munit_test_runner_finish_job(MunitTestRunner* runner, MunitJob* job) {
+  MunitWorker* worker;
+
+  if (job->worker >= 0) {
+    worker = &runner->workers[job->worker];
+    munit_worker_collect_stderr(worker, job);
+    if (job->report_read != munit_report_wire_size(&job->report, job->report_read)) {
+      /* The worker died; it is replaced on the next submit. */
+      close(worker->cmd_fd);
+      munit_test_runner_wait_child(worker->pid, job->report_read, job->stderr_buf, &job->report, job->timed_out ? job->timeout : 0.0);
+      munit_worker_close(worker);
+    }
+    worker->job = NULL;
+    job->done = 1;
+    runner->running--;
+    return;
+  }
+
+  munit_test_runner_wait_child(job->pid, job->report_read, job->stderr_buf, &job->report, job->timed_out ? job->timeout : 0.0);
+  /* Anything logged to the buffer must reach the file before the
+   * next fork, or the child would flush its copy of it again. */
+  if (job->stderr_buf != NULL)
+    fflush(job->stderr_buf);
+  close(job->pipefd);
+  job->done = 1;
+  runner->running--;
+}
+
+/* Wait until at least one running job makes progress or runs out
+ * of time.  A job past its deadline is killed with its child or
+ * worker; a killed worker is replaced on the next submit. */
+static void
+munit_test_runner_poll_jobs(MunitTestRunner* runner) {
+  struct pollfd* fds;
+  MunitJob** polled;
+  MunitJob* job;
+  nfds_t fds_l = 0;
+  nfds_t i;
+  ssize_t read_res;
+  munit_uint64_t deadline = 0;
+  munit_uint64_t now;
+
+  fds = malloc(sizeof(struct pollfd) * runner->running);
+  polled = malloc(sizeof(MunitJob*) * runner->running);
+  if (fds == NULL || polled == NULL) {
+    munit_log_internal(MUNIT_LOG_ERROR, stderr, "failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+
+  for (job = runner->queue_head ; job != NULL ; job = job->next) {
+    if (job->done || (job->worker < 0 && job->pid <= 0))
+      continue;
+    fds[fds_l].fd = job->pipefd;
+    fds[fds_l].events = POLLIN;
+    fds[fds_l].revents = 0;
+    polled[fds_l++] = job;
+    if (job->deadline != 0 && (deadline == 0 || job->deadline < deadline))
+      deadline = job->deadline;
+  }
+
+  if (poll(fds, fds_l, munit_deadline_poll_timeout(deadline)) < 0) {
+    if (errno != EINTR) {
+      munit_log_errno(MUNIT_LOG_ERROR, stderr, "unable to poll children");
+      exit(EXIT_FAILURE);
+    }
+    fds_l = 0;
+  }
+
+  now = (deadline != 0) ? munit_monotonic_ms() : 0;
+  for (i = 0 ; i < fds_l ; i++) {
+    job = polled[i];
+    if (fds[i].revents == 0) {
+      if (job->deadline != 0 && now >= job->deadline) {
+        kill((job->worker < 0) ? job->pid : runner->workers[job->worker].pid, SIGKILL);
+        job->timed_out = 1;
+        munit_test_runner_finish_job(runner, job);
+      }
+      continue;
+    }
+    read_res = munit_report_read(job->pipefd, &job->report, job->report_read);
+    if (read_res > 0) {
+      job->report_read += read_res;
+      if (job->report_read < munit_report_wire_size(&job->report, job->report_read))
+        continue;
+    } else if (read_res < 0 && (errno == EINTR || errno == EAGAIN)) {
+      continue;
+    }
+    /* A full report, EOF or a real error */
+    munit_test_runner_finish_job(runner, job);
+  }
+
+  free(fds);
+  free(polled);
+}
+
+/* Hand the job to an idle worker, starting one if needed. */
+static void
+munit_test_runner_submit_pool(MunitTestRunner* runner, MunitJob* job, size_t params_l) {
+  MunitWorkerRequest request;
+  MunitWorker* worker = NULL;
+  unsigned int i;
 
-    int errfd = fileno(stderr_buf);
-    if (MUNIT_UNLIKELY(errfd == -1)) {
+  job->stderr_buf = open_memstream(&job->stderr_data, &job->stderr_len);
+  if (job->stderr_buf == NULL) {
+    munit_log_errno(MUNIT_LOG_ERROR, stderr, "unable to create buffer for stderr");
+    exit(EXIT_FAILURE);
+  }
+
+  if (runner->workers == NULL) {
+    runner->workers = malloc(sizeof(MunitWorker) * runner->jobs);
+    if (runner->workers == NULL) {
+      munit_log_internal(MUNIT_LOG_ERROR, stderr, "failed to allocate memory");
       exit(EXIT_FAILURE);
     }
+    for (i = 0 ; i < runner->jobs ; i++) {
+      runner->workers[i].pid = -1;
+      runner->workers[i].job = NULL;
+    }
+  }
 
-    dup2(errfd, STDERR_FILENO);
+  for (i = 0 ; i < runner->jobs ; i++) {
+    if (runner->workers[i].job == NULL) {
+      worker = &runner->workers[i];
+      break;
+    }
+  }
+  if (worker == NULL) {
+    munit_log_internal(MUNIT_LOG_ERROR, stderr, "no idle worker");
+    exit(EXIT_FAILURE);
+  }
 
-    return orig_stderr;
+  if (worker->pid == -1 && !munit_test_runner_spawn_worker(runner, worker)) {
+    job->report.errored++;
+    job->result = MUNIT_ERROR;
+    job->done = 1;
+    return;
   }
 
-  return -1;
+  request.test = job->test;
+  request.has_params = job->params != NULL;
+  request.params_l = (unsigned int) params_l;
+  if (!munit_write_all(worker->cmd_fd, &request, sizeof(request)) ||
+      (job->params != NULL &&
+       !munit_write_all(worker->cmd_fd, job->params, sizeof(MunitParameter) * (params_l + 1)))) {
+    munit_log_errno(MUNIT_LOG_ERROR, job->stderr_buf, "unable to send test to worker");
+    job->report.errored++;
+    job->result = MUNIT_ERROR;
+    job->done = 1;
+    return;
+  }
+
+  job->worker = (int) (worker - runner->workers);
+  job->pipefd = worker->result_fd;
+  job->timeout = munit_test_runner_timeout(runner, job->test);
+  job->deadline = munit_deadline_after(job->timeout);
+  worker->job = job;
+  runner->running++;
 }
 
+/* Fork the test and queue it; blocks while runner->jobs children are
+ * already running. */
 static void
-munit_restore_stderr(int orig_stderr) {
-  if (orig_stderr != -1) {
-    dup2(orig_stderr, STDERR_FILENO);
-    close(orig_stderr);
+munit_test_runner_submit(MunitTestRunner* runner, const MunitTest* test, const MunitParameter params[]) {
+  MunitJob* job;
+  const MunitParameter* param;
+  size_t params_l = 0;
+  int pipefd[2];
+
+  job = calloc(1, sizeof(MunitJob));
+  if (job == NULL) {
+    munit_log_internal(MUNIT_LOG_ERROR, stderr, "failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  job->test = test;
+  job->result = MUNIT_OK;
+  job->pipefd = -1;
+  job->worker = -1;
+  job->header = runner->pending;
+  runner->pending = NULL;
+  runner->pending_len = 0;
+  runner->pending_cap = 0;
+
+  job->name = malloc(strlen(runner->test_name) + 1);
+  if (job->name == NULL) {
+    munit_log_internal(MUNIT_LOG_ERROR, stderr, "failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  strcpy(job->name, runner->test_name);
+
+  if (params != NULL) {
+    for (param = params ; param->name != NULL ; param++)
+      params_l++;
+    job->params = malloc(sizeof(MunitParameter) * (params_l + 1));
+    if (job->params == NULL) {
+      munit_log_internal(MUNIT_LOG_ERROR, stderr, "failed to allocate memory");
+      exit(EXIT_FAILURE);
+    }
+    memcpy(job->params, params, sizeof(MunitParameter) * (params_l + 1));
+  }
+
+  if (runner->queue_tail != NULL)
+    runner->queue_tail->next = job;
+  else
+    runner->queue_head = job;
+  runner->queue_tail = job;
+
+  if (runner->pool) {
+    munit_test_runner_submit_pool(runner, job, params_l);
+    while (runner->running >= runner->jobs)
+      munit_test_runner_poll_jobs(runner);
+    munit_test_runner_flush_jobs(runner);
+    return;
+  }
+
+  job->stderr_buf = tmpfile();
+  if (job->stderr_buf == NULL) {
+    munit_log_errno(MUNIT_LOG_ERROR, stderr, "unable to create buffer for stderr");
+    job->result = MUNIT_ERROR;
+    job->done = 1;
+    return;
+  }
+
+  if (pipe(pipefd) != 0) {
+    munit_log_errno(MUNIT_LOG_ERROR, stderr, "unable to create pipe");
+    job->result = MUNIT_ERROR;
+    job->done = 1;
+    return;
+  }
+
+  /* The child must not inherit unflushed output of the parent. */
+  fflush(MUNIT_OUTPUT_FILE);
+  fflush(stderr);
+
+  job->pid = fork();
+  if (job->pid == 0) {
+    munit_test_runner_fork_child(runner, test, job->params, job->stderr_buf, pipefd);
+  } else if (job->pid == -1) {
+    close(pipefd[0]);
+    close(pipefd[1]);
+    munit_log_errno(MUNIT_LOG_ERROR, stderr, "unable to fork");
+    job->report.errored++;
+    job->result = MUNIT_ERROR;
+    job->done = 1;
+  } else {
+    close(pipefd[1]);
+    job->pipefd = pipefd[0];
+    job->timeout = munit_test_runner_timeout(runner, test);
+    job->deadline = munit_deadline_after(job->timeout);
+    runner->running++;
   }
+
+  while (runner->running >= runner->jobs)
+    munit_test_runner_poll_jobs(runner);
+  munit_test_runner_flush_jobs(runner);
 }
-#endif /* !defined(MUNIT_NO_BUFFER) */
+#endif
 
 /* Run a test with the specified parameters. */
 static void
@@ -1286,7 +3850,19 @@ munit_test_runner_run_test_with_params(MunitTestRunner* runner, const MunitTest*
   MunitReport report = {
     0, 0, 0, 0,
 #if defined(MUNIT_ENABLE_TIMING)
-    0, 0
+    0, 0, { 0, },
+#endif
+#if defined(MUNIT_PERF)
+    { 0, },
+#endif
+#if defined(MUNIT_ALLOC_TRACKING)
+    { 0, },
+#endif
+#if defined(MUNIT_RUSAGE)
+    { 0, },
+#endif
+#if defined(MUNIT_ENABLE_TIMING)
+    NULL,
 #endif
   };
   unsigned int output_l;
@@ -1296,34 +3872,41 @@ munit_test_runner_run_test_with_params(MunitTestRunner* runner, const MunitTest*
 #if !defined(MUNIT_NO_FORK)
   int pipefd[2];
   pid_t fork_pid;
-  int orig_stderr;
-  ssize_t bytes_written = 0;
-  ssize_t write_res;
   ssize_t bytes_read = 0;
   ssize_t read_res;
-  int status = 0;
-  pid_t changed_pid;
+  struct pollfd pfd;
+  int poll_res;
+  double timeout = 0.0;
+  munit_uint64_t deadline;
+  munit_bool timed_out = 0;
 #endif
 
   if (params != NULL) {
     output_l = 2;
-    fputs("  ", MUNIT_OUTPUT_FILE);
+    munit_test_runner_printf(runner, "  ");
     first = 1;
     for (param = params ; param != NULL && param->name != NULL ; param++) {
       if (!first) {
-        fputs(", ", MUNIT_OUTPUT_FILE);
+        munit_test_runner_printf(runner, ", ");
         output_l += 2;
       } else {
         first = 0;
       }
 
-      output_l += fprintf(MUNIT_OUTPUT_FILE, "%s=%s", param->name, param->value);
+      output_l += munit_test_runner_printf(runner, "%s=%s", param->name, param->value);
     }
     while (output_l++ < MUNIT_TEST_NAME_LEN) {
-      fputc(' ', MUNIT_OUTPUT_FILE);
+      munit_test_runner_printf(runner, " ");
     }
   }
 
+#if !defined(MUNIT_NO_FORK)
+  if (runner->jobs > 1 || runner->pool) {
+    munit_test_runner_submit(runner, test, params);
+    return;
+  }
+#endif
+
   fflush(MUNIT_OUTPUT_FILE);
 
   stderr_buf = NULL;
@@ -1350,32 +3933,7 @@ munit_test_runner_run_test_with_params(MunitTestRunner* runner, const MunitTest*
 
     fork_pid = fork();
     if (fork_pid == 0) {
-      close(pipefd[0]);
-
-      orig_stderr = munit_replace_stderr(stderr_buf);
-      munit_test_runner_exec(runner, test, params, &report);
-
-      /* Note that we don't restore stderr.  This is so we can buffer
-       * things written to stderr later on (such as by
-       * asan/tsan/ubsan, valgrind, etc.) */
-      close(orig_stderr);
-
-      do {
-        write_res = write(pipefd[1], ((munit_uint8_t*) (&report)) + bytes_written, sizeof(report) - bytes_written);
-        if (write_res < 0) {
-          if (stderr_buf != NULL) {
-            munit_log_errno(MUNIT_LOG_ERROR, stderr, "unable to write to pipe");
-          }
-          exit(EXIT_FAILURE);
-        }
-        bytes_written += write_res;
-      } while ((size_t) bytes_written < sizeof(report));
-
-      if (stderr_buf != NULL)
-        fclose(stderr_buf);
-      close(pipefd[1]);
-
-      exit(EXIT_SUCCESS);
+      munit_test_runner_fork_child(runner, test, params, stderr_buf, pipefd);
     } else if (fork_pid == -1) {
       close(pipefd[0]);
       close(pipefd[1]);
@@ -1386,38 +3944,35 @@ munit_test_runner_run_test_with_params(MunitTestRunner* runner, const MunitTest*
       result = MUNIT_ERROR;
     } else {
       close(pipefd[1]);
+      timeout = munit_test_runner_timeout(runner, test);
+      deadline = munit_deadline_after(timeout);
       do {
-        read_res = read(pipefd[0], ((munit_uint8_t*) (&report)) + bytes_read, sizeof(report) - bytes_read);
+        pfd.fd = pipefd[0];
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        poll_res = poll(&pfd, 1, munit_deadline_poll_timeout(deadline));
+        if (poll_res < 0 && errno == EINTR)
+          continue;
+        if (poll_res < 0) {
+          /* A blocking read() could outlive the timeout */
+          munit_log_errno(MUNIT_LOG_ERROR, stderr_buf, "unable to poll child");
+          kill(fork_pid, SIGKILL);
+          break;
+        }
+        if (poll_res == 0) {
+          kill(fork_pid, SIGKILL);
+          timed_out = 1;
+          break;
+        }
+        read_res = munit_report_read(pipefd[0], &report, bytes_read);
         if (read_res < 1)
           break;
         bytes_read += read_res;
-      } while (bytes_read < (ssize_t) sizeof(report));
+      } while ((size_t) bytes_read < munit_report_wire_size(&report, bytes_read));
 
-      changed_pid = waitpid(fork_pid, &status, 0);
-
-      if (MUNIT_LIKELY(changed_pid == fork_pid) && MUNIT_LIKELY(WIFEXITED(status))) {
-        if (bytes_read != sizeof(report)) {
-          munit_logf_internal(MUNIT_LOG_ERROR, stderr_buf, "child exited unexpectedly with status %d", WEXITSTATUS(status));
-          report.errored++;
-        } else if (WEXITSTATUS(status) != EXIT_SUCCESS) {
-          munit_logf_internal(MUNIT_LOG_ERROR, stderr_buf, "child exited with status %d", WEXITSTATUS(status));
-          report.errored++;
-        }
-      } else {
-        if (WIFSIGNALED(status)) {
-#if defined(_XOPEN_VERSION) && (_XOPEN_VERSION >= 700)
-          munit_logf_internal(MUNIT_LOG_ERROR, stderr_buf, "child killed by signal %d (%s)", WTERMSIG(status), strsignal(WTERMSIG(status)));
-#else
-          munit_logf_internal(MUNIT_LOG_ERROR, stderr_buf, "child killed by signal %d", WTERMSIG(status));
-#endif
-        } else if (WIFSTOPPED(status)) {
-          munit_logf_internal(MUNIT_LOG_ERROR, stderr_buf, "child stopped by signal %d", WSTOPSIG(status));
-        }
-        report.errored++;
-      }
+      munit_test_runner_wait_child(fork_pid, bytes_read, stderr_buf, &report, timed_out ? timeout : 0.0);
 
       close(pipefd[0]);
-      waitpid(fork_pid, NULL, 0);
     }
   } else
 #endif
@@ -1449,71 +4004,12 @@ munit_test_runner_run_test_with_params(MunitTestRunner* runner, const MunitTest*
 
  print_result:
 
-  fputs("[ ", MUNIT_OUTPUT_FILE);
-  if ((test->options & MUNIT_TEST_OPTION_TODO) == MUNIT_TEST_OPTION_TODO) {
-    if (report.failed != 0 || report.errored != 0 || report.skipped != 0) {
-      munit_test_runner_print_color(runner, MUNIT_RESULT_STRING_TODO, '3');
-      result = MUNIT_OK;
-    } else {
-      munit_test_runner_print_color(runner, MUNIT_RESULT_STRING_ERROR, '1');
-      if (MUNIT_LIKELY(stderr_buf != NULL))
-        munit_log_internal(MUNIT_LOG_ERROR, stderr_buf, "Test marked TODO, but was successful.");
-      runner->report.failed++;
-      result = MUNIT_ERROR;
-    }
-  } else if (report.failed > 0) {
-    munit_test_runner_print_color(runner, MUNIT_RESULT_STRING_FAIL, '1');
-    runner->report.failed++;
-    result = MUNIT_FAIL;
-  } else if (report.errored > 0) {
-    munit_test_runner_print_color(runner, MUNIT_RESULT_STRING_ERROR, '1');
-    runner->report.errored++;
-    result = MUNIT_ERROR;
-  } else if (report.skipped > 0) {
-    munit_test_runner_print_color(runner, MUNIT_RESULT_STRING_SKIP, '3');
-    runner->report.skipped++;
-    result = MUNIT_SKIP;
-  } else if (report.successful > 1) {
-    munit_test_runner_print_color(runner, MUNIT_RESULT_STRING_OK, '2');
-#if defined(MUNIT_ENABLE_TIMING)
-    fputs(" ] [ ", MUNIT_OUTPUT_FILE);
-    munit_print_time(MUNIT_OUTPUT_FILE, report.wall_clock / report.successful);
-    fputs(" / ", MUNIT_OUTPUT_FILE);
-    munit_print_time(MUNIT_OUTPUT_FILE, report.cpu_clock / report.successful);
-    fprintf(MUNIT_OUTPUT_FILE, " CPU ]\n  %-" MUNIT_XSTRINGIFY(MUNIT_TEST_NAME_LEN) "s Total: [ ", "");
-    munit_print_time(MUNIT_OUTPUT_FILE, report.wall_clock);
-    fputs(" / ", MUNIT_OUTPUT_FILE);
-    munit_print_time(MUNIT_OUTPUT_FILE, report.cpu_clock);
-    fputs(" CPU", MUNIT_OUTPUT_FILE);
-#endif
-    runner->report.successful++;
-    result = MUNIT_OK;
-  } else if (report.successful > 0) {
-    munit_test_runner_print_color(runner, MUNIT_RESULT_STRING_OK, '2');
+  result = munit_test_runner_print_result(runner, test, &report, result, stderr_buf);
+  munit_test_runner_record(runner, runner->test_name, params, &report, result);
+  munit_test_runner_show_stderr(runner, result, stderr_buf);
 #if defined(MUNIT_ENABLE_TIMING)
-    fputs(" ] [ ", MUNIT_OUTPUT_FILE);
-    munit_print_time(MUNIT_OUTPUT_FILE, report.wall_clock);
-    fputs(" / ", MUNIT_OUTPUT_FILE);
-    munit_print_time(MUNIT_OUTPUT_FILE, report.cpu_clock);
-    fputs(" CPU", MUNIT_OUTPUT_FILE);
+  free(report.bench_sample);
 #endif
-    runner->report.successful++;
-    result = MUNIT_OK;
-  }
-  fputs(" ]\n", MUNIT_OUTPUT_FILE);
-
-  if (stderr_buf != NULL) {
-    if (result == MUNIT_FAIL || result == MUNIT_ERROR || runner->show_stderr) {
-      fflush(MUNIT_OUTPUT_FILE);
-
-      rewind(stderr_buf);
-      munit_splice(fileno(stderr_buf), STDERR_FILENO);
-
-      fflush(stderr);
-    }
-
-    fclose(stderr_buf);
-  }
 }
 
 static void
@@ -1577,13 +4073,14 @@ munit_test_runner_run_test(MunitTestRunner* runner,
 
   munit_rand_seed(runner->seed);
 
-  fprintf(MUNIT_OUTPUT_FILE, "%-" MUNIT_XSTRINGIFY(MUNIT_TEST_NAME_LEN) "s", test_name);
+  runner->test_name = test_name;
+  munit_test_runner_printf(runner, "%-" MUNIT_XSTRINGIFY(MUNIT_TEST_NAME_LEN) "s", test_name);
 
   if (test->parameters == NULL) {
     /* No parameters.  Simple, nice. */
     munit_test_runner_run_test_with_params(runner, test, NULL);
   } else {
-    fputc('\n', MUNIT_OUTPUT_FILE);
+    munit_test_runner_printf(runner, "\n");
 
     for (pe = test->parameters ; pe != NULL && pe->name != NULL ; pe++) {
       /* Did we received a value for this parameter from the CLI? */
@@ -1646,6 +4143,7 @@ munit_test_runner_run_test(MunitTestRunner* runner,
     free(wild_params);
   }
 
+  runner->test_name = NULL;
   munit_maybe_free_concat(test_name, prefix, test->name);
 }
 
@@ -1694,6 +4192,19 @@ munit_test_runner_run_suite(MunitTestRunner* runner,
 static void
 munit_test_runner_run(MunitTestRunner* runner) {
   munit_test_runner_run_suite(runner, runner->suite, NULL);
+
+#if !defined(MUNIT_NO_FORK)
+  while (runner->running > 0)
+    munit_test_runner_poll_jobs(runner);
+  munit_test_runner_flush_jobs(runner);
+  munit_test_runner_shutdown_workers(runner);
+#endif
+
+  if (runner->pending != NULL) {
+    fputs(runner->pending, MUNIT_OUTPUT_FILE);
+    free(runner->pending);
+    runner->pending = NULL;
+  }
 }
 
 static void
@@ -1725,9 +4236,55 @@ munit_print_help(int argc, char* const argv[MUNIT_ARRAY_PARAM(argc + 1)], void*
        " --no-fork Do not execute tests in a child process.  If this option is supplied\n"
        "           and a test crashes (including by failing an assertion), no further\n"
        "           tests will be performed.\n"
+       " --jobs N  Run up to N forked tests at once.  0 means the number of online\n"
+       "           CPUs.  Results are still printed in suite order.\n"
+       " --pool    Run tests in --jobs long-lived forked workers instead of forking\n"
+       "           for every test.  A worker that crashes is replaced, but tests run\n"
+       "           by the same worker share its process state.\n"
+       " --timeout SECONDS\n"
+       "           Kill a forked test still running after SECONDS and report it as\n"
+       "           an error.  munit_test_set_timeout() overrides it per test.  0\n"
+       "           means no limit (the default).  Ignored with --no-fork.\n"
 #endif
        " --fatal-failures\n"
        "           Stop executing tests as soon as a failure is found.\n"
+#if defined(MUNIT_PERF)
+       " --perf    Count cycles, instructions, cache-misses, LLC-loads, branch-misses\n"
+       "           and dTLB-misses in user space around each timed iteration and\n"
+       "           print totals and per-operation values (see munit_bench_set_ops).\n"
+       "           Counters the kernel does not allow are left out silently.\n"
+#endif
+       " --rusage  Print the max RSS, page faults and context switches of each test.\n"
+       "           Forked tests report the child's totals; with --pool or --no-fork\n"
+       "           the max RSS is the high-water mark of the whole process.  The\n"
+       "           values are always included in --output-json and --output-csv.\n"
+       " --allocs  Print the allocations, bytes allocated, peak heap growth and\n"
+       "           leaked blocks of each test, setup and tear down included.  Needs\n"
+       "           glibc and a build without sanitizers.\n"
+       " --output-json FILE\n"
+       " --output-csv FILE\n"
+       "           Also write the results to FILE: name, parameters, seed, result,\n"
+       "           iterations, wall and CPU nanoseconds and, with --bench, the\n"
+       "           per-operation statistics.  Each result is written as it finishes.\n"
+#if defined(MUNIT_ENABLE_TIMING)
+       " --bench   Benchmark each test: run --warmup untimed iterations, then time\n"
+       "           --samples iterations and print the min, median, mean, p90, p99\n"
+       "           and MAD per operation after dropping samples further than three\n"
+       "           MADs from the median.  Tests report operations per iteration with\n"
+       "           munit_bench_set_ops().  Single iteration tests run once.\n"
+       " --warmup N\n"
+       "           Untimed iterations before sampling with --bench (default 5).\n"
+       " --samples N\n"
+       "           Timed iterations with --bench (default 50, at most 1000).\n"
+       " --baseline FILE\n"
+       "           Compare --bench results with an earlier --output-json FILE,\n"
+       "           matching tests by name and parameters, and print a table of\n"
+       "           speedups and slowdowns.  A Mann-Whitney U test on the samples\n"
+       "           decides whether a change is significant (p < 0.05).\n"
+       " --max-regression PCT\n"
+       "           Exit with failure if a test in the --baseline comparison is\n"
+       "           significantly slower by more than PCT percent.\n"
+#endif
        " --show-stderr\n"
        "           Show data written to stderr by the tests, even if the test succeeds.\n"
        " --color auto|always|never\n"
@@ -1845,6 +4402,10 @@ munit_suite_main_custom(const MunitSuite* suite, void* user_data,
   unsigned long ts;
   char* endptr;
   unsigned long long iterations;
+  FILE* output_file;
+#if defined(MUNIT_ENABLE_TIMING)
+  size_t i;
+#endif
   MunitLogLevel level;
   const MunitArgument* argument;
   const char** runner_tests;
@@ -1867,6 +4428,7 @@ munit_suite_main_custom(const MunitSuite* suite, void* user_data,
 #if defined(MUNIT_ENABLE_TIMING)
   runner.report.cpu_clock = 0;
   runner.report.wall_clock = 0;
+  memset(&runner.report.bench, 0, sizeof(runner.report.bench));
 #endif
 
   runner.colorize = 0;
@@ -1877,6 +4439,37 @@ munit_suite_main_custom(const MunitSuite* suite, void* user_data,
 #endif
   runner.show_stderr = 0;
   runner.fatal_failures = 0;
+  runner.json_file = NULL;
+  runner.csv_file = NULL;
+  runner.json_first = 1;
+  runner.test_name = NULL;
+#if defined(MUNIT_ENABLE_TIMING)
+  runner.bench = 0;
+  runner.bench_warmup = 5;
+  runner.bench_samples = 50;
+  runner.baseline = NULL;
+  runner.baseline_l = 0;
+  runner.baseline_rows = NULL;
+  runner.baseline_rows_l = 0;
+  runner.max_regression = -1.0;
+#endif
+#if defined(MUNIT_PERF)
+  runner.perf = 0;
+#endif
+  runner.allocs = 0;
+  runner.rusage = 0;
+  runner.jobs = 1;
+  runner.pending = NULL;
+  runner.pending_len = 0;
+  runner.pending_cap = 0;
+#if !defined(MUNIT_NO_FORK)
+  runner.queue_head = NULL;
+  runner.queue_tail = NULL;
+  runner.running = 0;
+  runner.timeout = 0.0;
+  runner.pool = 0;
+  runner.workers = NULL;
+#endif
   runner.suite = suite;
   runner.user_data = user_data;
   runner.seed = munit_rand_generate_seed();
@@ -1961,9 +4554,137 @@ munit_suite_main_custom(const MunitSuite* suite, void* user_data,
 #if !defined(_WIN32)
       } else if (strcmp("no-fork", argv[arg] + 2) == 0) {
         runner.fork = 0;
+#endif
+#if !defined(MUNIT_NO_FORK)
+      } else if (strcmp("jobs", argv[arg] + 2) == 0) {
+        if (arg + 1 >= argc) {
+          munit_logf_internal(MUNIT_LOG_ERROR, stderr, "%s requires an argument", argv[arg]);
+          goto cleanup;
+        }
+
+        endptr = argv[arg + 1];
+        iterations = strtoul(argv[arg + 1], &endptr, 0);
+        if (*endptr != '\0' || iterations > 4096) {
+          munit_logf_internal(MUNIT_LOG_ERROR, stderr, "invalid value ('%s') passed to %s", argv[arg + 1], argv[arg]);
+          goto cleanup;
+        }
+        if (iterations == 0) {
+          ts = (unsigned long) sysconf(_SC_NPROCESSORS_ONLN);
+          iterations = (ts > 0 && ts <= 4096) ? ts : 1;
+        }
+
+        runner.jobs = (unsigned int) iterations;
+
+        arg++;
+      } else if (strcmp("pool", argv[arg] + 2) == 0) {
+        runner.pool = 1;
+      } else if (strcmp("timeout", argv[arg] + 2) == 0) {
+        if (arg + 1 >= argc) {
+          munit_logf_internal(MUNIT_LOG_ERROR, stderr, "%s requires an argument", argv[arg]);
+          goto cleanup;
+        }
+
+        runner.timeout = strtod(argv[arg + 1], &endptr);
+        if (*endptr != '\0' || endptr == argv[arg + 1] || !(runner.timeout >= 0.0)) {
+          munit_logf_internal(MUNIT_LOG_ERROR, stderr, "invalid value ('%s') passed to %s", argv[arg + 1], argv[arg]);
+          goto cleanup;
+        }
+
+        arg++;
 #endif
       } else if (strcmp("fatal-failures", argv[arg] + 2) == 0) {
         runner.fatal_failures = 1;
+#if defined(MUNIT_PERF)
+      } else if (strcmp("perf", argv[arg] + 2) == 0) {
+        runner.perf = 1;
+#endif
+      } else if (strcmp("rusage", argv[arg] + 2) == 0) {
+        runner.rusage = 1;
+      } else if (strcmp("allocs", argv[arg] + 2) == 0) {
+        if (!munit_alloc_tracking()) {
+          munit_logf_internal(MUNIT_LOG_ERROR, stderr, "%s is not available in this build", argv[arg]);
+          goto cleanup;
+        }
+        runner.allocs = 1;
+      } else if (strcmp("output-json", argv[arg] + 2) == 0 ||
+                 strcmp("output-csv", argv[arg] + 2) == 0) {
+        if (arg + 1 >= argc) {
+          munit_logf_internal(MUNIT_LOG_ERROR, stderr, "%s requires an argument", argv[arg]);
+          goto cleanup;
+        }
+
+        output_file = fopen(argv[arg + 1], "w");
+        if (output_file == NULL) {
+          munit_logf_internal(MUNIT_LOG_ERROR, stderr, "unable to open '%s' for %s: %s", argv[arg + 1], argv[arg], strerror(errno));
+          goto cleanup;
+        }
+
+        if (strcmp("output-json", argv[arg] + 2) == 0) {
+          if (runner.json_file != NULL)
+            fclose(runner.json_file);
+          runner.json_file = output_file;
+        } else {
+          if (runner.csv_file != NULL)
+            fclose(runner.csv_file);
+          runner.csv_file = output_file;
+        }
+
+        arg++;
+#if defined(MUNIT_ENABLE_TIMING)
+      } else if (strcmp("bench", argv[arg] + 2) == 0) {
+        runner.bench = 1;
+      } else if (strcmp("warmup", argv[arg] + 2) == 0 ||
+                 strcmp("samples", argv[arg] + 2) == 0) {
+        if (arg + 1 >= argc) {
+          munit_logf_internal(MUNIT_LOG_ERROR, stderr, "%s requires an argument", argv[arg]);
+          goto cleanup;
+        }
+
+        endptr = argv[arg + 1];
+        iterations = strtoul(argv[arg + 1], &endptr, 0);
+        if (*endptr != '\0' || iterations > UINT_MAX / 2 ||
+            (argv[arg][2] == 's' && (iterations == 0 || iterations > MUNIT_BENCH_SAMPLES_MAX))) {
+          munit_logf_internal(MUNIT_LOG_ERROR, stderr, "invalid value ('%s') passed to %s", argv[arg + 1], argv[arg]);
+          goto cleanup;
+        }
+
+        if (argv[arg][2] == 's')
+          runner.bench_samples = (unsigned int) iterations;
+        else
+          runner.bench_warmup = (unsigned int) iterations;
+
+        arg++;
+      } else if (strcmp("baseline", argv[arg] + 2) == 0) {
+        if (arg + 1 >= argc) {
+          munit_logf_internal(MUNIT_LOG_ERROR, stderr, "%s requires an argument", argv[arg]);
+          goto cleanup;
+        }
+
+        if (runner.baseline != NULL) {
+          munit_logf_internal(MUNIT_LOG_ERROR, stderr, "%s given more than once", argv[arg]);
+          goto cleanup;
+        }
+        if (!munit_test_runner_load_baseline(&runner, argv[arg + 1]))
+          goto cleanup;
+        /* Keep the table even if nothing in the file can be compared. */
+        if (runner.baseline == NULL)
+          runner.baseline = calloc(1, sizeof(MunitBaselineEntry));
+
+        arg++;
+      } else if (strcmp("max-regression", argv[arg] + 2) == 0) {
+        if (arg + 1 >= argc) {
+          munit_logf_internal(MUNIT_LOG_ERROR, stderr, "%s requires an argument", argv[arg]);
+          goto cleanup;
+        }
+
+        runner.max_regression = strtod(argv[arg + 1], &endptr);
+        if (*endptr != '\0' || endptr == argv[arg + 1] || !(runner.max_regression >= 0.0)) {
+          munit_logf_internal(MUNIT_LOG_ERROR, stderr, "invalid value ('%s') passed to %s", argv[arg + 1], argv[arg]);
+          goto cleanup;
+        }
+
+        arg++;
+#endif
       } else if (strcmp("log-visible", argv[arg] + 2) == 0 ||
                  strcmp("log-fatal", argv[arg] + 2) == 0) {
         if (arg + 1 >= argc) {
@@ -2020,11 +4741,37 @@ munit_suite_main_custom(const MunitSuite* suite, void* user_data,
     }
   }
 
+  /* Parallel runs need a child process per test. */
+  if (!runner.fork) {
+    runner.jobs = 1;
+#if !defined(MUNIT_NO_FORK)
+    runner.pool = 0;
+#endif
+  }
+
+  /* Headers are flushed so that forked children do not write them
+   * again when they exit. */
+  if (runner.json_file != NULL) {
+    fputc('[', runner.json_file);
+    fflush(runner.json_file);
+  }
+  if (runner.csv_file != NULL) {
+    fputs("name,params,seed,result,iterations,wall_ns,cpu_ns,"
+          "samples,outliers,ops,min_ns,median_ns,mean_ns,p90_ns,p99_ns,mad_ns,"
+          "perf_ops,cycles,instructions,cache_misses,llc_loads,branch_misses,dtlb_misses,"
+          "allocs,alloc_bytes,peak_bytes,leaked_blocks,leaked_bytes,"
+          "maxrss_kb,minor_faults,major_faults,voluntary_switches,involuntary_switches\n", runner.csv_file);
+    fflush(runner.csv_file);
+  }
+
   fflush(stderr);
   fprintf(MUNIT_OUTPUT_FILE, "Running test suite with seed 0x%08" PRIx32 "...\n", runner.seed);
 
   munit_test_runner_run(&runner);
 
+  if (runner.json_file != NULL)
+    fputs(runner.json_first ? "]\n" : "\n]\n", runner.json_file);
+
   tests_run = runner.report.successful + runner.report.failed + runner.report.errored;
   tests_total = tests_run + runner.report.skipped;
   if (tests_run == 0) {
@@ -2041,9 +4788,30 @@ munit_suite_main_custom(const MunitSuite* suite, void* user_data,
     result = EXIT_SUCCESS;
   }
 
+#if defined(MUNIT_ENABLE_TIMING)
+  if (munit_test_runner_print_baseline(&runner) > 0)
+    result = EXIT_FAILURE;
+#endif
+
  cleanup:
   free(runner.parameters);
   free((void*) runner.tests);
+  free(runner.pending);
+  if (runner.json_file != NULL)
+    fclose(runner.json_file);
+  if (runner.csv_file != NULL)
+    fclose(runner.csv_file);
+#if defined(MUNIT_ENABLE_TIMING)
+  for (i = 0 ; i < runner.baseline_l ; i++)
+    munit_baseline_entry_free(&runner.baseline[i]);
+  free(runner.baseline);
+  for (i = 0 ; i < runner.baseline_rows_l ; i++)
+    free(runner.baseline_rows[i].name);
+  free(runner.baseline_rows);
+#endif
+  free(munit_test_timeouts);
+  munit_test_timeouts = NULL;
+  munit_test_timeouts_l = 0;
 
   return result;
 }
@@ -392,6 +392,68 @@ void* munit_malloc_ex(const char* filename, int line, size_t size);
 #define munit_newa(type, nmemb) \
   ((type*) munit_calloc((nmemb), sizeof(type)))
 
+/*** Allocation tracking ***/
+
+typedef struct {
+  /* Calls to malloc, calloc, realloc and the aligned variants */
+  munit_uint64_t count;
+  /* Bytes requested by those calls */
+  munit_uint64_t bytes;
+  /* Highest heap growth, in usable bytes */
+  munit_uint64_t peak;
+} MunitAllocStats;
+
+/* Nonzero if munit counts allocations in this build (glibc, no
+ * sanitizers). */
+int munit_alloc_tracking(void);
+/* Allocations of the running test since the last call to
+ * munit_alloc_reset(), or since its setup finished with --allocs.
+ * Without --allocs nothing is counted until the test calls
+ * munit_alloc_reset(), so allocation-free runs stay cheap.  All zero
+ * without tracking. */
+MunitAllocStats munit_alloc_stats(void);
+void munit_alloc_reset(void);
+/* Nonzero if allocations of the running test are being counted. */
+int munit_alloc_counting(void);
+
+/* The allocation assertions need counting to be on: call
+ * munit_alloc_reset() in the test first or run with --allocs.
+ * Otherwise they fail instead of comparing zeros.  In builds without
+ * tracking they always pass. */
+#define munit_assert_alloc_counting_() \
+  do { \
+    if (munit_alloc_tracking() && !munit_alloc_counting()) \
+      munit_error("allocations are not counted; call munit_alloc_reset() or run with --allocs"); \
+    MUNIT_PUSH_DISABLE_MSVC_C4127_ \
+  } while (0) \
+  MUNIT_POP_DISABLE_MSVC_C4127_
+
+#define munit_assert_allocs_le(n) \
+  do { \
+    munit_uint64_t munit_tmp_allocs_; \
+    munit_assert_alloc_counting_(); \
+    munit_tmp_allocs_ = munit_alloc_stats().count; \
+    if (!(munit_tmp_allocs_ <= (munit_uint64_t) (n))) { \
+      munit_errorf("assertion failed: allocations <= %s (%" PRIu64 " <= %" PRIu64 ")", \
+                   #n, munit_tmp_allocs_, (munit_uint64_t) (n)); \
+    } \
+    MUNIT_PUSH_DISABLE_MSVC_C4127_ \
+  } while (0) \
+  MUNIT_POP_DISABLE_MSVC_C4127_
+
+#define munit_assert_alloc_bytes_le(n) \
+  do { \
+    munit_uint64_t munit_tmp_bytes_; \
+    munit_assert_alloc_counting_(); \
+    munit_tmp_bytes_ = munit_alloc_stats().bytes; \
+    if (!(munit_tmp_bytes_ <= (munit_uint64_t) (n))) { \
+      munit_errorf("assertion failed: allocated bytes <= %s (%" PRIu64 " <= %" PRIu64 ")", \
+                   #n, munit_tmp_bytes_, (munit_uint64_t) (n)); \
+    } \
+    MUNIT_PUSH_DISABLE_MSVC_C4127_ \
+  } while (0) \
+  MUNIT_POP_DISABLE_MSVC_C4127_
+
 /*** Random number generation ***/
 
 void munit_rand_seed(munit_uint32_t seed);
@@ -400,6 +462,18 @@ int munit_rand_int_range(int min, int max);
 double munit_rand_double(void);
 void munit_rand_memory(size_t size, munit_uint8_t buffer[MUNIT_ARRAY_PARAM(size)]);
 
+/* Fast generator for bulk data: xoshiro256** with per-thread state
+ * and no atomics.  It is reseeded by munit_rand_seed, so results are
+ * reproducible with --seed as long as threads draw from it in the
+ * same order.  Fill functions run four independent lanes the
+ * compiler can keep in SIMD registers.  Floats are uniform between
+ * min and max with 24 random bits each; fill_float2 fills n (x, y)
+ * pairs, e.g. an array of raylib Vector2 cast to float*. */
+munit_uint64_t munit_rand_fast_uint64(void);
+void munit_rand_fill_uint32(size_t n, munit_uint32_t values[MUNIT_ARRAY_PARAM(n)]);
+void munit_rand_fill_float(size_t n, float values[MUNIT_ARRAY_PARAM(n)], float min, float max);
+void munit_rand_fill_float2(size_t n, float values[], float x_min, float x_max, float y_min, float y_max);
+
 /*** Tests and Suites ***/
 
 typedef enum {
@@ -462,6 +536,16 @@ struct MunitSuite_ {
 
 int munit_suite_main(const MunitSuite* suite, void* user_data, int argc, char* const argv[MUNIT_ARRAY_PARAM(argc + 1)]);
 
+/* Number of operations one iteration of the current test performs;
+ * --bench reports time per operation.  Defaults to 1 per iteration. */
+void munit_bench_set_ops(munit_uint64_t ops);
+
+/* Seconds before the forked test is killed and reported as an error,
+ * overriding --timeout; 0 drops the override.  Call before
+ * munit_suite_main(), which forgets all overrides when it returns.
+ * Kept outside MunitTest so existing test tables stay complete. */
+void munit_test_set_timeout(const MunitTest* test, double seconds);
+
 /* Note: I'm not very happy with this API; it's likely to change if I
  * figure out something better.  Suggestions welcome. */
 
@@ -1,23 +1,45 @@
 // vim: set colorcolumn=85
 // vim: fdm=marker
 
+#include "koh_bitset.h"
 #include "koh_destral_ecs.h"
+#include "koh_key_norm.h"
+#include "koh_map.h"
+#include "koh_multiset.h"
+#include "koh_ordered_set.h"
+#include "koh_point_set.h"
+#include "koh_rect_index.h"
+#include "koh_roaring.h"
 #include "koh_set.h"
+#include "koh_set_filter.h"
+#include "koh_set_mapped.h"
+#include "koh_set_stream.h"
+#include "koh_sparse_set.h"
+#include "koh_strintern.h"
 #include "munit.h"
 #include "raylib.h"
 #include <assert.h>
 #include <math.h>
 #include <memory.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "koh_common.h"
 #include "koh_metaloader.h"
 
 static const bool verbose = false;
 
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 struct Vectors {
     Vector2 *vecs;
     int     num;
@@ -59,6 +81,132 @@ static koh_SetAction iter_each(const void *key, int key_len, void *udata) {
     return koh_SA_next;
 }
 
+static MunitResult test_filter_add_exist_remove(
+    const MunitParameter params[], void* data
+) {
+    Vector2 vecs[] = {
+        { 1.,    0. },
+        { 12.,   0. },
+        { 0.1,   0. },
+        { 1.3, -0.1 },
+        { 0.,   0.5 },
+        { 14,    0. },
+    };
+
+    Vector2 other_vecs[] = {
+        { -1.,   0. },
+        { 12.,  NAN },
+        { 0.1,  0.1 },
+        { 1.3,  0.1 },
+        { 0.,  0.51 },
+        { -14,   0. },
+    };
+
+    int vecs_num = sizeof(vecs) / sizeof(vecs[0]);
+    int other_vecs_num = sizeof(other_vecs) / sizeof(other_vecs[0]);
+
+    koh_Set *set = set_new();
+    set_add(set, &vecs[0], sizeof(vecs[0]));
+    koh_SetFilter *f = set_filter_new(set, 0);
+    munit_assert_ptr_not_null(f);
+
+    for (int i = 1; i < vecs_num; ++i) {
+        munit_assert(set_filter_add(f, &vecs[i], sizeof(vecs[0])));
+    }
+    munit_assert_false(set_filter_add(f, &vecs[1], sizeof(vecs[0])));
+
+    for (int i = 0; i < vecs_num; ++i) {
+        munit_assert(set_filter_exist(f, &vecs[i], sizeof(vecs[0])));
+    }
+    for (int i = 0; i < other_vecs_num; ++i) {
+        munit_assert(!set_filter_exist(f, &other_vecs[i], sizeof(vecs[0])));
+    }
+
+    for (int i = 0; i < vecs_num; i += 2) {
+        munit_assert(set_filter_remove(f, &vecs[i], sizeof(vecs[0])));
+    }
+    for (int i = 0; i < vecs_num; ++i) {
+        bool exist = set_filter_exist(f, &vecs[i], sizeof(vecs[0]));
+        munit_assert(exist == (i % 2 == 1));
+    }
+    munit_assert_int(set_size(set_filter_set(f)), ==, vecs_num / 2);
+
+    // Рост: ключей больше, чем рассчитан начальный массив.
+    for (int i = 0; i < 10000; ++i) {
+        Vector2 v = { i, -i };
+        set_filter_add(f, &v, sizeof(v));
+    }
+    for (int i = 0; i < 10000; ++i) {
+        Vector2 v = { i, -i };
+        munit_assert(set_filter_exist(f, &v, sizeof(v)));
+    }
+
+    set_filter_clear(f);
+    munit_assert(!set_filter_exist(f, &vecs[1], sizeof(vecs[0])));
+
+    set_filter_free(f);
+    set_free(set);
+    return MUNIT_OK;
+}
+
+// В работе большинство запросов - промахи, как в other_vecs.
+static MunitResult test_bench_filter(
+    const MunitParameter params[], void* data
+) {
+    const int num = 100000, queries = 1000000;
+
+    koh_Set *plain = set_new();
+    koh_Set *filtered_set = set_new();
+    koh_SetFilter *f = set_filter_new(filtered_set, 0);
+    for (uint32_t i = 0; i < num; i++) {
+        uint64_t id = i * 0x9e3779b97f4a7c15ULL;
+        set_add(plain, &id, sizeof(id));
+        set_filter_add(f, &id, sizeof(id));
+    }
+
+    // [0] - попадания, [1] - промахи
+    double t_plain[2], t_filter[2];
+    for (int miss = 0; miss < 2; miss++) {
+        int found_plain = 0, found_filter = 0;
+
+        double t0 = bench_now();
+        for (uint32_t i = 0; i < queries; i++) {
+            uint64_t id = (i % num + miss * num) * 0x9e3779b97f4a7c15ULL;
+            found_plain += set_exist(plain, &id, sizeof(id));
+        }
+        t_plain[miss] = bench_now() - t0;
+
+        t0 = bench_now();
+        for (uint32_t i = 0; i < queries; i++) {
+            uint64_t id = (i % num + miss * num) * 0x9e3779b97f4a7c15ULL;
+            found_filter += set_filter_exist(f, &id, sizeof(id));
+        }
+        t_filter[miss] = bench_now() - t0;
+
+        munit_assert_int(found_plain, ==, found_filter);
+        munit_assert_int(found_filter, ==, miss ? 0 : queries);
+    }
+
+    struct koh_SetFilterStats stats = set_filter_stats(f);
+    munit_logf(
+        MUNIT_LOG_INFO,
+        "%d keys, %d queries: hits set_exist %.1f ns, filter %.1f ns (%.2fx); "
+        "misses set_exist %.1f ns, filter %.1f ns (%.2fx); "
+        "false positive %.3f%%",
+        num, queries,
+        t_plain[0] * 1e9 / queries, t_filter[0] * 1e9 / queries,
+        t_plain[0] / t_filter[0],
+        t_plain[1] * 1e9 / queries, t_filter[1] * 1e9 / queries,
+        t_plain[1] / t_filter[1],
+        100. * stats.false_positives / queries
+    );
+
+    set_filter_free(f);
+    set_free(filtered_set);
+    set_free(plain);
+    return MUNIT_OK;
+}
+
 static MunitResult test_each(
     const MunitParameter params[], void* data
 ) {
@@ -204,6 +352,132 @@ static MunitResult test_each_view(
     return MUNIT_OK;
 }
 
+static int cmp_int(const void *a, const void *b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+static void test_oset_int_arr(const int *arr, int arr_len) {
+    koh_OrderedSet *oset = oset_new(sizeof(int), oset_cmp_int);
+
+    for (int j = 0; j < arr_len; ++j) {
+        munit_assert(oset_add(oset, &arr[j], sizeof(int)));
+        munit_assert_false(oset_add(oset, &arr[j], sizeof(int)));
+    }
+    munit_assert_int(oset_size(oset), ==, arr_len);
+
+    int sorted[arr_len + 1];
+    if (arr_len) {
+        memcpy(sorted, arr, sizeof(int) * arr_len);
+        qsort(sorted, arr_len, sizeof(int), cmp_int);
+    }
+
+    int i = 0;
+    for (struct koh_OrderedSetView v = oset_each_begin(oset);
+            oset_each_valid(&v); oset_each_next(&v)) {
+        munit_assert_int(oset_each_key_len(&v), ==, sizeof(int));
+        munit_assert_int(i, <, arr_len);
+        munit_assert_int(*(const int*)oset_each_key(&v), ==, sorted[i++]);
+    }
+    munit_assert_int(i, ==, arr_len);
+
+    if (arr_len) {
+        munit_assert_int(*(const int*)oset_min(oset), ==, sorted[0]);
+        munit_assert_int(*(const int*)oset_max(oset), ==, sorted[arr_len - 1]);
+    } else {
+        munit_assert_ptr_null(oset_min(oset));
+    }
+
+    oset_free(oset);
+}
+
+// Сверка выборки [lo, hi) с полным перебором.
+static void oset_check_range(
+    koh_OrderedSet *oset, const bool *present, int min, int max, int lo, int hi
+) {
+    struct koh_OrderedSetView v = oset_range(oset, &lo, &hi);
+    for (int k = lo; k < hi; k++) {
+        if (k < min || k >= max || !present[k - min])
+            continue;
+        munit_assert(oset_each_valid(&v));
+        munit_assert_int(*(const int*)oset_each_key(&v), ==, k);
+        oset_each_next(&v);
+    }
+    munit_assert_false(oset_each_valid(&v));
+}
+
+static MunitResult test_oset_range(
+    const MunitParameter params[], void* data
+) {
+    {
+        int arr1[] = { 0, 1, 2, 3, 4, 5};
+        test_oset_int_arr(arr1, sizeof(arr1) / sizeof(arr1[0]));
+    }
+
+    {
+        int arr2[] = { -5, 5, -6, 6,};
+        test_oset_int_arr(arr2, sizeof(arr2) / sizeof(arr2[0]));
+    }
+
+    {
+        int arr3[] = { 111 };
+        test_oset_int_arr(arr3, sizeof(arr3) / sizeof(arr3[0]));
+    }
+
+    test_oset_int_arr(NULL, 0);
+
+    // Много ключей - деление и слияние блоков.
+    enum { MIN = -20000, MAX = 20000, };
+    static bool present[MAX - MIN];
+    memset(present, 0, sizeof(present));
+
+    koh_OrderedSet *oset = oset_new(sizeof(int), oset_cmp_int);
+    int num = 0;
+    for (int n = 0; n < 60000; n++) {
+        int k = munit_rand_int_range(MIN, MAX - 1);
+        bool added = oset_add(oset, &k, sizeof(k));
+        munit_assert(added == !present[k - MIN]);
+        num += added;
+        present[k - MIN] = true;
+    }
+    for (int n = 0; n < 40000; n++) {
+        int k = munit_rand_int_range(MIN, MAX - 1);
+        bool removed = oset_remove(oset, &k, sizeof(k));
+        munit_assert(removed == present[k - MIN]);
+        num -= removed;
+        present[k - MIN] = false;
+    }
+    munit_assert_int(oset_size(oset), ==, num);
+    for (int k = MIN; k < MAX; k++)
+        munit_assert(oset_exist(oset, &k, sizeof(k)) == present[k - MIN]);
+
+    oset_check_range(oset, present, MIN, MAX, -5, 6);
+    oset_check_range(oset, present, MIN, MAX, MIN - 10, MIN + 100);
+    oset_check_range(oset, present, MIN, MAX, MAX - 300, MAX + 10);
+    oset_check_range(oset, present, MIN, MAX, 100, 100);
+    oset_check_range(oset, present, MIN, MAX, 100, -100);
+    for (int n = 0; n < 100; n++) {
+        int lo = munit_rand_int_range(MIN, MAX);
+        oset_check_range(oset, present, MIN, MAX, lo, lo + n * 50);
+    }
+
+    int k = 7;
+    struct koh_OrderedSetView v = oset_upper_bound(oset, &k);
+    if (oset_each_valid(&v))
+        munit_assert_int(*(const int*)oset_each_key(&v), >, k);
+    v = oset_lower_bound(oset, &k);
+    if (oset_each_valid(&v))
+        munit_assert_int(*(const int*)oset_each_key(&v), >=, k);
+
+    oset_clear(oset);
+    munit_assert_int(oset_size(oset), ==, 0);
+    v = oset_each_begin(oset);
+    munit_assert_false(oset_each_valid(&v));
+
+    oset_free(oset);
+    return MUNIT_OK;
+}
+
 static MunitResult test_compare_1(
     const MunitParameter params[], void* data
 ) {
@@ -259,6 +533,181 @@ static MunitResult test_compare_1(
     return MUNIT_OK;
 }
 
+struct RadiusCtx {
+    Vector2 center;
+    float   radius;
+    int     num;
+};
+
+static koh_SetAction iter_pset_radius(Vector2 p, void *udata) {
+    struct RadiusCtx *ctx = udata;
+    float dx = p.x - ctx->center.x, dy = p.y - ctx->center.y;
+    munit_assert_float(dx * dx + dy * dy, <=, ctx->radius * ctx->radius);
+    ctx->num++;
+    return koh_SA_next;
+}
+
+static MunitResult test_pset_eps_radius(
+    const MunitParameter params[], void* data
+) {
+    Vector2 vecs[] = {
+        { 1.,    0. },
+        { 12.,   0. },
+        { 0.1,   0. },
+        { 1.3, -0.1 },
+        { 0.,   0.5 },
+        { 14,    0. },
+    };
+    int vecs_num = sizeof(vecs) / sizeof(vecs[0]);
+
+    koh_PointSet *pset = pset_new(1e-4);
+    for (int i = 0; i < vecs_num; ++i)
+        munit_assert(pset_add(pset, vecs[i]));
+    munit_assert_int(pset_size(pset), ==, vecs_num);
+
+    // Побайтово разные, но в пределах eps.
+    munit_assert_false(pset_add(pset, (Vector2) { 1., 1e-7 }));
+    munit_assert(pset_exist(pset, (Vector2) { 1., 1e-7 }));
+    munit_assert(pset_exist(pset, (Vector2) { -0., 0.5 }));
+    munit_assert(pset_exist(pset, (Vector2) { 0.1 + 5e-5, -5e-5 }));
+    munit_assert_false(pset_exist(pset, (Vector2) { 0.1, 0.1 }));
+
+    munit_assert_false(pset_add(pset, (Vector2) { 12., NAN }));
+    munit_assert_false(pset_exist(pset, (Vector2) { 12., NAN }));
+    munit_assert_false(pset_add(pset, (Vector2) { INFINITY, 0. }));
+
+    Vector2 found;
+    munit_assert(pset_find(pset, (Vector2) { 14. + 1e-5, 0. }, &found));
+    munit_assert_float(found.x, ==, 14.f);
+
+    munit_assert(pset_remove(pset, (Vector2) { 12. - 1e-6, 0. }));
+    munit_assert_false(pset_exist(pset, vecs[1]));
+    munit_assert_int(pset_size(pset), ==, vecs_num - 1);
+    munit_assert(pset_add(pset, vecs[1]));
+
+    // Выборка по радиусу против перебора.
+    pset_clear(pset);
+    munit_assert_int(pset_size(pset), ==, 0);
+    pset_free(pset);
+
+    pset = pset_new(0.5);
+    enum { POINTS = 5000, };
+    static Vector2 points[POINTS];
+    int points_num = 0;
+    for (int i = 0; i < POINTS; i++) {
+        Vector2 p = {
+            munit_rand_double() * 200. - 100.,
+            munit_rand_double() * 200. - 100.,
+        };
+        if (pset_add(pset, p))
+            points[points_num++] = p;
+    }
+    munit_assert_int(pset_size(pset), ==, points_num);
+
+    float radii[] = { 0., 0.3, 2., 17.5, 500., };
+    for (size_t r = 0; r < sizeof(radii) / sizeof(radii[0]); r++) {
+        struct RadiusCtx ctx = {
+            .center = { munit_rand_double() * 100., -3. },
+            .radius = radii[r],
+        };
+        pset_query_radius(pset, ctx.center, ctx.radius, iter_pset_radius, &ctx);
+
+        int expected = 0;
+        for (int i = 0; i < points_num; i++) {
+            float dx = points[i].x - ctx.center.x;
+            float dy = points[i].y - ctx.center.y;
+            expected += dx * dx + dy * dy <= ctx.radius * ctx.radius;
+        }
+        munit_assert_int(ctx.num, ==, expected);
+    }
+
+    pset_free(pset);
+    return MUNIT_OK;
+}
+
+static float float_from_bits(uint32_t bits) {
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+struct PaddedKey {
+    uint8_t tag;        // за ним 7 байт выравнивания
+    double  weight;
+    Vector2 pos;
+    int     id;         // за ним 4 байта выравнивания
+};
+
+static MunitResult test_key_norm_float_keys(
+    const MunitParameter params[], void* data
+) {
+    koh_KeyNorm *vec_norm = key_norm_new(sizeof(Vector2));
+    key_norm_float(vec_norm, 0, 2);
+
+    // Разные полезные нагрузки NAN и знак нуля.
+    Vector2 a = { 12., float_from_bits(0x7fc00001) };
+    Vector2 b = { 12., float_from_bits(0xffc12345) };
+    Vector2 zero = { 0., 0.5 }, neg_zero = { -0., 0.5 };
+    munit_assert(memcmp(&a, &b, sizeof(a)));
+    munit_assert(memcmp(&zero, &neg_zero, sizeof(zero)));
+
+    koh_Set *set = set_new();
+    munit_assert(set_add_norm(set, vec_norm, &a, sizeof(a)));
+    munit_assert_false(set_add_norm(set, vec_norm, &b, sizeof(b)));
+    munit_assert(set_add_norm(set, vec_norm, &zero, sizeof(zero)));
+    munit_assert(set_exist_norm(set, vec_norm, &neg_zero, sizeof(neg_zero)));
+    munit_assert_int(set_size(set), ==, 2);
+    munit_assert(set_remove_norm(set, vec_norm, &neg_zero, sizeof(neg_zero)));
+    munit_assert_int(set_size(set), ==, 1);
+
+    // Обычные значения не меняются.
+    Vector2 plain = { 1.3, -0.1 }, plain_norm;
+    key_norm_apply(vec_norm, &plain_norm, &plain);
+    munit_assert_memory_equal(sizeof(plain), &plain, &plain_norm);
+    set_free(set);
+
+    // Поля float и double, мусор в выравнивании.
+    koh_KeyNorm *norm = key_norm_new(sizeof(struct PaddedKey));
+    key_norm_padding(norm, 1, offsetof(struct PaddedKey, weight) - 1);
+    key_norm_double(norm, offsetof(struct PaddedKey, weight), 1);
+    key_norm_float(norm, offsetof(struct PaddedKey, pos), 2);
+    size_t id_end = offsetof(struct PaddedKey, id) + sizeof(int);
+    key_norm_padding(norm, id_end, sizeof(struct PaddedKey) - id_end);
+
+    struct PaddedKey k1, k2;
+    memset(&k1, 0xaa, sizeof(k1));
+    memset(&k2, 0x55, sizeof(k2));
+    k1.tag = k2.tag = 7;
+    k1.id = k2.id = 42;
+    k1.weight = 0.;
+    k2.weight = -0.;
+    k1.pos = (Vector2) { -0., NAN };
+    k2.pos = (Vector2) { 0., float_from_bits(0xff800001) };
+
+    koh_Map *map = map_new(&(struct koh_MapSetup) {
+        .key_size = sizeof(struct PaddedKey),
+        .value_size = sizeof(int),
+        .normalize = key_norm_hook,
+        .normalize_udata = norm,
+    });
+    int value = 1;
+    map_add(map, &k1, sizeof(k1), &value);
+    munit_assert_ptr_not_null(map_get(map, &k2, sizeof(k2)));
+    bool created = true;
+    map_upsert(map, &k2, sizeof(k2), &created);
+    munit_assert_false(created);
+    munit_assert_int(map_size(map), ==, 1);
+
+    k2.weight = NAN;
+    munit_assert_ptr_null(map_get(map, &k2, sizeof(k2)));
+    munit_assert(map_remove(map, &k1, sizeof(k1)));
+
+    map_free(map);
+    key_norm_free(norm);
+    key_norm_free(vec_norm);
+    return MUNIT_OK;
+}
+
 struct MetaObject {
     Rectangle   rect;
     char        name[128];
@@ -468,296 +917,1902 @@ static MunitResult test_compare_2_eq(
     return MUNIT_OK;
 }
 
-struct TestAddRemoveCtx {
-    int     *examples;
-    int     examples_num;
-    int     examples_remove_value;
-    bool    examples_remove_value_found;
-    koh_Set *set;
-};
+static char *mapped_tmp_path(char *path, size_t path_len) {
+    snprintf(path, path_len, "/tmp/set_test_XXXXXX");
+    int fd = mkstemp(path);
+    munit_assert_int(fd, !=, -1);
+    close(fd);
+    return path;
+}
 
-static koh_SetAction iter_set_remove_by_value(
-    const void *key, int key_len, void *udata
+static MunitResult test_compare_2_eq_mapped(
+    const MunitParameter params[], void* data
 ) {
-    const int *key_value = key;
+    koh_Set *set1 = control_set_alloc((struct MetaLoaderObjects) {
+        .names = { 
+            "wheel1", "mine"  , "wheel2", "wheel3", "wheel4", "wheel5", 
+        },
+        .rects = {
+            { 0, 0, 100, 100, },
+            { 2156, 264, 407, 418 },
+            { 2, 20, 43, 43, },
+            { 2000, 20, 43, 43, },
+            { -20, 20, 43, 43, },
+            { 0, 0, 0, 0},
+        },
+        .num = 6,
+    });
 
-    if (!udata) {
-        fprintf(stderr, "iter_set_check: udata == NULL\n");
-        koh_trap();
-    }
+    char path[64];
+    mapped_tmp_path(path, sizeof(path));
+    munit_assert(set_save(set1, path));
 
-    struct TestAddRemoveCtx *ctx = udata;
+    koh_SetMapped *mapped = set_open_mapped(path);
+    munit_assert_ptr_not_null(mapped);
+    munit_assert_int(set_mapped_size(mapped), ==, set_size(set1));
 
-    if (*key_value == ctx->examples_remove_value) {
-        /*printf("iter_set_remove: found key %d\n", *key_value);*/
-        ctx->examples_remove_value_found = true;
-        return koh_SA_remove_break;
+    for (struct koh_SetView v = set_each_begin(set1);
+            set_each_valid(&v); set_each_next(&v)) {
+        munit_assert(set_mapped_exist(
+            mapped, set_each_key(&v), set_each_key_len(&v)
+        ));
     }
-    return koh_SA_next;
-}
 
-static koh_SetAction iter_set_check(
-    const void *key, int key_len, void *udata
-) {
-    const int *key_value = key;
-    if (!udata) {
-        fprintf(stderr, "iter_set_check: udata == NULL\n");
-        koh_trap();
-    }
+    struct MetaObject absent = { .rect = { 0, 0.01, 0, 0 }, };
+    strcpy(absent.name, "wheel5");
+    munit_assert_false(set_mapped_exist(mapped, &absent, sizeof(absent)));
 
-    struct TestAddRemoveCtx *ctx = udata;
-    for (int i = 0; i < ctx->examples_num; ++i) {
-        if (ctx->examples[i] == *key_value) {
-            //printf("iter_set_check: found %d\n", *key_value);
-            return koh_SA_next;
-        }
-    }
+    koh_Set *set2 = set_mapped_to_set(mapped);
+    munit_assert(set_compare(set1, set2));
 
-    if (verbose)
-        printf("iter_set_remove: key_value = %d not found\n", *key_value);
-    munit_assert(false);
-    return koh_SA_next;
+    set_mapped_close(mapped);
+    unlink(path);
+    set_free(set1);
+    set_free(set2);
+
+    return MUNIT_OK;
 }
 
-static MunitResult test_add_remove(
+static MunitResult test_mapped_empty_and_corrupt(
     const MunitParameter params[], void* data
 ) {
-    int examples[] = {
-        1, 3, 4, 5, 6, 7, 8, 9, 10, 11, 20, 23, 24
-    };
-    koh_Set *set = set_new();
+    char path[64];
+    mapped_tmp_path(path, sizeof(path));
+
+    koh_Set *empty = set_new();
+    munit_assert(set_save(empty, path));
+    koh_SetMapped *mapped = set_open_mapped(path);
+    munit_assert_ptr_not_null(mapped);
+    munit_assert_int(set_mapped_size(mapped), ==, 0);
+    int key = 1;
+    munit_assert_false(set_mapped_exist(mapped, &key, sizeof(key)));
+    struct koh_SetMappedView v = set_mapped_each_begin(mapped);
+    munit_assert_false(set_mapped_each_valid(&v));
+    set_mapped_close(mapped);
+    set_free(empty);
+
+    // Обрезанный файл не должен открываться.
+    munit_assert_int(truncate(path, 16), ==, 0);
+    munit_assert_ptr_null(set_open_mapped(path));
+
+    unlink(path);
+    return MUNIT_OK;
+}
 
-    int examples_num = sizeof(examples) / sizeof(examples[0]);
-    struct TestAddRemoveCtx ctx = {
-        .examples = calloc(sizeof(int), examples_num * 2),
-        .examples_num = examples_num,
-    };
-    assert(ctx.examples);
-    memcpy(ctx.examples, examples, sizeof(int) * examples_num);
+// Холодный старт: заполнение set_add против отображения готового файла.
+static MunitResult test_bench_mapped_startup(
+    const MunitParameter params[], void* data
+) {
+    const int num = 200000;
+    char path[64];
+    mapped_tmp_path(path, sizeof(path));
 
-    for (int i = 0; i < examples_num; i++) {
-        set_add(set, &examples[i], sizeof(int));
+    double t0 = bench_now();
+    koh_Set *set = set_new();
+    for (uint32_t i = 0; i < num; i++) {
+        uint64_t asset_id = i * 0x9e3779b97f4a7c15ULL;
+        set_add(set, &asset_id, sizeof(asset_id));
     }
+    double t_build = bench_now() - t0;
 
-    set_each(set, iter_set_check, &ctx);
-
-    set_remove(set, &ctx.examples[0], sizeof(int));
-    ctx.examples[0] = 0;
-
-    set_remove(set, &ctx.examples[1], sizeof(int));
-    ctx.examples[1] = 0;
+    munit_assert(set_save(set, path));
 
-    set_each(set, iter_set_check, &ctx);
+    t0 = bench_now();
+    koh_SetMapped *mapped = set_open_mapped(path);
+    double t_open = bench_now() - t0;
+    munit_assert_ptr_not_null(mapped);
 
-    ctx.examples[ctx.examples_num++] = 101;
-    set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
+    t0 = bench_now();
+    for (uint32_t i = 0; i < num; i++) {
+        uint64_t asset_id = i * 0x9e3779b97f4a7c15ULL;
+        munit_assert(set_mapped_exist(mapped, &asset_id, sizeof(asset_id)));
+    }
+    double t_exist = bench_now() - t0;
 
-    ctx.examples[ctx.examples_num++] = 102;
-    set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
+    munit_logf(
+        MUNIT_LOG_INFO,
+        "%d keys: set_add build %.3f ms, set_open_mapped %.3f ms, "
+        "first pass set_mapped_exist %.3f ms",
+        num, t_build * 1e3, t_open * 1e3, t_exist * 1e3
+    );
 
-    ctx.examples[ctx.examples_num++] = 103;
-    set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
+    set_mapped_close(mapped);
+    unlink(path);
+    set_free(set);
+    return MUNIT_OK;
+}
 
-    ctx.examples[ctx.examples_num++] = 104;
-    set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
+struct MemStream {
+    uint8_t *data;
+    size_t  len, cap, pos;
+    size_t  read_limit;     // если не 0, то read() отдает не больше
+};
 
-    ctx.examples[ctx.examples_num++] = 105;
-    set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
+static bool mem_stream_write(const void *data, size_t len, void *udata) {
+    struct MemStream *ms = udata;
+    if (ms->len + len > ms->cap) {
+        size_t cap = ms->cap ? ms->cap : 256;
+        while (cap < ms->len + len)
+            cap *= 2;
+        void *new_data = realloc(ms->data, cap);
+        if (!new_data)
+            return false;
+        ms->data = new_data;
+        ms->cap = cap;
+    }
+    memcpy(ms->data + ms->len, data, len);
+    ms->len += len;
+    return true;
+}
 
-    set_each(set, iter_set_check, &ctx);
+static size_t mem_stream_read(void *data, size_t len, void *udata) {
+    struct MemStream *ms = udata;
+    if (ms->read_limit && len > ms->read_limit)
+        len = ms->read_limit;
+    if (len > ms->len - ms->pos)
+        len = ms->len - ms->pos;
+    memcpy(data, ms->data + ms->pos, len);
+    ms->pos += len;
+    return len;
+}
 
-    set_remove(set, &ctx.examples[5], sizeof(int));
-    ctx.examples[5] = 0;
+static void stream_roundtrip(koh_Set *set, size_t read_limit) {
+    struct MemStream ms = { .read_limit = read_limit, };
+    munit_assert(set_write_stream(set, mem_stream_write, &ms));
+
+    koh_Set *copy = set_new();
+    int64_t num = set_read_stream(copy, mem_stream_read, &ms);
+    munit_assert_int64(num, ==, set_size(set));
+    munit_assert(set_compare(set, copy));
+    set_free(copy);
+
+    // Оборванный поток не принимается.
+    if (ms.len > 0) {
+        ms.len--;
+        ms.pos = 0;
+        copy = set_new();
+        munit_assert_int64(set_read_stream(copy, mem_stream_read, &ms), ==, -1);
+        set_free(copy);
+    }
 
-    set_remove(set, &ctx.examples[5], sizeof(int));
-    ctx.examples[5] = 0;
+    free(ms.data);
+}
 
-    set_each(set, iter_set_check, &ctx);
+static MunitResult test_stream_roundtrip(
+    const MunitParameter params[], void* data
+) {
+    // Ключи одной длины - упакованный массив.
+    koh_Set *ints = set_new();
+    for (int i = -50; i < 1000; i += 3)
+        set_add(ints, &i, sizeof(i));
+    stream_roundtrip(ints, 0);
+    stream_roundtrip(ints, 7);
+    set_free(ints);
+
+    // Ключи разной длины - varint длины.
+    koh_Set *names = control_set_alloc((struct MetaLoaderObjects) {
+        .names = { "wheel1", "mine", },
+        .rects = { { 0, 0, 100, 100, }, { 2156, 264, 407, 418 }, },
+        .num = 2,
+    });
+    const char *strs[] = { "a", "", "wheel2", "mine", };
+    for (size_t i = 0; i < sizeof(strs) / sizeof(strs[0]); i++)
+        set_add(names, strs[i], strlen(strs[i]));
+    static uint8_t big[3 * 4096 + 17];
+    memset(big, 0xab, sizeof(big));
+    set_add(names, big, sizeof(big));
+    stream_roundtrip(names, 0);
+    stream_roundtrip(names, 5);
+    set_free(names);
+
+    // Ключ больше половины куска, но меньше места в нем: уходит в поток
+    // после уже накопленных заголовка и длины.
+    koh_Set *mid = set_new();
+    static uint8_t mid_key[3000];
+    memset(mid_key, 0x5c, sizeof(mid_key));
+    set_add(mid, mid_key, sizeof(mid_key));
+    stream_roundtrip(mid, 0);
+    set_add(mid, "x", 1);
+    stream_roundtrip(mid, 0);
+    stream_roundtrip(mid, 5);
+    set_free(mid);
+
+    koh_Set *empty = set_new();
+    stream_roundtrip(empty, 0);
+    set_free(empty);
 
-    free(ctx.examples);
-    set_free(set);
+    return MUNIT_OK;
+}
+
+static void bench_stream(const char *title, koh_Set *set) {
+    struct MemStream ms = {};
+    const int rounds = 5;
+
+    double t_write = 0., t_read = 0.;
+    for (int r = 0; r < rounds; r++) {
+        ms.len = ms.pos = 0;
+        double t0 = bench_now();
+        munit_assert(set_write_stream(set, mem_stream_write, &ms));
+        t_write += bench_now() - t0;
+
+        koh_Set *copy = set_new();
+        t0 = bench_now();
+        munit_assert_int64(
+            set_read_stream(copy, mem_stream_read, &ms), ==, set_size(set)
+        );
+        t_read += bench_now() - t0;
+        set_free(copy);
+    }
+
+    double gb = (double)ms.len * rounds / 1e9;
+    munit_logf(
+        MUNIT_LOG_INFO, "%s: %zu bytes, encode %.3f GB/s, decode %.3f GB/s",
+        title, ms.len, gb / t_write, gb / t_read
+    );
+    free(ms.data);
+}
+
+static MunitResult test_bench_stream(
+    const MunitParameter params[], void* data
+) {
+    const int num = 200000;
+
+    koh_Set *fixed = set_new();
+    for (uint32_t i = 0; i < num; i++) {
+        uint64_t id = i * 0x9e3779b97f4a7c15ULL;
+        set_add(fixed, &id, sizeof(id));
+    }
+    bench_stream("fixed 8 byte keys", fixed);
+    set_free(fixed);
+
+    koh_Set *var = set_new();
+    for (uint32_t i = 0; i < num; i++) {
+        char name[64];
+        int len = snprintf(name, sizeof(name), "asset/%u/%0*u", i, i % 32, i);
+        set_add(var, name, len);
+    }
+    bench_stream("variable keys", var);
+    set_free(var);
+
+    return MUNIT_OK;
+}
+
+struct MetaObjectId {
+    Rectangle   rect;
+    uint32_t    name_id;
+};
+
+static koh_Set *interned_set_alloc(
+    koh_StrIntern *si, struct MetaLoaderObjects objs
+) {
+    koh_Set *set = set_new();
+    assert(set);
+
+    for (int i = 0; i < objs.num; ++i) {
+        struct MetaObjectId mobject = {
+            .rect = objs.rects[i],
+            .name_id = strint_intern(si, objs.names[i], -1),
+        };
+        set_add(set, &mobject, sizeof(mobject));
+    }
+
+    return set;
+}
+
+static MunitResult test_strintern(
+    const MunitParameter params[], void* data
+) {
+    koh_StrIntern *si = strint_new();
+    munit_assert_ptr_not_null(si);
+
+    uint32_t wheel1 = strint_intern(si, "wheel1", -1);
+    uint32_t mine = strint_intern(si, "mine", -1);
+    uint32_t empty = strint_intern(si, "", 0);
+    munit_assert_uint32(wheel1, !=, KOH_STRINT_NONE);
+    munit_assert_uint32(wheel1, !=, mine);
+    munit_assert_uint32(empty, !=, mine);
+    munit_assert_uint32(strint_intern(si, "wheel1xxx", 6), ==, wheel1);
+    munit_assert_uint32(strint_find(si, "mine", -1), ==, mine);
+    munit_assert_uint32(strint_find(si, "wh_el1", -1), ==, KOH_STRINT_NONE);
+    munit_assert_int(strint_size(si), ==, 3);
+
+    int len;
+    munit_assert_string_equal(strint_str(si, wheel1, &len), "wheel1");
+    munit_assert_int(len, ==, 6);
+    munit_assert_string_equal(strint_str(si, empty, NULL), "");
+    munit_assert_ptr_null(strint_str(si, KOH_STRINT_NONE, NULL));
+    munit_assert_ptr_null(strint_str(si, 1000, NULL));
+
+    // Рост таблицы, строки и id не меняются.
+    const char *wheel1_str = strint_str(si, wheel1, NULL);
+    for (int i = 0; i < 20000; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "object_%d", i);
+        uint32_t id = strint_intern(si, name, -1);
+        munit_assert_string_equal(strint_str(si, id, NULL), name);
+    }
+    munit_assert_int(strint_size(si), ==, 20003);
+    munit_assert_ptr_equal(strint_str(si, wheel1, NULL), wheel1_str);
+    munit_assert_uint32(strint_find(si, "object_777", -1), ==, 777 + 4);
+
+    static char big[100 * 1024];
+    memset(big, 'x', sizeof(big) - 1);
+    uint32_t big_id = strint_intern(si, big, -1);
+    munit_assert_uint32(strint_find(si, big, -1), ==, big_id);
+
+    strint_free(si);
+    return MUNIT_OK;
+}
+
+// set_compare на данных compare_2_eq: char name[128] против name_id.
+static MunitResult test_bench_strintern_compare(
+    const MunitParameter params[], void* data
+) {
+    struct MetaLoaderObjects objs = {
+        .names = { 
+            "wheel1", "mine"  , "wheel2", "wheel3", "wheel4", "wheel5", 
+        },
+        .rects = {
+            { 0, 0, 100, 100, },
+            { 2156, 264, 407, 418 },
+            { 2, 20, 43, 43, },
+            { 2000, 20, 43, 43, },
+            { -20, 20, 43, 43, },
+            { 0, 0, 0, 0},
+        },
+        .num = 6,
+    };
+    const int rounds = 100000;
+
+    koh_Set *full1 = control_set_alloc(objs);
+    koh_Set *full2 = control_set_alloc(objs);
+
+    koh_StrIntern *si = strint_new();
+    koh_Set *interned1 = interned_set_alloc(si, objs);
+    koh_Set *interned2 = interned_set_alloc(si, objs);
+
+    double t0 = bench_now();
+    for (int i = 0; i < rounds; i++)
+        munit_assert(set_compare(full1, full2));
+    double t_full = bench_now() - t0;
+
+    t0 = bench_now();
+    for (int i = 0; i < rounds; i++)
+        munit_assert(set_compare(interned1, interned2));
+    double t_interned = bench_now() - t0;
+
+    munit_logf(
+        MUNIT_LOG_INFO,
+        "set_compare x%d: %zu byte keys %.1f ns, %zu byte keys %.1f ns, "
+        "speedup %.2fx",
+        rounds, sizeof(struct MetaObject), t_full * 1e9 / rounds,
+        sizeof(struct MetaObjectId), t_interned * 1e9 / rounds,
+        t_full / t_interned
+    );
+
+    set_free(full1);
+    set_free(full2);
+    set_free(interned1);
+    set_free(interned2);
+    strint_free(si);
+    return MUNIT_OK;
+}
+
+static int meta_object_extract(
+    const void *key, struct koh_KeyRange ranges[KOH_MAP_KEY_RANGES_MAX],
+    void *udata
+) {
+    const struct MetaObject *mobject = key;
+    ranges[0] = (struct koh_KeyRange) {
+        &mobject->rect, sizeof(mobject->rect)
+    };
+    ranges[1] = (struct koh_KeyRange) {
+        mobject->name, strnlen(mobject->name, sizeof(mobject->name))
+    };
+    return 2;
+}
+
+static koh_Map *control_map_alloc(struct MetaLoaderObjects objs, bool extract) {
+    koh_Map *map = map_new(&(struct koh_MapSetup) {
+        .key_size = sizeof(struct MetaObject),
+        .extract = extract ? meta_object_extract : NULL,
+    });
+    assert(map);
+
+    for (int i = 0; i < objs.num; ++i) {
+        struct MetaObject mobject;
+        // мусор после имени не должен влиять на ключ с extract
+        memset(&mobject, 0x5a + i, sizeof(mobject));
+        memset(mobject.name, 0, sizeof(mobject.name));
+        strncpy(mobject.name, objs.names[i], sizeof(mobject.name) - 1);
+        mobject.rect = objs.rects[i];
+        map_add(map, &mobject, sizeof(mobject), NULL);
+    }
+
+    return map;
+}
+
+static const struct MetaLoaderObjects compare_2_objs = {
+    .names = { 
+        "wheel1", "mine"  , "wheel2", "wheel3", "wheel4", "wheel5", 
+    },
+    .rects = {
+        { 0, 0, 100, 100, },
+        { 2156, 264, 407, 418 },
+        { 2, 20, 43, 43, },
+        { 2000, 20, 43, 43, },
+        { -20, 20, 43, 43, },
+        { 0, 0, 0, 0},
+    },
+    .num = 6,
+};
+
+static MunitResult test_map_key_extract(
+    const MunitParameter params[], void* data
+) {
+    struct MetaLoaderObjects noeq = compare_2_objs;
+    strcpy(noeq.names[0], "wh_el1");
+
+    koh_Map *eq1 = control_map_alloc(compare_2_objs, true);
+    koh_Map *eq2 = control_map_alloc(compare_2_objs, true);
+    koh_Map *ne = control_map_alloc(noeq, true);
+    munit_assert_int(map_size(eq1), ==, compare_2_objs.num);
+    munit_assert(map_compare(eq1, eq2));
+    munit_assert_false(map_compare(eq1, ne));
+
+    struct MetaObject key;
+    memset(&key, 0xee, sizeof(key));
+    strcpy(key.name, "wheel3");
+    key.rect = (Rectangle) { 2000, 20, 43, 43, };
+    munit_assert(map_exist(eq1, &key, sizeof(key)));
+    strcpy(key.name, "wheel");
+    munit_assert_false(map_exist(eq1, &key, sizeof(key)));
+    strcpy(key.name, "wheel3");
+    munit_assert(map_remove(eq1, &key, sizeof(key)));
+    munit_assert_false(map_compare(eq1, eq2));
+
+    // Без extract в ключ попадает мусор после имени.
+    koh_Map *full1 = control_map_alloc(compare_2_objs, false);
+    munit_assert_false(map_exist(full1, &key, sizeof(key)));
+
+    map_free(eq1);
+    map_free(eq2);
+    map_free(ne);
+    map_free(full1);
+    return MUNIT_OK;
+}
+
+static MunitResult test_bench_map_key_extract(
+    const MunitParameter params[], void* data
+) {
+    const int rounds = 100000;
+    struct MetaLoaderObjects noeq = compare_2_objs;
+    strcpy(noeq.names[5], "wheel6");
+
+    for (int extract = 0; extract < 2; extract++) {
+        koh_Map *m1 = control_map_alloc(compare_2_objs, extract);
+        koh_Map *m2 = control_map_alloc(compare_2_objs, extract);
+        koh_Map *m3 = control_map_alloc(noeq, extract);
+
+        double t0 = bench_now();
+        for (int i = 0; i < rounds; i++) {
+            munit_assert(map_compare(m1, m2));
+            munit_assert_false(map_compare(m1, m3));
+        }
+        double t = bench_now() - t0;
+
+        munit_logf(
+            MUNIT_LOG_INFO,
+            "map_compare on compare_2 fixtures, %s: %.1f ns per eq+noeq pair",
+            extract ? "rect + strlen(name) bytes" : "full 144 byte struct",
+            t * 1e9 / rounds
+        );
+
+        map_free(m1);
+        map_free(m2);
+        map_free(m3);
+    }
+
+    return MUNIT_OK;
+}
+
+static bool check_collision_recs(Rectangle a, Rectangle b) {
+    return a.x < b.x + b.width && a.x + a.width > b.x &&
+           a.y < b.y + b.height && a.y + a.height > b.y;
+}
+
+struct RectQueryCtx {
+    bool        *seen;
+    uint32_t    id_max;
+    int         num;
+};
+
+static koh_SetAction iter_rindex_query(
+    uint32_t id, Rectangle rect, void *udata
+) {
+    struct RectQueryCtx *ctx = udata;
+    munit_assert_uint32(id, <, ctx->id_max);
+    munit_assert_false(ctx->seen[id]);
+    ctx->seen[id] = true;
+    ctx->num++;
+    return koh_SA_next;
+}
+
+static void rindex_check_query(
+    koh_RectIndex *ri, const Rectangle *rects, const bool *alive,
+    int rects_num, Rectangle view
+) {
+    bool seen[rects_num];
+    memset(seen, 0, sizeof(seen));
+    struct RectQueryCtx ctx = { .seen = seen, .id_max = rects_num, };
+    rindex_query(ri, view, iter_rindex_query, &ctx);
+
+    for (int i = 0; i < rects_num; i++) {
+        bool expected = alive[i] && check_collision_recs(rects[i], view);
+        munit_assert(seen[i] == expected);
+    }
+}
+
+static MunitResult test_rindex_query(
+    const MunitParameter params[], void* data
+) {
+    koh_StrIntern *names = strint_new();
+    koh_RectIndex *meta = rindex_new_meta(&compare_2_objs, names);
+    munit_assert_ptr_not_null(meta);
+    munit_assert_int(rindex_size(meta), ==, compare_2_objs.num);
+
+    Rectangle rect;
+    uint32_t mine = strint_find(names, "mine", -1);
+    munit_assert(rindex_get(meta, mine, &rect));
+    munit_assert_float(rect.x, ==, 2156);
+    munit_assert_false(rindex_add(meta, mine, rect));
+
+    // Окно вокруг "mine" и "wheel3".
+    bool seen[16] = {};
+    struct RectQueryCtx ctx = { .seen = seen, .id_max = 16, };
+    rindex_query(
+        meta, (Rectangle) { 1990, 0, 300, 300 }, iter_rindex_query, &ctx
+    );
+    munit_assert_int(ctx.num, ==, 2);
+    munit_assert(seen[mine]);
+    munit_assert(seen[strint_find(names, "wheel3", -1)]);
+
+    munit_assert(rindex_remove(meta, mine));
+    munit_assert_false(rindex_get(meta, mine, NULL));
+    rindex_free(meta);
+    strint_free(names);
+
+    // Случайные прямоугольники против перебора.
+    enum { RECTS = 3000, };
+    static Rectangle rects[RECTS];
+    static bool alive[RECTS];
+    koh_RectIndex *ri = rindex_new(64.);
+    for (int i = 0; i < RECTS; i++) {
+        float size = i % 50 ? 40. : 2000.;  // часть объектов крупные
+        rects[i] = (Rectangle) {
+            munit_rand_double() * 4000. - 2000.,
+            munit_rand_double() * 4000. - 2000.,
+            munit_rand_double() * size,
+            munit_rand_double() * size,
+        };
+        alive[i] = true;
+        munit_assert(rindex_add(ri, i, rects[i]));
+    }
+
+    for (int i = 0; i < RECTS; i += 3) {
+        munit_assert(rindex_remove(ri, i));
+        alive[i] = false;
+    }
+    for (int i = 1; i < RECTS; i += 7) {
+        rects[i].x += 500.;
+        munit_assert(rindex_update(ri, i, rects[i]) == alive[i]);
+    }
+    munit_assert_false(rindex_update(ri, 0, rects[0]));
+    munit_assert_int(rindex_size(ri), ==, RECTS - (RECTS + 2) / 3);
+
+    for (int q = 0; q < 50; q++) {
+        Rectangle view = {
+            munit_rand_double() * 4000. - 2000.,
+            munit_rand_double() * 4000. - 2000.,
+            munit_rand_double() * 800.,
+            munit_rand_double() * 600.,
+        };
+        rindex_check_query(ri, rects, alive, RECTS, view);
+    }
+    rindex_check_query(ri, rects, alive, RECTS, (Rectangle) {
+        -1e6, -1e6, 2e6, 2e6
+    });
+
+    rindex_clear(ri);
+    munit_assert_int(rindex_size(ri), ==, 0);
+    rindex_free(ri);
+    return MUNIT_OK;
+}
+
+struct RectCountCtx {
+    int num;
+};
+
+static koh_SetAction iter_rect_count(uint32_t id, Rectangle rect, void *udata) {
+    ((struct RectCountCtx*)udata)->num++;
+    return koh_SA_next;
+}
+
+// Запрос "что видно в окне" на 100k объектах.
+static MunitResult test_bench_rindex_query(
+    const MunitParameter params[], void* data
+) {
+    enum { RECTS = 100000, QUERIES = 2000, };
+    const float world = 50000.;
+    Rectangle *rects = malloc(sizeof(*rects) * RECTS);
+    Rectangle *views = malloc(sizeof(*views) * QUERIES);
+    munit_assert_ptr_not_null(rects);
+    munit_assert_ptr_not_null(views);
+
+    for (int i = 0; i < RECTS; i++) {
+        rects[i] = (Rectangle) {
+            munit_rand_double() * world, munit_rand_double() * world,
+            10. + munit_rand_double() * 400., 10. + munit_rand_double() * 400.,
+        };
+    }
+    for (int q = 0; q < QUERIES; q++) {
+        views[q] = (Rectangle) {
+            munit_rand_double() * world, munit_rand_double() * world,
+            1920., 1080.,
+        };
+    }
+
+    double t0 = bench_now();
+    koh_RectIndex *ri = rindex_new(512.);
+    for (int i = 0; i < RECTS; i++)
+        rindex_add(ri, i, rects[i]);
+    double t_build = bench_now() - t0;
+
+    int found_scan = 0;
+    t0 = bench_now();
+    for (int q = 0; q < QUERIES; q++) {
+        for (int i = 0; i < RECTS; i++)
+            found_scan += check_collision_recs(rects[i], views[q]);
+    }
+    double t_scan = bench_now() - t0;
+
+    struct RectCountCtx ctx = {};
+    t0 = bench_now();
+    for (int q = 0; q < QUERIES; q++)
+        rindex_query(ri, views[q], iter_rect_count, &ctx);
+    double t_index = bench_now() - t0;
+
+    munit_assert_int(ctx.num, ==, found_scan);
+    munit_logf(
+        MUNIT_LOG_INFO,
+        "%d rects, build %.1f ms; view query: scan %.1f us, "
+        "index %.2f us, speedup %.1fx, %.1f hits per query",
+        RECTS, t_build * 1e3, t_scan * 1e6 / QUERIES, t_index * 1e6 / QUERIES,
+        t_scan / t_index, (double)found_scan / QUERIES
+    );
+
+    rindex_free(ri);
+    free(rects);
+    free(views);
+    return MUNIT_OK;
+}
+
+static koh_SetAction iter_sset_remove_odd(de_entity e, void *udata) {
+    return e & 1 ? koh_SA_remove_next : koh_SA_next;
+}
+
+static MunitResult test_sset_add_remove(
+    const MunitParameter params[], void* data
+) {
+    enum { ENTITIES = 20000, };
+    koh_SparseSet *ss = sset_new();
+    koh_Set *control = set_new();
+
+    for (int i = 0; i < ENTITIES; i++) {
+        de_entity e = munit_rand_uint32() % (KOH_SPARSE_ID_MASK + 1);
+        bool exist = set_exist(control, &e, sizeof(e));
+        munit_assert(sset_add(ss, e) == !exist);
+        set_add(control, &e, sizeof(e));
+    }
+    munit_assert_int(sset_size(ss), ==, set_size(control));
+
+    // Та же позиция с другой версией - другая сущность.
+    de_entity first = sset_dense(ss)[0];
+    de_entity other = first + KOH_SPARSE_ID_MASK + 1;
+    munit_assert_false(sset_exist(ss, other));
+    munit_assert_false(sset_remove(ss, other));
+    munit_assert(sset_exist(ss, first));
+
+    // Новая версия вытесняет старую, размер не меняется.
+    int size = sset_size(ss);
+    munit_assert(sset_add(ss, other));
+    munit_assert_int(sset_size(ss), ==, size);
+    munit_assert(sset_exist(ss, other));
+    munit_assert_false(sset_exist(ss, first));
+    munit_assert(sset_add(ss, first));
+    munit_assert_int(sset_size(ss), ==, size);
+    munit_assert(sset_exist(ss, first));
+    munit_assert_false(sset_exist(ss, other));
+
+    sset_each(ss, iter_sset_remove_odd, NULL);
+    for (struct koh_SetView v = set_each_begin(control);
+            set_each_valid(&v); set_each_next(&v)) {
+        de_entity e = *(const de_entity*)set_each_key(&v);
+        munit_assert(sset_exist(ss, e) == !(e & 1));
+    }
+
+    // Удаление переносит последнюю сущность, поэтому обход каждый раз
+    // начинается заново.
+    int left = sset_size(ss), num = 0;
+    munit_assert_int(left, >, 0);
+    while (sset_size(ss) > 0) {
+        struct koh_SparseSetView v = sset_each_begin(ss);
+        munit_assert(sset_each_valid(&v));
+        de_entity e = sset_each_entity(&v);
+        munit_assert(set_exist(control, &e, sizeof(e)));
+        munit_assert(sset_remove(ss, e));
+        munit_assert_false(sset_exist(ss, e));
+        num++;
+    }
+    munit_assert_int(num, ==, left);
+
+    munit_assert(sset_add(ss, first));
+    sset_clear(ss);
+    munit_assert_false(sset_exist(ss, first));
+
+    set_free(control);
+    sset_free(ss);
+    return MUNIT_OK;
+}
+
+// Учет компонента у 1M сущностей: koh_Set против разреженного множества.
+static MunitResult test_bench_sset(
+    const MunitParameter params[], void* data
+) {
+    enum { ENTITIES = 1000000, };
+    de_entity *ids = malloc(sizeof(*ids) * ENTITIES);
+    munit_assert_ptr_not_null(ids);
+    for (int i = 0; i < ENTITIES; i++)
+        ids[i] = i;
+    // Перемешанный порядок, как у запросов из систем.
+    for (int i = ENTITIES - 1; i > 0; i--) {
+        int j = munit_rand_uint32() % (i + 1);
+        de_entity t = ids[i];
+        ids[i] = ids[j];
+        ids[j] = t;
+    }
+
+    double t0 = bench_now();
+    koh_Set *set = set_new();
+    for (int i = 0; i < ENTITIES; i++)
+        set_add(set, &ids[i], sizeof(ids[i]));
+    double t_set_add = bench_now() - t0;
+
+    t0 = bench_now();
+    int hits_set = 0;
+    for (int i = 0; i < ENTITIES; i++)
+        hits_set += set_exist(set, &ids[i], sizeof(ids[i]));
+    double t_set_exist = bench_now() - t0;
+
+    t0 = bench_now();
+    uint64_t sum_set = 0;
+    for (struct koh_SetView v = set_each_begin(set);
+            set_each_valid(&v); set_each_next(&v))
+        sum_set += *(const de_entity*)set_each_key(&v);
+    double t_set_each = bench_now() - t0;
+
+    t0 = bench_now();
+    koh_SparseSet *ss = sset_new();
+    for (int i = 0; i < ENTITIES; i++)
+        sset_add(ss, ids[i]);
+    double t_ss_add = bench_now() - t0;
+
+    t0 = bench_now();
+    int hits_ss = 0;
+    for (int i = 0; i < ENTITIES; i++)
+        hits_ss += sset_exist(ss, ids[i]);
+    double t_ss_exist = bench_now() - t0;
+
+    t0 = bench_now();
+    uint64_t sum_ss = 0;
+    const de_entity *dense = sset_dense(ss);
+    for (int i = 0; i < sset_size(ss); i++)
+        sum_ss += dense[i];
+    double t_ss_each = bench_now() - t0;
+
+    munit_assert_int(hits_set, ==, ENTITIES);
+    munit_assert_int(hits_ss, ==, ENTITIES);
+    munit_assert_uint64(sum_set, ==, sum_ss);
+
+    munit_logf(
+        MUNIT_LOG_INFO,
+        "%d entities, koh_Set / sparse, ms: add %.1f / %.1f, "
+        "exist %.1f / %.1f, each %.2f / %.2f",
+        ENTITIES, t_set_add * 1e3, t_ss_add * 1e3,
+        t_set_exist * 1e3, t_ss_exist * 1e3,
+        t_set_each * 1e3, t_ss_each * 1e3
+    );
+
+    sset_free(ss);
+    set_free(set);
+    free(ids);
+    return MUNIT_OK;
+}
+
+static koh_SetAction iter_bset_remove_3(
+    const void *key, int key_len, void *udata
+) {
+    munit_assert_int(key_len, ==, sizeof(uint32_t));
+    return *(const uint32_t*)key % 3 ? koh_SA_next : koh_SA_remove_next;
+}
+
+static MunitResult test_bset_ops(
+    const MunitParameter params[], void* data
+) {
+    // Ключи как в test_add_remove: 1, 3, 5, ... 1105.
+    koh_Set *set = set_new();
+    for (uint32_t i = 1; i <= 1105; i += 2)
+        set_add(set, &i, sizeof(i));
+
+    munit_assert_ptr_null(bset_from_set(set, 2, 1105));
+    koh_BitSet *small = bset_new(0, 10);
+    int64_t wide = 1;
+    munit_assert_false(bset_add(small, &wide, sizeof(wide)));
+    munit_assert_ptr_null(bset_new(10, 0));
+
+    koh_BitSet *odd = bset_from_set(set, 0, 2000);
+    munit_assert_ptr_not_null(odd);
+    munit_assert_int(bset_size(odd), ==, set_size(set));
+
+    uint32_t prev = 0;
+    int num = 0;
+    for (struct koh_BitSetView v = bset_each_begin(odd);
+            bset_each_valid(&v); bset_each_next(&v)) {
+        munit_assert_int(bset_each_key_len(&v), ==, sizeof(uint32_t));
+        uint32_t key = *(const uint32_t*)bset_each_key(&v);
+        munit_assert(set_exist(set, &key, sizeof(key)));
+        munit_assert_uint32(key, >, prev);
+        prev = key;
+        num++;
+    }
+    munit_assert_int(num, ==, set_size(set));
+
+    koh_BitSet *low = bset_new(0, 2000);
+    for (uint32_t i = 0; i < 100; i++)
+        munit_assert(bset_add(low, &i, sizeof(i)));
+    uint32_t out = 2001;
+    munit_assert_false(bset_add(low, &out, sizeof(out)));
+
+    koh_BitSet *u = bset_new(0, 2000);
+    munit_assert(bset_union(u, odd));
+    munit_assert(bset_compare(u, odd));
+    munit_assert(bset_union(u, low));
+    // 553 нечетных до 1105 и 50 четных до 100
+    munit_assert_int(bset_size(u), ==, 553 + 50);
+
+    munit_assert(bset_intersect(u, low));
+    munit_assert_int(bset_size(u), ==, 100);
+    munit_assert(bset_compare(u, low));
+    munit_assert_false(bset_union(u, small));
+
+    bset_each(odd, iter_bset_remove_3, NULL);
+    for (uint32_t i = 1; i <= 1105; i += 2)
+        munit_assert(bset_exist(odd, &i, sizeof(i)) == (i % 3 != 0));
+
+    koh_Set *back = set_new();
+    bset_to_set(odd, back);
+    munit_assert_int(set_size(back), ==, bset_size(odd));
+
+    uint32_t seven = 7;
+    munit_assert(bset_remove(odd, &seven, sizeof(seven)));
+    munit_assert_false(bset_remove(odd, &seven, sizeof(seven)));
+    bset_clear(odd);
+    munit_assert_int(bset_size(odd), ==, 0);
+    struct koh_BitSetView v = bset_each_begin(odd);
+    munit_assert_false(bset_each_valid(&v));
+
+    set_free(back);
+    set_free(set);
+    bset_free(odd);
+    bset_free(low);
+    bset_free(u);
+    bset_free(small);
+    return MUNIT_OK;
+}
+
+// Плотные id в диапазоне 1M: koh_Set против битового множества.
+static MunitResult test_bench_bset(
+    const MunitParameter params[], void* data
+) {
+    enum { RANGE = 1 << 20, };
+    koh_Set *s1 = set_new(), *s2 = set_new();
+    for (uint32_t i = 0; i < RANGE; i++) {
+        if (i % 3)
+            set_add(s1, &i, sizeof(i));
+        if (i % 5)
+            set_add(s2, &i, sizeof(i));
+    }
+    koh_BitSet *b1 = bset_from_set(s1, 0, RANGE - 1);
+    koh_BitSet *b2 = bset_from_set(s2, 0, RANGE - 1);
+    munit_assert_ptr_not_null(b1);
+    munit_assert_ptr_not_null(b2);
+
+    double t0 = bench_now();
+    int hits_set = 0;
+    for (uint32_t i = 0; i < RANGE; i++)
+        hits_set += set_exist(s1, &i, sizeof(i));
+    double t_set_exist = bench_now() - t0;
+
+    t0 = bench_now();
+    int hits_bs = 0;
+    for (uint32_t i = 0; i < RANGE; i++)
+        hits_bs += bset_exist(b1, &i, sizeof(i));
+    double t_bs_exist = bench_now() - t0;
+    munit_assert_int(hits_set, ==, hits_bs);
+
+    // Пересечение: проверкой по второму множеству и по словам.
+    t0 = bench_now();
+    int inter_set = 0;
+    for (struct koh_SetView v = set_each_begin(s1);
+            set_each_valid(&v); set_each_next(&v))
+        inter_set += set_exist(s2, set_each_key(&v), set_each_key_len(&v));
+    double t_set_inter = bench_now() - t0;
+
+    t0 = bench_now();
+    bset_intersect(b1, b2);
+    double t_bs_inter = bench_now() - t0;
+    munit_assert_int(bset_size(b1), ==, inter_set);
+
+    t0 = bench_now();
+    uint64_t sum = 0;
+    for (struct koh_BitSetView v = bset_each_begin(b1);
+            bset_each_valid(&v); bset_each_next(&v))
+        sum += *(const uint32_t*)bset_each_key(&v);
+    double t_bs_each = bench_now() - t0;
+    munit_assert_uint64(sum, >, 0);
+
+    munit_logf(
+        MUNIT_LOG_INFO,
+        "range %d, koh_Set / bitset: exist %.1f / %.2f ms, "
+        "intersect %.1f / %.3f ms, bitset each %.2f ms, "
+        "memory %d KiB",
+        RANGE, t_set_exist * 1e3, t_bs_exist * 1e3,
+        t_set_inter * 1e3, t_bs_inter * 1e3, t_bs_each * 1e3, RANGE / 8 / 1024
+    );
+
+    set_free(s1);
+    set_free(s2);
+    bset_free(b1);
+    bset_free(b2);
+    return MUNIT_OK;
+}
+
+// test_each на сжатом множестве.
+static MunitResult test_roar_each(
+    const MunitParameter params[], void* data
+) {
+    uint32_t nums[] = {
+        1, 3, 5, 7, 11, 13, 15,
+    };
+    int nums_num = sizeof(nums) / sizeof(nums[0]);
+
+    koh_Roaring *r = roar_new();
+    for (int i = 0; i< nums_num; ++i) {
+        roar_add(r, &nums[i], sizeof(nums[i]));
+    }
+
+    struct NumbersCtx ctx = {
+        .arr = nums, 
+        .num = nums_num,
+    };
+    roar_each(r, iter_each, &ctx);
+    roar_free(r);
+
+    return MUNIT_OK;
+}
+
+// Множество совпадает с model, обход идет по возрастанию.
+static void roar_check_model(koh_Roaring *r, koh_Set *model) {
+    munit_assert_int64(roar_size(r), ==, set_size(model));
+
+    int64_t num = 0, prev = -1;
+    for (struct koh_RoaringView v = roar_each_begin(r);
+            roar_each_valid(&v); roar_each_next(&v)) {
+        munit_assert_int(roar_each_key_len(&v), ==, sizeof(uint32_t));
+        uint32_t key = *(const uint32_t*)roar_each_key(&v);
+        munit_assert_int64(key, >, prev);
+        munit_assert(set_exist(model, &key, sizeof(key)));
+        prev = key;
+        num++;
+    }
+    munit_assert_int64(num, ==, set_size(model));
+
+    for (struct koh_SetView v = set_each_begin(model);
+            set_each_valid(&v); set_each_next(&v))
+        munit_assert(roar_exist(r, set_each_key(&v), set_each_key_len(&v)));
+}
+
+// Серии, плотный и разреженный контейнеры и одиночные значения.
+static void roar_fill(koh_Roaring *r, koh_Set *model, uint32_t seed) {
+    for (uint32_t i = 0; i < 70000; i++) {
+        uint32_t keys[] = {
+            (1u << 16) * 3 + i % 60000,                 // серия
+            (1u << 16) * 5 + (i * 7 + seed) % 65536,    // битовый
+            (1u << 16) * 9 + (i * 131 + seed) % 65536,  // массив
+            UINT32_MAX - (i + seed) % 3,
+        };
+        for (int k = 0; k < 4; k++) {
+            if (k == 2 && i % 50)
+                continue;
+            if (k == 1 && i % 2)
+                continue;
+            bool exist = set_exist(model, &keys[k], sizeof(keys[k]));
+            munit_assert(roar_add(r, &keys[k], sizeof(keys[k])) == !exist);
+            set_add(model, &keys[k], sizeof(keys[k]));
+        }
+    }
+}
+
+// Подходит и для roar_each, и для set_each с ключами uint32_t.
+static koh_SetAction iter_remove_5(
+    const void *key, int key_len, void *udata
+) {
+    return *(const uint32_t*)key % 5 ? koh_SA_next : koh_SA_remove_next;
+}
+
+static MunitResult test_roar_ops(
+    const MunitParameter params[], void* data
+) {
+    koh_Roaring *a = roar_new(), *b = roar_new();
+    koh_Set *ma = set_new(), *mb = set_new();
+    roar_fill(a, ma, 0);
+    roar_fill(b, mb, 17);
+    roar_check_model(a, ma);
+
+    uint64_t wide = 1;
+    munit_assert_false(roar_add(a, &wide, sizeof(wide)));
+
+    // Представление не меняет содержимого.
+    struct koh_RoaringStats before = roar_stats(a);
+    roar_optimize(a);
+    struct koh_RoaringStats after = roar_stats(a);
+    munit_assert_int(after.runs, >, 0);
+    munit_assert_int64(after.bytes, <, before.bytes);
+    roar_check_model(a, ma);
+
+    // Вставка и удаление внутри серий и на их границах.
+    uint32_t edits[] = {
+        (1u << 16) * 3 + 100, (1u << 16) * 3, (1u << 16) * 3 + 59999,
+        (1u << 16) * 3 + 60000, (1u << 16) * 3 + 101, 7,
+    };
+    for (int i = 0; i < 6; i++) {
+        bool exist = set_exist(ma, &edits[i], sizeof(edits[i]));
+        munit_assert(roar_remove(a, &edits[i], sizeof(edits[i])) == exist);
+        set_remove(ma, &edits[i], sizeof(edits[i]));
+    }
+    for (int i = 0; i < 6; i += 2) {
+        munit_assert(roar_add(a, &edits[i], sizeof(edits[i])));
+        set_add(ma, &edits[i], sizeof(edits[i]));
+    }
+    roar_check_model(a, ma);
+
+    // Алгебра против перебора.
+    koh_Set *m_and = set_new(), *m_or = set_new();
+    for (struct koh_SetView v = set_each_begin(ma);
+            set_each_valid(&v); set_each_next(&v)) {
+        const void *key = set_each_key(&v);
+        if (set_exist(mb, key, sizeof(uint32_t)))
+            set_add(m_and, key, sizeof(uint32_t));
+        set_add(m_or, key, sizeof(uint32_t));
+    }
+    for (struct koh_SetView v = set_each_begin(mb);
+            set_each_valid(&v); set_each_next(&v))
+        set_add(m_or, set_each_key(&v), sizeof(uint32_t));
+
+    koh_Roaring *r_and = roar_and(a, b), *r_or = roar_or(a, b);
+    roar_check_model(r_and, m_and);
+    roar_check_model(r_or, m_or);
+    munit_assert_int64(roar_and_size(a, b), ==, set_size(m_and));
+    munit_assert_int64(roar_and_size(b, a), ==, set_size(m_and));
+
+    // Сериализация.
+    struct MemStream ms = {};
+    munit_assert(roar_write_stream(a, mem_stream_write, &ms));
+    koh_Roaring *copy = roar_read_stream(mem_stream_read, &ms);
+    munit_assert_ptr_not_null(copy);
+    munit_assert(roar_compare(a, copy));
+    munit_assert_false(roar_compare(a, b));
+    roar_free(copy);
+
+    ms.len--;
+    ms.pos = 0;
+    munit_assert_ptr_null(roar_read_stream(mem_stream_read, &ms));
+    ms.len++;
+    ms.pos = 0;
+    ms.data[sizeof(uint64_t) * 3 - 2] ^= 0xFF;
+    munit_assert_ptr_null(roar_read_stream(mem_stream_read, &ms));
+    free(ms.data);
+
+    // Удаление при обходе, в том числе внутри серий.
+    roar_each(a, iter_remove_5, NULL);
+    set_each(ma, iter_remove_5, NULL);
+    roar_check_model(a, ma);
+
+    roar_clear(a);
+    munit_assert_int64(roar_size(a), ==, 0);
+    struct koh_RoaringView v = roar_each_begin(a);
+    munit_assert_false(roar_each_valid(&v));
+
+    set_free(m_and);
+    set_free(m_or);
+    set_free(ma);
+    set_free(mb);
+    roar_free(r_and);
+    roar_free(r_or);
+    roar_free(a);
+    roar_free(b);
+    return MUNIT_OK;
+}
+
+// Миллионы id, собранных в серии, и разреженный хвост.
+static MunitResult test_bench_roar(
+    const MunitParameter params[], void* data
+) {
+    enum { IDS = 4000000, };
+    uint32_t *ids = malloc(sizeof(*ids) * IDS);
+    munit_assert_ptr_not_null(ids);
+    uint32_t id = 1000;
+    for (int i = 0; i < IDS; i++) {
+        // серии по 1000 id с разрывами, каждый десятый id - одиночный
+        id += i % 1000 ? 1 : 5000;
+        ids[i] = i % 10 ? id : munit_rand_uint32();
+    }
+
+    double t0 = bench_now();
+    koh_Set *s1 = set_new(), *s2 = set_new();
+    for (int i = 0; i < IDS; i++) {
+        set_add(s1, &ids[i], sizeof(ids[i]));
+        if (i % 3)
+            set_add(s2, &ids[i], sizeof(ids[i]));
+    }
+    double t_set_add = bench_now() - t0;
+
+    t0 = bench_now();
+    koh_Roaring *r1 = roar_new(), *r2 = roar_new();
+    for (int i = 0; i < IDS; i++) {
+        roar_add(r1, &ids[i], sizeof(ids[i]));
+        if (i % 3)
+            roar_add(r2, &ids[i], sizeof(ids[i]));
+    }
+    roar_optimize(r1);
+    roar_optimize(r2);
+    double t_roar_add = bench_now() - t0;
+    munit_assert_int64(roar_size(r1), ==, set_size(s1));
+
+    t0 = bench_now();
+    int hits_set = 0;
+    for (int i = 0; i < IDS; i++)
+        hits_set += set_exist(s1, &ids[i], sizeof(ids[i]));
+    double t_set_exist = bench_now() - t0;
+
+    t0 = bench_now();
+    int hits_roar = 0;
+    for (int i = 0; i < IDS; i++)
+        hits_roar += roar_exist(r1, &ids[i], sizeof(ids[i]));
+    double t_roar_exist = bench_now() - t0;
+    munit_assert_int(hits_set, ==, hits_roar);
+
+    t0 = bench_now();
+    int64_t inter_set = 0;
+    for (struct koh_SetView v = set_each_begin(s1);
+            set_each_valid(&v); set_each_next(&v))
+        inter_set += set_exist(s2, set_each_key(&v), set_each_key_len(&v));
+    double t_set_inter = bench_now() - t0;
+
+    t0 = bench_now();
+    koh_Roaring *r_and = roar_and(r1, r2);
+    double t_roar_inter = bench_now() - t0;
+    munit_assert_int64(roar_size(r_and), ==, inter_set);
+
+    struct koh_RoaringStats stats = roar_stats(r1);
+    munit_logf(
+        MUNIT_LOG_INFO,
+        "%d ids, koh_Set / roaring ms: add %.1f / %.1f, exist %.1f / %.1f, "
+        "and %.1f / %.2f; roaring %.2f bytes per id "
+        "(%d arrays, %d bitmaps, %d runs)",
+        IDS, t_set_add * 1e3, t_roar_add * 1e3,
+        t_set_exist * 1e3, t_roar_exist * 1e3,
+        t_set_inter * 1e3, t_roar_inter * 1e3,
+        (double)stats.bytes / roar_size(r1),
+        stats.arrays, stats.bitmaps, stats.runs
+    );
+
+    roar_free(r_and);
+    roar_free(r1);
+    roar_free(r2);
+    set_free(s1);
+    set_free(s2);
+    free(ids);
+    return MUNIT_OK;
+}
+
+struct TestAddRemoveCtx {
+    int     *examples;
+    int     examples_num;
+    int     examples_remove_value;
+    bool    examples_remove_value_found;
+    koh_Set *set;
+};
+
+static koh_SetAction iter_set_remove_by_value(
+    const void *key, int key_len, void *udata
+) {
+    const int *key_value = key;
+
+    if (!udata) {
+        fprintf(stderr, "iter_set_check: udata == NULL\n");
+        koh_trap();
+    }
+
+    struct TestAddRemoveCtx *ctx = udata;
+
+    if (*key_value == ctx->examples_remove_value) {
+        /*printf("iter_set_remove: found key %d\n", *key_value);*/
+        ctx->examples_remove_value_found = true;
+        return koh_SA_remove_break;
+    }
+    return koh_SA_next;
+}
+
+static koh_SetAction iter_set_check(
+    const void *key, int key_len, void *udata
+) {
+    const int *key_value = key;
+    if (!udata) {
+        fprintf(stderr, "iter_set_check: udata == NULL\n");
+        koh_trap();
+    }
+
+    struct TestAddRemoveCtx *ctx = udata;
+    for (int i = 0; i < ctx->examples_num; ++i) {
+        if (ctx->examples[i] == *key_value) {
+            //printf("iter_set_check: found %d\n", *key_value);
+            return koh_SA_next;
+        }
+    }
+
+    if (verbose)
+        printf("iter_set_remove: key_value = %d not found\n", *key_value);
+    munit_assert(false);
+    return koh_SA_next;
+}
+
+static MunitResult test_add_remove(
+    const MunitParameter params[], void* data
+) {
+    int examples[] = {
+        1, 3, 4, 5, 6, 7, 8, 9, 10, 11, 20, 23, 24
+    };
+    koh_Set *set = set_new();
+
+    int examples_num = sizeof(examples) / sizeof(examples[0]);
+    struct TestAddRemoveCtx ctx = {
+        .examples = calloc(sizeof(int), examples_num * 2),
+        .examples_num = examples_num,
+    };
+    assert(ctx.examples);
+    memcpy(ctx.examples, examples, sizeof(int) * examples_num);
+
+    for (int i = 0; i < examples_num; i++) {
+        set_add(set, &examples[i], sizeof(int));
+    }
+
+    set_each(set, iter_set_check, &ctx);
+
+    set_remove(set, &ctx.examples[0], sizeof(int));
+    ctx.examples[0] = 0;
+
+    set_remove(set, &ctx.examples[1], sizeof(int));
+    ctx.examples[1] = 0;
+
+    set_each(set, iter_set_check, &ctx);
+
+    ctx.examples[ctx.examples_num++] = 101;
+    set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
+
+    ctx.examples[ctx.examples_num++] = 102;
+    set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
+
+    ctx.examples[ctx.examples_num++] = 103;
+    set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
+
+    ctx.examples[ctx.examples_num++] = 104;
+    set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
+
+    ctx.examples[ctx.examples_num++] = 105;
+    set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
+
+    set_each(set, iter_set_check, &ctx);
+
+    set_remove(set, &ctx.examples[5], sizeof(int));
+    ctx.examples[5] = 0;
+
+    set_remove(set, &ctx.examples[5], sizeof(int));
+    ctx.examples[5] = 0;
+
+    set_each(set, iter_set_check, &ctx);
+
+    free(ctx.examples);
+    set_free(set);
     return MUNIT_OK;
 }
 
 static void ctx_set_remove(struct TestAddRemoveCtx *ctx, int index) {
     assert(ctx);
 
-    if (!ctx) {
+    if (!ctx) {
+        if (verbose)
+            printf("set_remove_through: ctx == NULL\n");
+        koh_trap();
+    }
+
+    assert(ctx->set);
+
+    if (!ctx->examples) {
+        if (verbose)
+            printf("set_remove_through: ctx->examples == NULL\n");
+        koh_trap();
+    }
+
+    assert(index < ctx->examples_num);
+    if (ctx->examples)
+        ctx->examples_remove_value = ctx->examples[index];
+    else {
+        printf("ctx_set_removce: ctx->examples == NULL\n");
+        exit(EXIT_FAILURE);
+    }
+    //ctx->examples_remove_value_found = false;
+    //set_each(ctx->set, iter_set_remove_by_value, ctx);
+    set_remove(ctx->set, &ctx->examples[index], sizeof(int));
+    ctx->examples[index] = 0;
+    //if (!ctx->examples_remove_value_found) {
+        //printf("ctx->examples_remove_value: %d\n", ctx->examples_remove_value);
+        //munit_assert(ctx->examples_remove_value_found);
+    //}
+}
+
+static void ctx_set_remove_through(struct TestAddRemoveCtx *ctx, int index) {
+    assert(ctx);
+
+    if (!ctx) {
+        printf("set_remove_through: ctx == NULL\n");
+        koh_trap();
+    }
+
+    assert(ctx->set);
+
+    if (!ctx->examples) {
+        printf("set_remove_through: ctx->examples == NULL\n");
+        koh_trap();
+    }
+
+    assert(index < ctx->examples_num);
+    ctx->examples_remove_value = ctx->examples[index];
+    ctx->examples[index] = 0;
+    ctx->examples_remove_value_found = false;
+    set_each(ctx->set, iter_set_remove_by_value, ctx);
+    if (!ctx->examples_remove_value_found) {
+        if (verbose)
+            printf(
+                "ctx->examples_remove_value: %d\n",
+                ctx->examples_remove_value
+            );
+        munit_assert(ctx->examples_remove_value_found);
+    }
+}
+
+static MunitResult test_add_remove_each(
+    const MunitParameter params[], void* data
+) {
+
+    int examples[] = {
+        1,  // 0
+        3,  // 1
+        4,  // 2
+        5,  // 3
+        6,  // 4
+        7,  // 5
+        8,  // 6
+        9,  // 7
+        10, // 8
+        11, // 9
+        20, // 10
+        23, // 11
+        24  // 12
+    };
+
+    koh_Set *set = set_new();
+    int examples_num = sizeof(examples) / sizeof(examples[0]);
+    int examples_cap = examples_num * 10;
+    struct TestAddRemoveCtx ctx = {
+        .examples = calloc(sizeof(int), examples_cap),
+        .examples_num = examples_num,
+        .set = set,
+    };
+    assert(ctx.examples);
+    memcpy(ctx.examples, examples, sizeof(int) * examples_num);
+
+    for (int i = 0; i < examples_num; i++) {
+        int example_value = examples[i];
         if (verbose)
-            printf("set_remove_through: ctx == NULL\n");
-        koh_trap();
+            printf("%d ", example_value);
+        set_add(set, &example_value, sizeof(int));
+    }
+    if (verbose) {
+        printf("\n");
+        printf("set_size(set) %d\n", set_size(set));
     }
+    munit_assert_int(set_size(set), !=, 0);
+    set_each(set, iter_set_check, &ctx);
 
-    assert(ctx->set);
+    ctx_set_remove_through(&ctx, 0);
+    ctx_set_remove_through(&ctx, 10);
+    ctx_set_remove_through(&ctx, 12);
+    ctx_set_remove_through(&ctx, 5);
+    ctx_set_remove_through(&ctx, 6);
+    ctx_set_remove_through(&ctx, 7);
 
-    if (!ctx->examples) {
+    set_each(set, iter_set_check, &ctx);
+
+    bool use_print = false;
+    if (use_print)
+        printf("new elements were added: ");
+    for (int j = examples_num; j < examples_num * 2; j++) {
+        ctx.examples[ctx.examples_num++] = 100 + j;
+        if (use_print)
+            printf("%d ", ctx.examples[ctx.examples_num - 1]);
+        set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
+    }
+    if (use_print)
+        printf("\n");
+
+    // XXX: Что показывают эти цифры?
+    if (verbose) {
+        for (int i = 0; i < ctx.examples_num; i++) {
+            int example_value = ctx.examples[i];
+            printf("%d ", example_value);
+        }
+        printf("\n");
+    }
+
+    for (int j = examples_num - 1; j < examples_num / 2; j--) {
         if (verbose)
-            printf("set_remove_through: ctx->examples == NULL\n");
-        koh_trap();
+            printf("j %d, ctx.examples[%d] = %d\n", j, j, ctx.examples[j]);
+        if (ctx.examples[j])
+            ctx_set_remove_through(&ctx, j);
     }
 
-    assert(index < ctx->examples_num);
-    if (ctx->examples)
-        ctx->examples_remove_value = ctx->examples[index];
-    else {
-        printf("ctx_set_removce: ctx->examples == NULL\n");
-        exit(EXIT_FAILURE);
+    ctx.examples[ctx.examples_num++] = 1102;
+    set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
+
+    ctx.examples[ctx.examples_num++] = 1103;
+    set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
+
+    ctx.examples[ctx.examples_num++] = 1104;
+    set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
+
+    ctx.examples[ctx.examples_num++] = 1105;
+    set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
+
+    set_each(set, iter_set_check, &ctx);
+
+    ctx_set_remove(&ctx, ctx.examples_num - 1);
+    ctx.examples_num--;
+    ctx_set_remove(&ctx, ctx.examples_num - 1);
+    ctx.examples_num--;
+    ctx_set_remove(&ctx, ctx.examples_num - 1);
+    ctx.examples_num--;
+    ctx_set_remove(&ctx, ctx.examples_num - 1);
+    ctx.examples_num--;
+
+    if (verbose) {
+        for (int i = 0; i < ctx.examples_num; i++) {
+            printf("%d ", ctx.examples[i]);
+        }
+        printf("\n");
     }
-    //ctx->examples_remove_value_found = false;
-    //set_each(ctx->set, iter_set_remove_by_value, ctx);
-    set_remove(ctx->set, &ctx->examples[index], sizeof(int));
-    ctx->examples[index] = 0;
-    //if (!ctx->examples_remove_value_found) {
-        //printf("ctx->examples_remove_value: %d\n", ctx->examples_remove_value);
-        //munit_assert(ctx->examples_remove_value_found);
-    //}
+
+    set_each(set, iter_set_check, &ctx);
+
+    free(ctx.examples);
+    set_free(set);
+    return MUNIT_OK;
 }
 
-static void ctx_set_remove_through(struct TestAddRemoveCtx *ctx, int index) {
-    assert(ctx);
+static koh_SetAction iter_map_check(
+    const void *key, int key_len, void *value, int value_len, void *udata
+) {
+    const int *key_value = key;
+    struct TestAddRemoveCtx *ctx = udata;
 
-    if (!ctx) {
-        printf("set_remove_through: ctx == NULL\n");
-        koh_trap();
+    munit_assert_int(value_len, ==, sizeof(int));
+    munit_assert_int(*(int*)value, ==, *key_value * 10);
+
+    for (int i = 0; i < ctx->examples_num; ++i) {
+        if (ctx->examples[i] == *key_value)
+            return koh_SA_next;
+    }
+
+    if (verbose)
+        printf("iter_map_check: key_value = %d not found\n", *key_value);
+    munit_assert(false);
+    return koh_SA_next;
+}
+
+static void ctx_map_add(koh_Map *map, struct TestAddRemoveCtx *ctx, int key) {
+    ctx->examples[ctx->examples_num++] = key;
+    int value = key * 10;
+    map_add(map, &key, sizeof(key), &value);
+}
+
+static MunitResult test_map_add_remove(
+    const MunitParameter params[], void* data
+) {
+    int examples[] = {
+        1, 3, 4, 5, 6, 7, 8, 9, 10, 11, 20, 23, 24
+    };
+    koh_Map *map = map_new(&(struct koh_MapSetup) {
+        .key_size = sizeof(int),
+        .value_size = sizeof(int),
+    });
+
+    int examples_num = sizeof(examples) / sizeof(examples[0]);
+    struct TestAddRemoveCtx ctx = {
+        .examples = calloc(sizeof(int), examples_num * 2),
+    };
+    assert(ctx.examples);
+
+    for (int i = 0; i < examples_num; i++) {
+        ctx_map_add(map, &ctx, examples[i]);
+    }
+    munit_assert_int(map_size(map), ==, examples_num);
+
+    // Ключ другой длины не читается за пределами key_size.
+    int64_t wide = examples[0];
+    bool created = true;
+    munit_assert_ptr_null(map_upsert(map, &wide, sizeof(wide), &created));
+    munit_assert_false(created);
+    munit_assert_ptr_null(map_add(map, &wide, sizeof(wide), NULL));
+    munit_assert_int(map_size(map), ==, examples_num);
+
+    map_each(map, iter_map_check, &ctx);
+
+    munit_assert(map_remove(map, &ctx.examples[0], sizeof(int)));
+    ctx.examples[0] = 0;
+
+    munit_assert(map_remove(map, &ctx.examples[1], sizeof(int)));
+    ctx.examples[1] = 0;
+    munit_assert_false(map_remove(map, &examples[1], sizeof(int)));
+
+    map_each(map, iter_map_check, &ctx);
+
+    for (int key = 101; key <= 105; key++)
+        ctx_map_add(map, &ctx, key);
+
+    map_each(map, iter_map_check, &ctx);
+
+    munit_assert(map_remove(map, &ctx.examples[5], sizeof(int)));
+    ctx.examples[5] = 0;
+
+    munit_assert_false(map_remove(map, &ctx.examples[5], sizeof(int)));
+    ctx.examples[5] = 0;
+
+    map_each(map, iter_map_check, &ctx);
+    munit_assert_int(map_size(map), ==, examples_num + 5 - 3);
+
+    // get-or-insert за один проход
+    int key = 24;
+    created = true;
+    int *value = map_upsert(map, &key, sizeof(key), &created);
+    munit_assert_false(created);
+    munit_assert_int(*value, ==, 240);
+
+    key = 777;
+    value = map_upsert(map, &key, sizeof(key), &created);
+    munit_assert(created);
+    munit_assert_int(*value, ==, 0);
+    *value = 7770;
+    munit_assert_int(*(int*)map_get(map, &key, sizeof(key)), ==, 7770);
+    munit_assert_ptr_null(map_get(map, &examples[0], sizeof(int)));
+
+    free(ctx.examples);
+    map_free(map);
+    return MUNIT_OK;
+}
+
+// Повторные очистки с удалениями и ростом таблицы между ними.
+static MunitResult test_map_clear_epoch(
+    const MunitParameter params[], void* data
+) {
+    koh_Map *map = map_new(&(struct koh_MapSetup) {
+        .key_size = sizeof(int),
+        .value_size = sizeof(int),
+    });
+
+    for (int round = 0; round < 200; round++) {
+        int num = 1 + round % 37 * 3;
+        for (int key = 0; key < num; key++) {
+            bool created = false;
+            int *value = map_upsert(map, &key, sizeof(key), &created);
+            munit_assert(created);
+            *value = key + round;
+        }
+        for (int key = 0; key < num; key += 2)
+            munit_assert(map_remove(map, &key, sizeof(key)));
+
+        int left = 0;
+        for (struct koh_MapView v = map_each_begin(map);
+                map_each_valid(&v); map_each_next(&v)) {
+            int key = *(const int*)map_each_key(&v);
+            munit_assert_int(key % 2, ==, 1);
+            munit_assert_int(*(int*)map_each_value(&v), ==, key + round);
+            left++;
+        }
+        munit_assert_int(left, ==, num / 2);
+        munit_assert_int(map_size(map), ==, num / 2);
+
+        map_clear(map);
+        munit_assert_int(map_size(map), ==, 0);
+        for (int key = 0; key < num; key++)
+            munit_assert_false(map_exist(map, &key, sizeof(key)));
+        struct koh_MapView v = map_each_begin(map);
+        munit_assert_false(map_each_valid(&v));
+    }
+
+    map_free(map);
+    return MUNIT_OK;
+}
+
+// Очистка почти пустой таблицы на 1M записей каждый кадр.
+static MunitResult test_bench_map_clear(
+    const MunitParameter params[], void* data
+) {
+    enum { CAP = 1 << 20, KEYS = 10, CLEARS = 10000, MEMSETS = 100, };
+    koh_Map *map = map_new(&(struct koh_MapSetup) {
+        .key_size = sizeof(uint32_t),
+        .capacity = CAP,
+    });
+
+    double t0 = bench_now();
+    for (int i = 0; i < CLEARS; i++) {
+        for (uint32_t key = 0; key < KEYS; key++)
+            map_add(map, &key, sizeof(key), NULL);
+        map_clear(map);
+    }
+    double t_epoch = bench_now() - t0;
+    munit_assert_int(map_size(map), ==, 0);
+
+    // Прежняя очистка: обнуление всех записей (заголовок и ключ).
+    size_t bytes = (size_t)CAP * (sizeof(uint32_t) * 2 + 8);
+    uint8_t *slots = malloc(bytes);
+    munit_assert_ptr_not_null(slots);
+    t0 = bench_now();
+    for (int i = 0; i < MEMSETS; i++) {
+        memset(slots, 0, bytes);
+        // не дать выбросить memset
+        __asm__ volatile("" : : "r"(slots) : "memory");
+    }
+    double t_memset = bench_now() - t0;
+
+    munit_logf(
+        MUNIT_LOG_INFO,
+        "capacity %d, %d keys: add + epoch clear %.3f us, "
+        "memset clear %.1f us",
+        CAP, KEYS, t_epoch * 1e6 / CLEARS, t_memset * 1e6 / MEMSETS
+    );
+
+    free(slots);
+    map_free(map);
+    return MUNIT_OK;
+}
+
+static void test_map_each_view_int_arr(int *examples, int examples_num) {
+    bool examples_exists[examples_num + 1];
+    memset(examples_exists, 0, sizeof(examples_exists));
+
+    koh_Map *map = map_new(&(struct koh_MapSetup) {
+        .key_size = sizeof(int),
+        .value_size = sizeof(int),
+    });
+
+    for (int j = 0; j < examples_num; ++j) {
+        int value = j;
+        map_add(map, &examples[j], sizeof(int), &value);
+    }
+    munit_assert_int(map_size(map), ==, examples_num);
+
+    for (struct koh_MapView v = map_each_begin(map); 
+            map_each_valid(&v);
+            map_each_next(&v)) {
+        const int *key = map_each_key(&v);
+        const int *value = map_each_value(&v);
+        munit_assert_ptr_not_null(key);
+        munit_assert_int(map_each_key_len(&v), ==, sizeof(int));
+        munit_assert_int(map_each_value_len(&v), ==, sizeof(int));
+
+        // значение - индекс ключа в examples
+        munit_assert_int(*value, >=, 0);
+        munit_assert_int(*value, <, examples_num);
+        munit_assert_int(examples[*value], ==, *key);
+        examples_exists[*value] = true;
+    }
+
+    for (int i = 0; i < examples_num; i++)
+        munit_assert(examples_exists[i]);
+
+    map_free(map);
+}
+
+static MunitResult test_map_each_view(
+    const MunitParameter params[], void* data
+) {
+    {
+        int arr1[] = { 0, 1, 2, 3, 4, 5};
+        test_map_each_view_int_arr(arr1, sizeof(arr1) / sizeof(arr1[0]));
+    }
+
+    {
+        int arr2[] = { -5, 5, -6, 6,};
+        test_map_each_view_int_arr(arr2, sizeof(arr2) / sizeof(arr2[0]));
+    }
+
+    {
+        int arr3[] = { 111 };
+        test_map_each_view_int_arr(arr3, sizeof(arr3) / sizeof(arr3[0]));
+    }
+
+    {
+        int arr4[1000];
+        for (int i = 0; i < 1000; i++)
+            arr4[i] = i * 7 - 3500;
+        test_map_each_view_int_arr(arr4, sizeof(arr4) / sizeof(arr4[0]));
+    }
+
+    test_map_each_view_int_arr(NULL, 0);
+
+    return MUNIT_OK;
+}
+
+struct TestMultiSetCtx {
+    int         *examples;
+    uint32_t    *counts;
+    int         examples_num;
+};
+
+static koh_SetAction iter_mset_check(
+    const void *key, int key_len, uint32_t count, void *udata
+) {
+    const int *key_value = key;
+    struct TestMultiSetCtx *ctx = udata;
+
+    for (int i = 0; i < ctx->examples_num; ++i) {
+        if (ctx->examples[i] == *key_value) {
+            munit_assert_uint32(count, ==, ctx->counts[i]);
+            return koh_SA_next;
+        }
     }
 
-    assert(ctx->set);
+    if (verbose)
+        printf("iter_mset_check: key_value = %d not found\n", *key_value);
+    munit_assert(false);
+    return koh_SA_next;
+}
 
-    if (!ctx->examples) {
-        printf("set_remove_through: ctx->examples == NULL\n");
-        koh_trap();
+static void mset_check_view(koh_MultiSet *mset, struct TestMultiSetCtx *ctx) {
+    int keys_num = 0;
+    uint64_t total = 0;
+    for (int i = 0; i < ctx->examples_num; i++) {
+        keys_num += ctx->counts[i] > 0;
+        total += ctx->counts[i];
     }
-
-    assert(index < ctx->examples_num);
-    ctx->examples_remove_value = ctx->examples[index];
-    ctx->examples[index] = 0;
-    ctx->examples_remove_value_found = false;
-    set_each(ctx->set, iter_set_remove_by_value, ctx);
-    if (!ctx->examples_remove_value_found) {
-        if (verbose)
-            printf(
-                "ctx->examples_remove_value: %d\n",
-                ctx->examples_remove_value
-            );
-        munit_assert(ctx->examples_remove_value_found);
+    munit_assert_int(mset_size(mset), ==, keys_num);
+    munit_assert_uint64(mset_total(mset), ==, total);
+
+    int visited = 0;
+    for (struct koh_MultiSetView v = mset_each_begin(mset);
+            mset_each_valid(&v); mset_each_next(&v)) {
+        iter_mset_check(
+            mset_each_key(&v), mset_each_key_len(&v), mset_each_count(&v), ctx
+        );
+        visited++;
     }
+    munit_assert_int(visited, ==, keys_num);
+    mset_each(mset, iter_mset_check, ctx);
 }
 
-static MunitResult test_add_remove_each(
+static MunitResult test_mset_add_remove_each(
     const MunitParameter params[], void* data
 ) {
-
     int examples[] = {
-        1,  // 0
-        3,  // 1
-        4,  // 2
-        5,  // 3
-        6,  // 4
-        7,  // 5
-        8,  // 6
-        9,  // 7
-        10, // 8
-        11, // 9
-        20, // 10
-        23, // 11
-        24  // 12
+        1, 3, 4, 5, 6, 7, 8, 9, 10, 11, 20, 23, 24
     };
-
-    koh_Set *set = set_new();
     int examples_num = sizeof(examples) / sizeof(examples[0]);
-    int examples_cap = examples_num * 10;
-    struct TestAddRemoveCtx ctx = {
-        .examples = calloc(sizeof(int), examples_cap),
+    uint32_t counts[sizeof(examples) / sizeof(examples[0])] = {};
+
+    struct TestMultiSetCtx ctx = {
+        .examples = examples,
+        .counts = counts,
         .examples_num = examples_num,
-        .set = set,
     };
-    assert(ctx.examples);
-    memcpy(ctx.examples, examples, sizeof(int) * examples_num);
-
-    for (int i = 0; i < examples_num; i++) {
-        int example_value = examples[i];
-        if (verbose)
-            printf("%d ", example_value);
-        set_add(set, &example_value, sizeof(int));
-    }
-    if (verbose) {
-        printf("\n");
-        printf("set_size(set) %d\n", set_size(set));
-    }
-    munit_assert_int(set_size(set), !=, 0);
-    set_each(set, iter_set_check, &ctx);
-
-    ctx_set_remove_through(&ctx, 0);
-    ctx_set_remove_through(&ctx, 10);
-    ctx_set_remove_through(&ctx, 12);
-    ctx_set_remove_through(&ctx, 5);
-    ctx_set_remove_through(&ctx, 6);
-    ctx_set_remove_through(&ctx, 7);
-
-    set_each(set, iter_set_check, &ctx);
 
-    bool use_print = false;
-    if (use_print)
-        printf("new elements were added: ");
-    for (int j = examples_num; j < examples_num * 2; j++) {
-        ctx.examples[ctx.examples_num++] = 100 + j;
-        if (use_print)
-            printf("%d ", ctx.examples[ctx.examples_num - 1]);
-        set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
-    }
-    if (use_print)
-        printf("\n");
+    koh_MultiSet *mset = mset_new(sizeof(int));
 
-    // XXX: Что показывают эти цифры?
-    if (verbose) {
-        for (int i = 0; i < ctx.examples_num; i++) {
-            int example_value = ctx.examples[i];
-            printf("%d ", example_value);
+    // i-й ключ добавляется i + 1 раз
+    for (int i = 0; i < examples_num; i++) {
+        for (int j = 0; j <= i; j++) {
+            uint32_t count = mset_add(mset, &examples[i], sizeof(int));
+            munit_assert_uint32(count, ==, ++counts[i]);
         }
-        printf("\n");
     }
-
-    for (int j = examples_num - 1; j < examples_num / 2; j--) {
-        if (verbose)
-            printf("j %d, ctx.examples[%d] = %d\n", j, j, ctx.examples[j]);
-        if (ctx.examples[j])
-            ctx_set_remove_through(&ctx, j);
+    mset_check_view(mset, &ctx);
+
+    // Ключ с единичным счетчиком исчезает после одного удаления.
+    munit_assert_uint32(mset_remove(mset, &examples[0], sizeof(int)), ==, 0);
+    counts[0] = 0;
+    munit_assert_false(mset_exist(mset, &examples[0], sizeof(int)));
+    munit_assert_uint32(mset_remove(mset, &examples[0], sizeof(int)), ==, 0);
+
+    // Остальные остаются пока счетчик не дойдет до нуля.
+    for (int i = 1; i < examples_num; i += 2) {
+        while (counts[i] > 1) {
+            munit_assert_uint32(
+                mset_remove(mset, &examples[i], sizeof(int)), ==, --counts[i]
+            );
+            munit_assert(mset_exist(mset, &examples[i], sizeof(int)));
+        }
     }
+    mset_check_view(mset, &ctx);
 
-    ctx.examples[ctx.examples_num++] = 1102;
-    set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
-
-    ctx.examples[ctx.examples_num++] = 1103;
-    set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
-
-    ctx.examples[ctx.examples_num++] = 1104;
-    set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
-
-    ctx.examples[ctx.examples_num++] = 1105;
-    set_add(set, &ctx.examples[ctx.examples_num - 1], sizeof(int));
-
-    set_each(set, iter_set_check, &ctx);
-
-    ctx_set_remove(&ctx, ctx.examples_num - 1);
-    ctx.examples_num--;
-    ctx_set_remove(&ctx, ctx.examples_num - 1);
-    ctx.examples_num--;
-    ctx_set_remove(&ctx, ctx.examples_num - 1);
-    ctx.examples_num--;
-    ctx_set_remove(&ctx, ctx.examples_num - 1);
-    ctx.examples_num--;
+    munit_assert(mset_remove_all(mset, &examples[12], sizeof(int)));
+    counts[12] = 0;
+    munit_assert_uint32(mset_count(mset, &examples[12], sizeof(int)), ==, 0);
+    mset_check_view(mset, &ctx);
 
-    if (verbose) {
-        for (int i = 0; i < ctx.examples_num; i++) {
-            printf("%d ", ctx.examples[i]);
+    for (int i = 0; i < examples_num; i++) {
+        while (counts[i]) {
+            mset_remove(mset, &examples[i], sizeof(int));
+            counts[i]--;
         }
-        printf("\n");
     }
+    mset_check_view(mset, &ctx);
+    munit_assert_int(mset_size(mset), ==, 0);
 
-    set_each(set, iter_set_check, &ctx);
+    mset_add(mset, &examples[3], sizeof(int));
+    mset_clear(mset);
+    munit_assert_false(mset_exist(mset, &examples[3], sizeof(int)));
+    munit_assert_uint64(mset_total(mset), ==, 0);
 
-    free(ctx.examples);
-    set_free(set);
+    mset_free(mset);
     return MUNIT_OK;
 }
 
@@ -826,6 +2881,139 @@ static MunitResult test_new_add_exist_free(
     return MUNIT_OK;
 }
 
+// Микробенчмарки для --bench: одна итерация - BENCH_SET_KEYS операций.
+enum { BENCH_SET_KEYS = 4096, };
+
+static uint64_t bench_set_key(uint32_t i) {
+    return i * 0x9e3779b97f4a7c15ULL;
+}
+
+static MunitResult test_bench_set_add(
+    const MunitParameter params[], void* data
+) {
+    koh_Set *set = set_new();
+    for (uint32_t i = 0; i < BENCH_SET_KEYS; i++) {
+        uint64_t key = bench_set_key(i);
+        set_add(set, &key, sizeof(key));
+    }
+    munit_bench_set_ops(BENCH_SET_KEYS);
+    munit_assert_int(set_size(set), ==, BENCH_SET_KEYS);
+    set_free(set);
+    return MUNIT_OK;
+}
+
+static void *bench_set_exist_setup(
+    const MunitParameter params[], void* user_data
+) {
+    koh_Set *set = set_new();
+    for (uint32_t i = 0; i < BENCH_SET_KEYS; i++) {
+        uint64_t key = bench_set_key(i);
+        set_add(set, &key, sizeof(key));
+    }
+    return set;
+}
+
+static void bench_set_exist_tear_down(void *fixture) {
+    set_free(fixture);
+}
+
+static MunitResult test_bench_set_exist(
+    const MunitParameter params[], void* data
+) {
+    koh_Set *set = data;
+    int found = 0;
+    // половина запросов - промахи
+    for (uint32_t i = 0; i < BENCH_SET_KEYS; i++) {
+        uint64_t key = bench_set_key(i / 2 + (i & 1) * BENCH_SET_KEYS);
+        found += set_exist(set, &key, sizeof(key));
+    }
+    munit_bench_set_ops(BENCH_SET_KEYS);
+    munit_assert_int(found, ==, BENCH_SET_KEYS / 2);
+    return MUNIT_OK;
+}
+
+// Поиск не должен выделять память.
+static MunitResult test_set_exist_no_alloc(
+    const MunitParameter params[], void* data
+) {
+    koh_Set *set = data;
+    int found = 0;
+    munit_alloc_reset();
+    for (uint32_t i = 0; i < BENCH_SET_KEYS * 2; i++) {
+        uint64_t key = bench_set_key(i);
+        found += set_exist(set, &key, sizeof(key));
+    }
+    munit_assert_allocs_le(0);
+    munit_assert_int(found, ==, BENCH_SET_KEYS);
+    return MUNIT_OK;
+}
+
+static MunitResult test_rand_fill(
+    const MunitParameter params[], void* data
+) {
+    enum { N = 1003 };
+    static uint32_t u1[N], u2[N];
+    static float f[N];
+    static Vector2 v[N];
+    _Static_assert(sizeof(Vector2) == 2 * sizeof(float), "Vector2 layout");
+
+    // одинаковое зерно - одинаковая последовательность, хвост не кратен
+    // числу линий генератора
+    munit_rand_seed(1234);
+    munit_rand_fill_uint32(N, u1);
+    munit_rand_seed(1234);
+    munit_rand_fill_uint32(N, u2);
+    munit_assert_memory_equal(sizeof(u1), u1, u2);
+    munit_rand_fill_uint32(N, u2);
+    munit_assert_memory_not_equal(sizeof(u1), u1, u2);
+
+    munit_rand_fill_float(N, f, -2.f, 3.f);
+    for (int i = 0; i < N; i++) {
+        munit_assert_float(f[i], >=, -2.f);
+        munit_assert_float(f[i], <=, 3.f);
+    }
+
+    munit_rand_fill_float2(N, (float*)v, 0.f, 10.f, -1.f, 0.f);
+    double sum_x = 0., sum_y = 0.;
+    for (int i = 0; i < N; i++) {
+        munit_assert_float(v[i].x, >=, 0.f);
+        munit_assert_float(v[i].x, <=, 10.f);
+        munit_assert_float(v[i].y, >=, -1.f);
+        munit_assert_float(v[i].y, <=, 0.f);
+        sum_x += v[i].x;
+        sum_y += v[i].y;
+    }
+    munit_assert_double(sum_x / N, >, 4.);
+    munit_assert_double(sum_x / N, <, 6.);
+    munit_assert_double(sum_y / N, >, -0.6);
+    munit_assert_double(sum_y / N, <, -0.4);
+    return MUNIT_OK;
+}
+
+static MunitResult test_bench_rand_fill(
+    const MunitParameter params[], void* data
+) {
+    enum { N = 1 << 20 };
+    uint32_t *keys = malloc(sizeof(keys[0]) * N);
+    munit_assert_not_null(keys);
+
+    double t0 = bench_now();
+    for (int i = 0; i < N; i++)
+        keys[i] = munit_rand_uint32();
+    double t_cas = bench_now() - t0;
+
+    t0 = bench_now();
+    munit_rand_fill_uint32(N, keys);
+    double t_fill = bench_now() - t0;
+
+    munit_logf(
+        MUNIT_LOG_INFO, "%d keys: munit_rand_uint32 %.2f ms, fill %.2f ms",
+        N, t_cas * 1e3, t_fill * 1e3
+    );
+    free(keys);
+    return MUNIT_OK;
+}
+
 static MunitTest test_suite_tests[] = {
   {
     (char*) "/each_view",
@@ -842,26 +3030,193 @@ static MunitTest test_suite_tests[] = {
     test_add_remove,
     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
   },
+  {
+    (char*) "/map_add_remove",
+    test_map_add_remove,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/map_each_view",
+    test_map_each_view,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/map_clear_epoch",
+    test_map_clear_epoch,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/bench_map_clear",
+    test_bench_map_clear,
+    NULL, NULL, MUNIT_TEST_OPTION_SINGLE_ITERATION, NULL
+  },
+  {
+    (char*) "/mset_add_remove_each",
+    test_mset_add_remove_each,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
   {
     (char*) "/new_add_exist_free",
     test_new_add_exist_free,
     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
   },
+  {
+    (char*) "/filter_add_exist_remove",
+    test_filter_add_exist_remove,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/bench_filter",
+    test_bench_filter,
+    NULL, NULL, MUNIT_TEST_OPTION_SINGLE_ITERATION, NULL
+  },
   {
     (char*) "/each",
     test_each,
     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
   },
+  {
+    (char*) "/oset_range",
+    test_oset_range,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
   {
     (char*) "/compare_1",
     test_compare_1,
     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
   },
+  {
+    (char*) "/pset_eps_radius",
+    test_pset_eps_radius,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/key_norm_float_keys",
+    test_key_norm_float_keys,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
   {
     (char*) "/compare_2_eq",
     test_compare_2_eq,
     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
   },
+  {
+    (char*) "/compare_2_eq_mapped",
+    test_compare_2_eq_mapped,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/mapped_empty_and_corrupt",
+    test_mapped_empty_and_corrupt,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/bench_mapped_startup",
+    test_bench_mapped_startup,
+    NULL, NULL, MUNIT_TEST_OPTION_SINGLE_ITERATION, NULL
+  },
+  {
+    (char*) "/stream_roundtrip",
+    test_stream_roundtrip,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/bench_stream",
+    test_bench_stream,
+    NULL, NULL, MUNIT_TEST_OPTION_SINGLE_ITERATION, NULL
+  },
+  {
+    (char*) "/strintern",
+    test_strintern,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/bench_strintern_compare",
+    test_bench_strintern_compare,
+    NULL, NULL, MUNIT_TEST_OPTION_SINGLE_ITERATION, NULL
+  },
+  {
+    (char*) "/map_key_extract",
+    test_map_key_extract,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/bench_map_key_extract",
+    test_bench_map_key_extract,
+    NULL, NULL, MUNIT_TEST_OPTION_SINGLE_ITERATION, NULL
+  },
+  {
+    (char*) "/rindex_query",
+    test_rindex_query,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/bench_rindex_query",
+    test_bench_rindex_query,
+    NULL, NULL, MUNIT_TEST_OPTION_SINGLE_ITERATION, NULL
+  },
+  {
+    (char*) "/sset_add_remove",
+    test_sset_add_remove,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/bench_sset",
+    test_bench_sset,
+    NULL, NULL, MUNIT_TEST_OPTION_SINGLE_ITERATION, NULL
+  },
+  {
+    (char*) "/bset_ops",
+    test_bset_ops,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/bench_bset",
+    test_bench_bset,
+    NULL, NULL, MUNIT_TEST_OPTION_SINGLE_ITERATION, NULL
+  },
+  {
+    (char*) "/roar_each",
+    test_roar_each,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/roar_ops",
+    test_roar_ops,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/bench_roar",
+    test_bench_roar,
+    NULL, NULL, MUNIT_TEST_OPTION_SINGLE_ITERATION, NULL
+  },
+  {
+    (char*) "/bench_set_add",
+    test_bench_set_add,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/bench_set_exist",
+    test_bench_set_exist,
+    bench_set_exist_setup, bench_set_exist_tear_down,
+    MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/set_exist_no_alloc",
+    test_set_exist_no_alloc,
+    bench_set_exist_setup, bench_set_exist_tear_down,
+    MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/rand_fill",
+    test_rand_fill,
+    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL
+  },
+  {
+    (char*) "/bench_rand_fill",
+    test_bench_rand_fill,
+    NULL, NULL, MUNIT_TEST_OPTION_SINGLE_ITERATION, NULL
+  },
   {
     (char*) "/compare_2_noeq",
     test_compare_2_noeq,